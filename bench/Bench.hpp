@@ -0,0 +1,160 @@
+#ifndef BENCH_HPP
+#define BENCH_HPP
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <vector>
+#include <spawn.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+using namespace std;
+
+/**
+ * BENCH
+ *
+ * helpers of the benchmarks under bench/ (make -C bench run), each one prints one row per case.
+ * LIB=<dir> builds them against another lib/ tree (e.g. a checkout of the previous commit) for before/after numbers
+ */
+class Bench
+{
+public:
+  using Clock = chrono::steady_clock;
+
+  static Clock::time_point now ()
+  {
+    return Clock::now ();
+  }
+
+  static double seconds ( Clock::time_point start )
+  {
+    return chrono::duration<double> ( Clock::now () - start ).count ();
+  }
+
+  /**
+   * peak RSS of this process, MB
+   */
+  static double peakRss ()
+  {
+    struct rusage ru;
+
+    getrusage ( RUSAGE_SELF, &ru );
+    return ru.ru_maxrss / 1024.0;
+  }
+
+  /**
+   * runs argv (normally this benchmark again, in a mode that does one case) in a fresh process, so one case's
+   * peak RSS does not include another's or what the parent built. the child prints its seconds on stdout.
+   * returns the child's peak RSS (MB)
+   */
+  static double spawn ( const vector<string>& argv, double& seconds )
+  {
+    int fds[2];
+
+    if ( pipe ( fds ) != 0 )
+    {
+      abort ();
+    }
+
+    /* posix_spawn shares the parent's memory until exec, a fork () copy would count in the child's peak */
+    vector<char*> args;
+    posix_spawn_file_actions_t actions;
+    pid_t pid = -1;
+
+    for ( const auto& a : argv )
+    {
+      args.push_back ( const_cast<char*> ( a.c_str () ) );
+    }
+
+    args.push_back ( nullptr );
+    fflush ( stdout );
+    posix_spawn_file_actions_init ( &actions );
+    posix_spawn_file_actions_adddup2 ( &actions, fds[1], STDOUT_FILENO );
+    posix_spawn_file_actions_addclose ( &actions, fds[0] );
+
+    if ( posix_spawn ( &pid, args[0], &actions, nullptr, args.data (), environ ) != 0 )
+    {
+      abort ();
+    }
+
+    posix_spawn_file_actions_destroy ( &actions );
+
+    char buf[64] = { 0 };
+    int status = 0;
+    struct rusage ru;
+
+    ::close ( fds[1] );
+    seconds = read ( fds[0], buf, sizeof ( buf ) - 1 ) > 0 ? strtod ( buf, nullptr ) : -1;
+    ::close ( fds[0] );
+    wait4 ( pid, &status, 0, &ru );
+
+    if ( !WIFEXITED ( status ) || WEXITSTATUS ( status ) != 0 )
+    {
+      seconds = -1;
+    }
+
+    return ru.ru_maxrss / 1024.0;
+  }
+
+  /**
+   * NID-style names: "PLANT-03/LINE-12/TEMP-000042"
+   */
+  static vector<string> names ( size_t n )
+  {
+    vector<string> out;
+    char buf[64];
+
+    out.reserve ( n );
+
+    for ( size_t i = 0; i < n; ++i )
+    {
+      snprintf ( buf, sizeof ( buf ), "PLANT-%02zu/LINE-%02zu/TEMP-%06zu", i % 7, i % 31, i );
+      out.emplace_back ( buf );
+    }
+
+    return out;
+  }
+
+  /**
+   * count zipfian ranks in [0, n), skew s (0.99 as in YCSB), rank 0 the hottest
+   */
+  static vector<uint32_t> zipf ( size_t n, size_t count, double s = 0.99, uint32_t seed = 7 )
+  {
+    vector<double> cdf ( n );
+    double sum = 0;
+
+    for ( size_t i = 0; i < n; ++i )
+    {
+      sum += 1.0 / pow ( static_cast<double> ( i + 1 ), s );
+      cdf[i] = sum;
+    }
+
+    mt19937_64 rng ( seed );
+    uniform_real_distribution<double> uni ( 0, sum );
+    vector<uint32_t> out ( count );
+
+    for ( auto& r : out )
+    {
+      r = static_cast<uint32_t> ( lower_bound ( cdf.begin (), cdf.end (), uni ( rng ) ) - cdf.begin () );
+    }
+
+    return out;
+  }
+
+  /**
+   * the optimizer must not drop the measured work
+   */
+  template <typename T> static void keep ( const T& v )
+  {
+    asm volatile ( "" : : "g"( &v ) : "memory" );
+  }
+};
+
+#endif
@@ -0,0 +1,71 @@
+#include "Bench.hpp"
+#include "kvstore/KvStore.hpp"
+#include <atomic>
+#include <new>
+
+/**
+ * heap allocations and latency per point lookup of an existing key (key (), hasKey ()), counted by replacing the
+ * global operator new. uses only the API every tree has, so LIB=<older lib> gives the before numbers
+ *
+ * usage: KvAllocBench [NIDs = 200000] [lookups = 2000000]
+ */
+static atomic<uint64_t> allocations{ 0 };
+
+void* operator new ( size_t size )
+{
+  allocations.fetch_add ( 1, memory_order_relaxed );
+
+  if ( void* p = malloc ( size ? size : 1 ) )
+  {
+    return p;
+  }
+
+  throw bad_alloc ();
+}
+
+void operator delete ( void* p ) noexcept
+{
+  free ( p );
+}
+
+void operator delete ( void* p, size_t ) noexcept
+{
+  free ( p );
+}
+
+int main ( int argc, char** argv )
+{
+  const size_t n = argc > 1 ? strtoul ( argv[1], nullptr, 10 ) : 200000;
+  const size_t lookups = argc > 2 ? strtoul ( argv[2], nullptr, 10 ) : 2000000;
+  const vector<string> keys = Bench::names ( n );
+  vector<string_view> views ( keys.begin (), keys.end () );
+  KvStore store ( n );
+
+  for ( size_t i = 0; i < n; ++i )
+  {
+    store.push ( keys[i], static_cast<double> ( i ) );
+  }
+
+  printf ( "%zu NIDs, %zu lookups\n%-8s %12s %10s\n", n, lookups, "call", "allocs/op", "ns/op" );
+
+  for ( int call = 0; call < 2; ++call )
+  {
+    size_t found = 0;
+    const uint64_t before = allocations.load ();
+    const auto t = Bench::now ();
+
+    for ( size_t i = 0; i < lookups; ++i )
+    {
+      const string_view k = views[( i * 7919 ) % n];
+
+      found += call == 0 ? store.key ( k ) != nullptr : store.hasKey ( k );
+    }
+
+    const double s = Bench::seconds ( t );
+
+    Bench::keep ( found );
+    printf ( "%-8s %12.3f %10.1f\n", call == 0 ? "key" : "hasKey", static_cast<double> ( allocations.load () - before ) / lookups, s * 1e9 / lookups );
+  }
+
+  return 0;
+}
@@ -0,0 +1,64 @@
+#include "Bench.hpp"
+#include "kvstore/KvShardedStore.hpp"
+
+/**
+ * ingest of frames of readings: one push () per reading against pushBatch () per frame, batch sizes 1 to 65536,
+ * on KvStore and KvShardedStore. the store already holds every NID (steady-state updates)
+ *
+ * usage: KvBatchBench [NIDs = 200000] [readings = 2000000]
+ */
+template <typename S> static void measure ( const char* name, const vector<string>& keys, size_t readings )
+{
+  S store ( keys.size () );
+
+  for ( const auto& k : keys )
+  {
+    store.push ( k, 0.0 );
+  }
+
+  for ( size_t batch : { 1, 16, 256, 4096, 65536 } )
+  {
+    /* frames arrive built, only the ingest is timed */
+    vector<vector<pair<string_view, KvValue>>> frames ( ( readings + batch - 1 ) / batch );
+
+    for ( size_t i = 0; i < readings; ++i )
+    {
+      frames[i / batch].emplace_back ( keys[i % keys.size ()], static_cast<double> ( i ) );
+    }
+
+    auto t = Bench::now ();
+
+    for ( const auto& frame : frames )
+    {
+      for ( const auto& [k, v] : frame )
+      {
+        store.push ( k, v );
+      }
+    }
+
+    const double single = Bench::seconds ( t );
+
+    t = Bench::now ();
+
+    for ( const auto& frame : frames )
+    {
+      store.pushBatch ( frame );
+    }
+
+    const double batched = Bench::seconds ( t );
+
+    printf ( "%-8s %8zu %14.0f %14.0f %8.2fx\n", name, batch, readings / single, readings / batched, single / batched );
+  }
+}
+
+int main ( int argc, char** argv )
+{
+  const vector<string> keys = Bench::names ( argc > 1 ? strtoul ( argv[1], nullptr, 10 ) : 200000 );
+  const size_t readings = argc > 2 ? strtoul ( argv[2], nullptr, 10 ) : 2000000;
+
+  printf ( "%zu NIDs, %zu readings\n%-8s %8s %14s %14s %9s\n", keys.size (), readings, "store", "batch", "push/s", "pushBatch/s", "speedup" );
+  measure<KvStore> ( "single", keys, readings );
+  measure<KvShardedStore> ( "sharded", keys, readings );
+
+  return 0;
+}
@@ -0,0 +1,69 @@
+#include "Bench.hpp"
+#include "kvstore/KvStore.hpp"
+#include <thread>
+
+/**
+ * zipfian (s = 0.99) reads through KvStore::key (), which checks the hot cache first, with a 1% write mix
+ * that invalidates cached keys. uses only the API every tree has, so LIB=<older lib> gives the before numbers
+ *
+ * usage: KvCacheBench [NIDs = 200000] [reads = 2000000] [threads = 4]
+ */
+int main ( int argc, char** argv )
+{
+  const size_t n = argc > 1 ? strtoul ( argv[1], nullptr, 10 ) : 200000;
+  const size_t reads = argc > 2 ? strtoul ( argv[2], nullptr, 10 ) : 2000000;
+  const size_t threads = argc > 3 ? strtoul ( argv[3], nullptr, 10 ) : 4;
+  const vector<string> keys = Bench::names ( n );
+  const vector<uint32_t> ranks = Bench::zipf ( n, reads );
+  KvStore store ( n );
+
+  for ( size_t i = 0; i < n; ++i )
+  {
+    store.push ( keys[i], static_cast<double> ( i ) );
+  }
+
+  printf ( "%zu NIDs, %zu zipfian reads, %zu threads\n%-10s %12s %10s\n", n, reads, threads, "writes", "reads/s", "ns/read" );
+
+  for ( size_t every : { 0, 100 } )
+  {
+    vector<thread> workers;
+    const auto t = Bench::now ();
+
+    for ( size_t w = 0; w < threads; ++w )
+    {
+      workers.emplace_back (
+          [&, w]
+          {
+            double sum = 0;
+
+            for ( size_t i = w; i < reads; i += threads )
+            {
+              const string& k = keys[ranks[i]];
+
+              if ( every && i % every == 0 )
+              {
+                store.push ( k, static_cast<double> ( i ) );
+                continue;
+              }
+
+              const auto data = store.key ( k );
+
+              sum += data ? 1 : 0;
+            }
+
+            Bench::keep ( sum );
+          } );
+    }
+
+    for ( auto& worker : workers )
+    {
+      worker.join ();
+    }
+
+    const double s = Bench::seconds ( t );
+
+    printf ( "%-10s %12.0f %10.1f\n", every ? "1%" : "none", reads / s, s * 1e9 / reads );
+  }
+
+  return 0;
+}
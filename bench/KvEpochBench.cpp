@@ -0,0 +1,87 @@
+#include "Bench.hpp"
+#include "kvstore/KvStore.hpp"
+#include <thread>
+
+/**
+ * read-heavy (99% reads, 1% pushes) scaling of KvReadMode::EPOCH against LOCKED (shared_mutex), 1 to 64 threads.
+ * reads go through key () (a shared_ptr copy, the path before EPOCH) or read (), which hands out a reference
+ * without shared_ptr traffic in EPOCH mode
+ *
+ * usage: KvEpochBench [ops per thread = 200000] [NIDs = 200000]
+ */
+static double run ( KvStore& store, const vector<string>& keys, size_t threads, size_t ops, bool copy )
+{
+  vector<thread> workers;
+  const auto t = Bench::now ();
+
+  for ( size_t w = 0; w < threads; ++w )
+  {
+    workers.emplace_back (
+        [&, w]
+        {
+          double sum = 0;
+
+          for ( size_t i = 0; i < ops; ++i )
+          {
+            const string& k = keys[( w * 7919 + i * 31 ) % keys.size ()];
+
+            if ( i % 100 == 0 )
+            {
+              store.push ( k, static_cast<double> ( i ) );
+              continue;
+            }
+
+            if ( copy )
+            {
+              const auto data = store.key ( k );
+
+              sum += data ? data->getId () : 0;
+            }
+            else
+            {
+              store.read ( k, [&sum] ( const KvData& d ) { sum += d.getId (); } );
+            }
+          }
+
+          Bench::keep ( sum );
+        } );
+  }
+
+  for ( auto& worker : workers )
+  {
+    worker.join ();
+  }
+
+  return threads * ops / Bench::seconds ( t );
+}
+
+int main ( int argc, char** argv )
+{
+  const size_t ops = argc > 1 ? strtoul ( argv[1], nullptr, 10 ) : 200000;
+  const vector<string> keys = Bench::names ( argc > 2 ? strtoul ( argv[2], nullptr, 10 ) : 200000 );
+
+  printf ( "%zu hardware threads, op/s\n%8s %16s %16s %16s\n", static_cast<size_t> ( thread::hardware_concurrency () ), "threads", "LOCKED key ()", "LOCKED read ()", "EPOCH read ()" );
+
+  for ( size_t threads : { 1, 2, 4, 8, 16, 32, 64 } )
+  {
+    double result[3];
+
+    for ( int mode = 0; mode < 3; ++mode )
+    {
+      KvStore store ( keys.size () );
+
+      store.setReadMode ( mode == 2 ? KvReadMode::EPOCH : KvReadMode::LOCKED );
+
+      for ( const auto& k : keys )
+      {
+        store.push ( k, 0.0 );
+      }
+
+      result[mode] = run ( store, keys, threads, ops, mode == 0 );
+    }
+
+    printf ( "%8zu %16.0f %16.0f %16.0f\n", threads, result[0], result[1], result[2] );
+  }
+
+  return 0;
+}
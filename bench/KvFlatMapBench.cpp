@@ -0,0 +1,107 @@
+#include "Bench.hpp"
+#include "kvstore/KvStore.hpp"
+#include <cstring>
+#include <filesystem>
+
+/**
+ * FlatHashMap against HashmapPool (unordered_map on boost::fast_pool_allocator) with int -> shared_ptr entries:
+ * memory per entry and 50% hit lookups, each case in its own process (KvFlatMapBench case flat|pool <entries>),
+ * then steady erase + insert churn at capacity 16384 with the live size just under the 7/8 load
+ *
+ * usage: KvFlatMapBench [entries = 200000,16000000] [churn ops = 200000]
+ */
+using Flat = FlatHashMap<int, shared_ptr<int>, KvIntHash>;
+using Pool = HashmapPool<int, shared_ptr<int>, KvIntHash>;
+
+template <typename M> static double lookups ( size_t n )
+{
+  M map;
+
+  for ( size_t i = 0; i < n; ++i )
+  {
+    map.try_emplace ( static_cast<int> ( i * 2 ), nullptr );
+  }
+
+  /* odd keys miss */
+  const size_t count = 4000000;
+  size_t found = 0;
+  const auto t = Bench::now ();
+
+  for ( size_t i = 0; i < count; ++i )
+  {
+    found += map.count ( static_cast<int> ( ( i * 7919 ) % ( n * 2 ) ) );
+  }
+
+  const double s = Bench::seconds ( t );
+
+  Bench::keep ( found );
+  return s / count;
+}
+
+static void churn ( size_t n, size_t ops )
+{
+  Flat map ( n );
+  int next = 0;
+
+  for ( ; next < static_cast<int> ( n ); ++next )
+  {
+    map.try_emplace ( next, nullptr );
+  }
+
+  const auto t = Bench::now ();
+
+  for ( size_t i = 0; i < ops; ++i, ++next )
+  {
+    map.erase ( next - static_cast<int> ( n ) );
+    map.try_emplace ( next, nullptr );
+  }
+
+  const double s = Bench::seconds ( t );
+
+  printf ( "churn    %10zu %10zu %10.2f %12.1f\n", n, map.capacity (), s, s * 1e9 / ops );
+}
+
+int main ( int argc, char** argv )
+{
+  if ( argc == 4 && strcmp ( argv[1], "case" ) == 0 )
+  {
+    const string kind = argv[2];
+    const size_t n = strtoul ( argv[3], nullptr, 10 );
+
+    printf ( "%.12f\n", kind == "flat" ? lookups<Flat> ( n ) : kind == "pool" ? lookups<Pool> ( n ) : 0.0 );
+    return 0;
+  }
+
+  vector<size_t> sizes = { 200000, 16000000 };
+
+  if ( argc > 1 )
+  {
+    sizes = { strtoul ( argv[1], nullptr, 10 ) };
+  }
+
+  const size_t ops = argc > 2 ? strtoul ( argv[2], nullptr, 10 ) : 200000;
+  const string self = filesystem::canonical ( "/proc/self/exe" ).string ();
+  double seconds = 0;
+  const double empty = Bench::spawn ( { self, "case", "none", "0" }, seconds );
+
+  printf ( "%-8s %10s %10s %12s %12s\n", "map", "entries", "RSS MB", "bytes/entry", "ns/lookup" );
+
+  for ( size_t n : sizes )
+  {
+    for ( const char* kind : { "flat", "pool" } )
+    {
+      const double rss = Bench::spawn ( { self, "case", kind, to_string ( n ) }, seconds );
+
+      printf ( "%-8s %10zu %10.1f %12.1f %12.1f\n", kind, n, rss - empty, ( rss - empty ) * 1048576.0 / n, seconds * 1e9 );
+    }
+  }
+
+  printf ( "\n%zu erase + insert\n%-8s %10s %10s %10s %12s\n", ops, "", "live", "capacity", "seconds", "ns/op" );
+
+  for ( size_t n : { 12000, 14000, 14335, 14336 } )
+  {
+    churn ( n, ops );
+  }
+
+  return 0;
+}
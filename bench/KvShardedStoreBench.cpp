@@ -0,0 +1,74 @@
+#include "Bench.hpp"
+#include "kvstore/KvShardedStore.hpp"
+#include <thread>
+
+/**
+ * push/get scaling of KvShardedStore against a single KvStore (one shared_mutex), 1 to 64 threads.
+ * every thread runs the same mix on its own slice of the keys: 1 push per 4 gets
+ *
+ * usage: KvShardedStoreBench [ops per thread = 200000] [NIDs = 200000]
+ */
+template <typename S> static double run ( S& store, const vector<string>& keys, size_t threads, size_t ops )
+{
+  vector<thread> workers;
+  const auto t = Bench::now ();
+
+  for ( size_t w = 0; w < threads; ++w )
+  {
+    workers.emplace_back (
+        [&, w]
+        {
+          size_t found = 0;
+
+          for ( size_t i = 0; i < ops; ++i )
+          {
+            const string& k = keys[( w * 7919 + i * 31 ) % keys.size ()];
+
+            if ( i % 5 == 0 )
+            {
+              store.push ( k, static_cast<int64_t> ( i ) );
+            }
+            else
+            {
+              found += store.hasKey ( k );
+            }
+          }
+
+          Bench::keep ( found );
+        } );
+  }
+
+  for ( auto& worker : workers )
+  {
+    worker.join ();
+  }
+
+  return threads * ops / Bench::seconds ( t );
+}
+
+int main ( int argc, char** argv )
+{
+  const size_t ops = argc > 1 ? strtoul ( argv[1], nullptr, 10 ) : 200000;
+  const vector<string> keys = Bench::names ( argc > 2 ? strtoul ( argv[2], nullptr, 10 ) : 200000 );
+
+  printf ( "%zu hardware threads\n%8s %14s %14s\n", static_cast<size_t> ( thread::hardware_concurrency () ), "threads", "KvStore op/s", "sharded op/s" );
+
+  for ( size_t threads : { 1, 2, 4, 8, 16, 32, 64 } )
+  {
+    KvStore single ( keys.size () );
+    KvShardedStore sharded ( keys.size () );
+
+    for ( const auto& k : keys )
+    {
+      single.push ( k, int64_t ( 0 ) );
+      sharded.push ( k, int64_t ( 0 ) );
+    }
+
+    const double a = run ( single, keys, threads, ops );
+    const double b = run ( sharded, keys, threads, ops );
+
+    printf ( "%8zu %14.0f %14.0f\n", threads, a, b );
+  }
+
+  return 0;
+}
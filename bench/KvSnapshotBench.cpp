@@ -0,0 +1,80 @@
+#include "Bench.hpp"
+#include "kvstore/KvStore.hpp"
+#include <cstring>
+#include <filesystem>
+
+/**
+ * flush and cold-start load time and peak RSS of a KvStore snapshot, YAML against BINARY.
+ * every case runs in its own process (KvSnapshotBench push|flush|load ...)
+ *
+ * usage: KvSnapshotBench [NIDs = 200000] [dir = /tmp]
+ */
+static void fill ( KvStore& store, const vector<string>& keys )
+{
+  for ( size_t i = 0; i < keys.size (); ++i )
+  {
+    store.push ( keys[i], i % 3 == 0 ? KvValue ( static_cast<double> ( i ) * 0.5 ) : i % 3 == 1 ? KvValue ( static_cast<int64_t> ( i ) ) : KvValue ( string ( "ok" ) ) );
+  }
+}
+
+int main ( int argc, char** argv )
+{
+  if ( argc == 4 && strcmp ( argv[1], "load" ) == 0 )
+  {
+    const size_t n = strtoul ( argv[3], nullptr, 10 );
+    const auto t = Bench::now ();
+    KvStore store ( n );
+
+    store.load ( argv[2] );
+    printf ( "%f\n", Bench::seconds ( t ) );
+    return store.size () == n ? 0 : 1;
+  }
+
+  if ( argc == 5 && strcmp ( argv[1], "flush" ) == 0 )
+  {
+    KvStore store ( strtoul ( argv[4], nullptr, 10 ) );
+
+    fill ( store, Bench::names ( strtoul ( argv[4], nullptr, 10 ) ) );
+    store.setFormat ( strcmp ( argv[2], "yaml" ) == 0 ? KvFormat::YAML : KvFormat::BINARY );
+
+    const auto t = Bench::now ();
+
+    store.flush ( argv[3] );
+    printf ( "%f\n", Bench::seconds ( t ) );
+    return 0;
+  }
+
+  if ( argc == 3 && strcmp ( argv[1], "push" ) == 0 )
+  {
+    const vector<string> keys = Bench::names ( strtoul ( argv[2], nullptr, 10 ) );
+    const auto t = Bench::now ();
+    KvStore store ( keys.size () );
+
+    fill ( store, keys );
+    printf ( "%f\n", Bench::seconds ( t ) );
+    return 0;
+  }
+
+  const size_t n = argc > 1 ? strtoul ( argv[1], nullptr, 10 ) : 200000;
+  const string dir = argc > 2 ? argv[2] : "/tmp";
+  const string self = filesystem::canonical ( "/proc/self/exe" ).string ();
+  double seconds = 0;
+  const double rss = Bench::spawn ( { self, "push", to_string ( n ) }, seconds );
+
+  printf ( "%zu NIDs, built by push (): %.3f s, peak RSS %.1f MB\n", n, seconds, rss );
+  printf ( "%-8s %10s %13s %10s %10s %12s\n", "format", "flush s", "flush RSS MB", "MB", "load s", "load RSS MB" );
+
+  for ( const char* format : { "yaml", "binary" } )
+  {
+    const string file = dir + "/kvsnapshot-bench-" + to_string ( getpid () ) + "." + format;
+    double flushed = 0;
+    double loaded = 0;
+    const double written = Bench::spawn ( { self, "flush", format, file, to_string ( n ) }, flushed );
+    const double peak = Bench::spawn ( { self, "load", file, to_string ( n ) }, loaded );
+
+    printf ( "%-8s %10.3f %13.1f %10.1f %10.3f %12.1f\n", format, flushed, written, filesystem::file_size ( file ) / 1e6, loaded, peak );
+    filesystem::remove ( file );
+  }
+
+  return 0;
+}
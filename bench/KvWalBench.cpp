@@ -0,0 +1,77 @@
+#include "Bench.hpp"
+#include "kvstore/KvStore.hpp"
+#include <filesystem>
+#include <thread>
+
+/**
+ * push throughput of a KvStore per WAL fsync policy, against no WAL.
+ * ALWAYS group-commits what the other threads appended while a sync runs, so it is measured at several thread counts
+ *
+ * usage: KvWalBench [pushes = 200000] [dir = /tmp]
+ */
+int main ( int argc, char** argv )
+{
+  const size_t n = argc > 1 ? strtoul ( argv[1], nullptr, 10 ) : 200000;
+  const string dir = ( argc > 2 ? argv[2] : "/tmp" ) + string ( "/kvwal-bench-" ) + to_string ( getpid () );
+  const vector<string> keys = Bench::names ( 20000 );
+
+  struct Case
+  {
+    const char* name;
+    bool wal;
+    KvWalSync sync;
+  };
+
+  printf ( "%-9s %8s %10s %12s\n", "policy", "threads", "pushes", "pushes/s" );
+
+  for ( const Case& c : { Case{ "no wal", false, KvWalSync::NONE }, Case{ "NONE", true, KvWalSync::NONE }, Case{ "INTERVAL", true, KvWalSync::INTERVAL }, Case{ "ALWAYS", true, KvWalSync::ALWAYS } } )
+  {
+    for ( size_t threads : { 1, 4, 16 } )
+    {
+      /* one fsync per push single threaded: fewer pushes keep the case short */
+      const size_t total = c.sync == KvWalSync::ALWAYS && c.wal ? n / 20 : n;
+      KvWalOptions options;
+
+      options.path = dir + "/wal";
+      options.sync = c.sync;
+      filesystem::remove_all ( dir );
+      filesystem::create_directories ( dir );
+
+      KvStore store ( keys.size () );
+
+      if ( c.wal )
+      {
+        store.openWal ( options );
+      }
+
+      vector<thread> workers;
+      const auto t = Bench::now ();
+
+      for ( size_t w = 0; w < threads; ++w )
+      {
+        workers.emplace_back (
+            [&, w]
+            {
+              for ( size_t i = w; i < total; i += threads )
+              {
+                store.push ( keys[i % keys.size ()], static_cast<int64_t> ( i ) );
+              }
+            } );
+      }
+
+      for ( auto& worker : workers )
+      {
+        worker.join ();
+      }
+
+      store.close ();
+
+      const double s = Bench::seconds ( t );
+
+      printf ( "%-9s %8zu %10zu %12.0f\n", c.name, threads, total, total / s );
+    }
+  }
+
+  filesystem::remove_all ( dir );
+  return 0;
+}
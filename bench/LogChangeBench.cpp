@@ -0,0 +1,59 @@
+#include "Bench.hpp"
+#include "log/LogRecord.hpp"
+#include <cstring>
+#include <filesystem>
+
+/**
+ * memory and latency of LogChangeDetector at its default capacity (every NID) with only some NIDs in use.
+ * each case runs in its own process (LogChangeBench case <NIDs> <rounds>), memory is its peak RSS against an
+ * empty run of the same process
+ *
+ * usage: LogChangeBench [rounds = 20]
+ */
+int main ( int argc, char** argv )
+{
+  if ( argc == 4 && strcmp ( argv[1], "case" ) == 0 )
+  {
+    const size_t n = strtoul ( argv[2], nullptr, 10 );
+    const size_t rounds = strtoul ( argv[3], nullptr, 10 );
+
+    if ( n == 0 )
+    {
+      printf ( "0\n" );
+      return 0;
+    }
+
+    LogChangeDetector detector;
+    size_t changes = 0;
+    const auto t = Bench::now ();
+
+    for ( size_t round = 0; round < rounds; ++round )
+    {
+      for ( size_t i = 0; i < n; ++i )
+      {
+        /* a third of the NIDs change every round */
+        changes += detector.changed ( static_cast<uint32_t> ( i ), static_cast<int32_t> ( i * 7 + ( i % 3 == 0 ? round : 0 ) ), 0 );
+      }
+    }
+
+    Bench::keep ( changes );
+    printf ( "%.12f\n", Bench::seconds ( t ) / static_cast<double> ( max<size_t> ( rounds * n, 1 ) ) );
+    return 0;
+  }
+
+  const size_t rounds = argc > 1 ? strtoul ( argv[1], nullptr, 10 ) : 20;
+  const string self = filesystem::canonical ( "/proc/self/exe" ).string ();
+  double seconds = 0;
+  const double empty = Bench::spawn ( { self, "case", "0", "0" }, seconds );
+
+  printf ( "capacity %zu NIDs\n%10s %10s %12s\n", static_cast<size_t> ( LOG_NID_MAX + 1 ), "NIDs", "RSS MB", "ns/record" );
+
+  for ( size_t n : { 1, 200000, 2000000 } )
+  {
+    const double rss = Bench::spawn ( { self, "case", to_string ( n ), to_string ( rounds ) }, seconds );
+
+    printf ( "%10zu %10.1f %12.1f\n", n, rss - empty, seconds * 1e9 );
+  }
+
+  return 0;
+}
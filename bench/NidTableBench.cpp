@@ -0,0 +1,76 @@
+#include "Bench.hpp"
+#include "kvstore/KvStore.hpp"
+#include "kvstore/NidTable.hpp"
+#include <cstring>
+#include <filesystem>
+
+/**
+ * memory per NID and update latency of NidTable against KvStore as the memory DB.
+ * each case runs in its own process (NidTableBench case kvstore|nidtable <NIDs> <rounds>), memory is its peak RSS
+ * against an empty run of the same process
+ *
+ * usage: NidTableBench [NIDs = 200000] [rounds = 20]
+ */
+static void update ( NidTable* table, KvStore* store, const vector<string>& names, size_t round )
+{
+  for ( size_t i = 0; i < names.size (); ++i )
+  {
+    /* a third of the NIDs change every round */
+    const int32_t value = static_cast<int32_t> ( i * 7 + ( i % 3 == 0 ? round : 0 ) );
+
+    if ( table )
+    {
+      Bench::keep ( table->update ( uint24_t ( static_cast<uint32_t> ( i ) ), value, 0, round ) );
+    }
+    else if ( store )
+    {
+      store->push ( names[i], static_cast<double> ( value ) );
+    }
+  }
+}
+
+int main ( int argc, char** argv )
+{
+  if ( argc == 5 && strcmp ( argv[1], "case" ) == 0 )
+  {
+    const string kind = argv[2];
+    const vector<string> names = Bench::names ( strtoul ( argv[3], nullptr, 10 ) );
+    const size_t rounds = strtoul ( argv[4], nullptr, 10 );
+    unique_ptr<NidTable> table = kind == "nidtable" ? make_unique<NidTable> () : nullptr;
+    unique_ptr<KvStore> store = kind == "kvstore" ? make_unique<KvStore> ( names.size () ) : nullptr;
+
+    for ( size_t i = 0; table && i < names.size (); ++i )
+    {
+      table->setName ( uint24_t ( static_cast<uint32_t> ( i ) ), names[i] );
+    }
+
+    update ( table.get (), store.get (), names, 0 );
+
+    const auto t = Bench::now ();
+
+    for ( size_t round = 1; round <= rounds; ++round )
+    {
+      update ( table.get (), store.get (), names, round );
+    }
+
+    printf ( "%.12f\n", Bench::seconds ( t ) / static_cast<double> ( max<size_t> ( rounds * names.size (), 1 ) ) );
+    return 0;
+  }
+
+  const size_t n = argc > 1 ? strtoul ( argv[1], nullptr, 10 ) : 200000;
+  const size_t rounds = argc > 2 ? strtoul ( argv[2], nullptr, 10 ) : 20;
+  const string self = filesystem::canonical ( "/proc/self/exe" ).string ();
+  double seconds = 0;
+  const double empty = Bench::spawn ( { self, "case", "none", to_string ( n ), "0" }, seconds );
+
+  printf ( "%zu NIDs (process with the names only: %.1f MB)\n%-9s %10s %12s %12s\n", n, empty, "db", "RSS MB", "bytes/NID", "ns/update" );
+
+  for ( const char* kind : { "kvstore", "nidtable" } )
+  {
+    const double rss = Bench::spawn ( { self, "case", kind, to_string ( n ), to_string ( rounds ) }, seconds );
+
+    printf ( "%-9s %10.1f %12.0f %12.1f\n", kind, rss - empty, ( rss - empty ) * 1048576.0 / n, seconds * 1e9 );
+  }
+
+  return 0;
+}
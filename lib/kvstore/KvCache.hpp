@@ -0,0 +1,285 @@
+#ifndef KV_CACHE_HPP
+#define KV_CACHE_HPP
+
+#include "KvHash.hpp"
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+using namespace std;
+
+constexpr size_t KV_CACHE_SHARD_NUM = 16;
+
+struct KvCacheStats
+{
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t evictions;
+  size_t size;
+};
+
+/**
+ * CLOCK CACHE
+ *
+ * bounded, sharded second-chance cache
+ * - get () takes the shard's shared lock and only sets the slot's reference bit
+ * - insert () evicts with the clock hand, a referenced slot gets a second chance
+ * - the index is keyed by a KvDigest viewing the slot's own key, lookups never allocate
+ *   and callers that already hashed the key pass the digest in
+ */
+template <typename T> class ClockCache
+{
+private:
+  struct Slot
+  {
+    string key;
+    uint64_t digest = 0;
+    T value{};
+    mutable atomic<uint8_t> ref{ 0 };
+  };
+
+  struct alignas ( 64 ) Shard
+  {
+    mutable shared_mutex mutex;
+    unique_ptr<Slot[]> slots;
+    size_t capacity = 0;
+    size_t count = 0;
+    size_t hand = 0;
+    vector<uint32_t> free;
+    unordered_map<KvDigest, uint32_t, KvDigestHash> index;
+
+    mutable atomic<uint64_t> hits{ 0 };
+    mutable atomic<uint64_t> misses{ 0 };
+    atomic<uint64_t> evictions{ 0 };
+  };
+
+  unique_ptr<Shard[]> _shards;
+
+public:
+  explicit ClockCache ( size_t c = 10000 ) : _shards ( new Shard[KV_CACHE_SHARD_NUM] )
+  {
+    setCapacity ( c );
+  }
+
+  void insert ( string_view k, T v )
+  {
+    insert ( KvDigest ( k ), move ( v ) );
+  }
+
+  void insert ( const KvDigest& k, T v )
+  {
+    Shard& s = shard ( k );
+
+    /* @MUTEX-LOCK */
+    unique_lock<shared_mutex> lock ( s.mutex );
+
+    if ( s.capacity == 0 )
+    {
+      return;
+    }
+
+    auto it = s.index.find ( k );
+
+    if ( it != s.index.end () )
+    {
+      Slot& slot = s.slots[it->second];
+
+      slot.value = move ( v );
+      slot.ref.store ( 1, memory_order_relaxed );
+      return;
+    }
+
+    uint32_t idx;
+
+    if ( !s.free.empty () )
+    {
+      idx = s.free.back ();
+      s.free.pop_back ();
+    }
+    else if ( s.count < s.capacity )
+    {
+      idx = static_cast<uint32_t> ( s.count++ );
+    }
+    else
+    {
+      idx = evict ( s );
+    }
+
+    Slot& slot = s.slots[idx];
+
+    slot.key.assign ( k.key.data (), k.key.size () );
+    slot.digest = k.value;
+    slot.value = move ( v );
+    slot.ref.store ( 0, memory_order_relaxed );
+
+    s.index.emplace ( KvDigest ( slot.key, slot.digest ), idx );
+  }
+
+  optional<T> get ( string_view k ) const
+  {
+    return get ( KvDigest ( k ) );
+  }
+
+  optional<T> get ( const KvDigest& k ) const
+  {
+    const Shard& s = shard ( k );
+
+    /* @MUTEX-LOCK */
+    shared_lock<shared_mutex> lock ( s.mutex );
+
+    auto it = s.index.find ( k );
+
+    if ( it == s.index.end () )
+    {
+      s.misses.fetch_add ( 1, memory_order_relaxed );
+      return nullopt;
+    }
+
+    const Slot& slot = s.slots[it->second];
+
+    if ( !slot.ref.load ( memory_order_relaxed ) )
+    {
+      slot.ref.store ( 1, memory_order_relaxed );
+    }
+
+    s.hits.fetch_add ( 1, memory_order_relaxed );
+    return slot.value;
+  }
+
+  bool remove ( string_view k )
+  {
+    return remove ( KvDigest ( k ) );
+  }
+
+  bool remove ( const KvDigest& k )
+  {
+    Shard& s = shard ( k );
+
+    /* @MUTEX-LOCK */
+    unique_lock<shared_mutex> lock ( s.mutex );
+
+    auto it = s.index.find ( k );
+
+    if ( it == s.index.end () )
+    {
+      return false;
+    }
+
+    const uint32_t idx = it->second;
+    Slot& slot = s.slots[idx];
+
+    s.index.erase ( it );
+    release ( slot );
+    s.free.push_back ( idx );
+
+    return true;
+  }
+
+  void clear ()
+  {
+    for ( size_t i = 0; i < KV_CACHE_SHARD_NUM; ++i )
+    {
+      Shard& s = _shards[i];
+
+      /* @MUTEX-LOCK */
+      unique_lock<shared_mutex> lock ( s.mutex );
+      reset ( s, s.capacity );
+    }
+  }
+
+  /**
+   * drops the cached entries
+   */
+  void setCapacity ( size_t c )
+  {
+    const size_t per = ( c + KV_CACHE_SHARD_NUM - 1 ) / KV_CACHE_SHARD_NUM;
+
+    for ( size_t i = 0; i < KV_CACHE_SHARD_NUM; ++i )
+    {
+      Shard& s = _shards[i];
+
+      /* @MUTEX-LOCK */
+      unique_lock<shared_mutex> lock ( s.mutex );
+      reset ( s, per );
+    }
+  }
+
+  KvCacheStats stats () const
+  {
+    KvCacheStats r{ 0, 0, 0, 0 };
+
+    for ( size_t i = 0; i < KV_CACHE_SHARD_NUM; ++i )
+    {
+      const Shard& s = _shards[i];
+
+      r.hits += s.hits.load ( memory_order_relaxed );
+      r.misses += s.misses.load ( memory_order_relaxed );
+      r.evictions += s.evictions.load ( memory_order_relaxed );
+
+      /* @MUTEX-LOCK */
+      shared_lock<shared_mutex> lock ( s.mutex );
+      r.size += s.index.size ();
+    }
+
+    return r;
+  }
+
+private:
+  /* bits 48.., KvShardedStore picks its shard from bits 32.. of the same digest */
+  Shard& shard ( const KvDigest& k ) const
+  {
+    return _shards[( k.value >> 48 ) & ( KV_CACHE_SHARD_NUM - 1 )];
+  }
+
+  uint32_t evict ( Shard& s )
+  {
+    while ( true )
+    {
+      Slot& slot = s.slots[s.hand];
+      const uint32_t idx = static_cast<uint32_t> ( s.hand );
+
+      s.hand = ( s.hand + 1 ) % s.capacity;
+
+      if ( slot.ref.load ( memory_order_relaxed ) )
+      {
+        slot.ref.store ( 0, memory_order_relaxed );
+        continue;
+      }
+
+      s.index.erase ( KvDigest ( slot.key, slot.digest ) );
+      release ( slot );
+      s.evictions.fetch_add ( 1, memory_order_relaxed );
+
+      return idx;
+    }
+  }
+
+  static void release ( Slot& slot )
+  {
+    slot.key.clear ();
+    slot.digest = 0;
+    slot.value = T{};
+    slot.ref.store ( 0, memory_order_relaxed );
+  }
+
+  static void reset ( Shard& s, size_t capacity )
+  {
+    s.index.clear ();
+    s.free.clear ();
+    s.slots.reset ( capacity ? new Slot[capacity] : nullptr );
+    s.capacity = capacity;
+    s.count = 0;
+    s.hand = 0;
+    s.index.reserve ( capacity );
+  }
+};
+
+#endif
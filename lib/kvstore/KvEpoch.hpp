@@ -0,0 +1,367 @@
+#ifndef KV_EPOCH_HPP
+#define KV_EPOCH_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std;
+
+constexpr size_t EPOCH_STRIPES = 64;
+constexpr size_t EPOCH_RECLAIM_THRESHOLD = 1024;
+
+/**
+ * EPOCH DOMAIN
+ *
+ * two-parity epoch based reclamation (userspace RCU style)
+ * - a reader bumps the counter of the current parity in its own cache line stripe,
+ *   no shared reference count is touched
+ * - writers unlink first, then retire (); collect () flips the epoch, waits until the
+ *   readers of the previous parity have left and frees everything retired before the flip
+ */
+class EpochDomain
+{
+private:
+  struct alignas ( 64 ) Stripe
+  {
+    atomic<uint64_t> readers[2];
+  };
+
+  struct Retired
+  {
+    void* ptr;
+    void ( *free ) ( void* );
+  };
+
+  atomic<uint64_t> _epoch{ 0 };
+  unique_ptr<Stripe[]> _stripes;
+  mutex _mutex;
+  vector<Retired> _retired;
+  atomic<size_t> _pending{ 0 };
+
+public:
+  class Guard
+  {
+  private:
+    atomic<uint64_t>* _counter;
+
+  public:
+    explicit Guard ( const EpochDomain& domain )
+    {
+      Stripe& s = domain._stripes[stripe ()];
+
+      while ( true )
+      {
+        const uint64_t e = domain._epoch.load ( memory_order_seq_cst );
+
+        _counter = &s.readers[e & 1];
+        _counter->fetch_add ( 1, memory_order_seq_cst );
+
+        if ( domain._epoch.load ( memory_order_seq_cst ) == e )
+        {
+          break;
+        }
+
+        _counter->fetch_sub ( 1, memory_order_release );
+      }
+    }
+
+    ~Guard ()
+    {
+      _counter->fetch_sub ( 1, memory_order_release );
+    }
+
+    Guard ( const Guard& ) = delete;
+    Guard& operator= ( const Guard& ) = delete;
+  };
+
+  EpochDomain () : _stripes ( new Stripe[EPOCH_STRIPES] )
+  {
+    for ( size_t i = 0; i < EPOCH_STRIPES; ++i )
+    {
+      _stripes[i].readers[0] = 0;
+      _stripes[i].readers[1] = 0;
+    }
+  }
+
+  ~EpochDomain ()
+  {
+    for ( auto& r : _retired )
+    {
+      r.free ( r.ptr );
+    }
+  }
+
+  EpochDomain ( const EpochDomain& ) = delete;
+  EpochDomain& operator= ( const EpochDomain& ) = delete;
+
+  template <typename T> void retire ( T* p )
+  {
+    /* @MUTEX-LOCK */
+    lock_guard<mutex> lock ( _mutex );
+    _retired.push_back ( { p, [] ( void* x ) { delete static_cast<T*> ( x ); } } );
+    _pending.store ( _retired.size (), memory_order_relaxed );
+  }
+
+  /**
+   * call without holding locks readers could wait on
+   */
+  void collect ( bool force = false )
+  {
+    vector<Retired> ready;
+
+    if ( !force && _pending.load ( memory_order_relaxed ) < EPOCH_RECLAIM_THRESHOLD )
+    {
+      return;
+    }
+
+    {
+      /* @MUTEX-LOCK */
+      lock_guard<mutex> lock ( _mutex );
+
+      if ( _retired.empty () || ( !force && _retired.size () < EPOCH_RECLAIM_THRESHOLD ) )
+      {
+        return;
+      }
+
+      ready.swap ( _retired );
+      _pending.store ( 0, memory_order_relaxed );
+
+      const uint64_t old = _epoch.fetch_add ( 1, memory_order_seq_cst ) & 1;
+
+      for ( size_t i = 0; i < EPOCH_STRIPES; ++i )
+      {
+        while ( _stripes[i].readers[old].load ( memory_order_acquire ) != 0 )
+        {
+          this_thread::yield ();
+        }
+      }
+    }
+
+    for ( auto& r : ready )
+    {
+      r.free ( r.ptr );
+    }
+  }
+
+private:
+  static size_t stripe ()
+  {
+    static atomic<size_t> next{ 0 };
+    static thread_local const size_t id = next.fetch_add ( 1, memory_order_relaxed ) % EPOCH_STRIPES;
+
+    return id;
+  }
+};
+
+/**
+ * RCU INDEX
+ *
+ * open addressing map of K -> const V*, read without locks inside an EpochDomain::Guard.
+ * single writer (the caller serializes store/erase/clear), the table is replaced
+ * as a whole when it grows and the old one is retired to the domain
+ */
+template <typename K, typename V, typename H> class RcuIndex
+{
+private:
+  struct Entry
+  {
+    K key;
+    size_t hash;
+    atomic<const V*> value;
+  };
+
+  struct Table
+  {
+    size_t mask;
+    size_t used;
+    unique_ptr<atomic<Entry*>[]> slots;
+
+    explicit Table ( size_t capacity ) : mask ( capacity - 1 ), used ( 0 ), slots ( new atomic<Entry*>[capacity] )
+    {
+      for ( size_t i = 0; i < capacity; ++i )
+      {
+        slots[i].store ( nullptr, memory_order_relaxed );
+      }
+    }
+  };
+
+  EpochDomain& _domain;
+  H _hasher;
+  atomic<Table*> _table;
+
+public:
+  explicit RcuIndex ( EpochDomain& domain, size_t capacity = 16 ) : _domain ( domain ), _table ( new Table ( pow2 ( capacity ) ) )
+  {
+  }
+
+  ~RcuIndex ()
+  {
+    Table* t = _table.load ( memory_order_relaxed );
+
+    for ( size_t i = 0; i <= t->mask; ++i )
+    {
+      delete t->slots[i].load ( memory_order_relaxed );
+    }
+
+    delete t;
+  }
+
+  RcuIndex ( const RcuIndex& ) = delete;
+  RcuIndex& operator= ( const RcuIndex& ) = delete;
+
+  /**
+   * the caller holds an EpochDomain::Guard for as long as it uses the result
+   */
+  const V* find ( const K& k ) const
+  {
+    const size_t h = _hasher ( k );
+    const Table* t = _table.load ( memory_order_acquire );
+
+    for ( size_t i = h & t->mask;; i = ( i + 1 ) & t->mask )
+    {
+      const Entry* e = t->slots[i].load ( memory_order_acquire );
+
+      if ( !e )
+      {
+        return nullptr;
+      }
+
+      if ( e->hash == h && e->key == k )
+      {
+        return e->value.load ( memory_order_acquire );
+      }
+    }
+  }
+
+  /**
+   * K must stay valid (interned) for the lifetime of the index
+   */
+  void store ( const K& k, const V* v )
+  {
+    const size_t h = _hasher ( k );
+    Table* t = _table.load ( memory_order_relaxed );
+
+    if ( Entry* e = lookup ( t, k, h ) )
+    {
+      e->value.store ( v, memory_order_release );
+      return;
+    }
+
+    if ( ( t->used + 1 ) * 4 > ( t->mask + 1 ) * 3 )
+    {
+      t = grow ( t );
+    }
+
+    place ( t, new Entry{ k, h, { v } } );
+    t->used++;
+  }
+
+  /**
+   * leaves a tombstone, dropped on the next growth
+   */
+  void erase ( const K& k )
+  {
+    if ( Entry* e = lookup ( _table.load ( memory_order_relaxed ), k, _hasher ( k ) ) )
+    {
+      e->value.store ( nullptr, memory_order_release );
+    }
+  }
+
+  void clear ()
+  {
+    Table* old = _table.exchange ( new Table ( 16 ), memory_order_acq_rel );
+
+    for ( size_t i = 0; i <= old->mask; ++i )
+    {
+      if ( Entry* e = old->slots[i].load ( memory_order_relaxed ) )
+      {
+        _domain.retire ( e );
+      }
+    }
+
+    _domain.retire ( old );
+  }
+
+private:
+  static size_t pow2 ( size_t x )
+  {
+    size_t n = 16;
+
+    while ( n < x )
+    {
+      n <<= 1;
+    }
+
+    return n;
+  }
+
+  static Entry* lookup ( Table* t, const K& k, size_t h )
+  {
+    for ( size_t i = h & t->mask;; i = ( i + 1 ) & t->mask )
+    {
+      Entry* e = t->slots[i].load ( memory_order_relaxed );
+
+      if ( !e || ( e->hash == h && e->key == k ) )
+      {
+        return e;
+      }
+    }
+  }
+
+  static void place ( Table* t, Entry* e )
+  {
+    size_t i = e->hash & t->mask;
+
+    while ( t->slots[i].load ( memory_order_relaxed ) )
+    {
+      i = ( i + 1 ) & t->mask;
+    }
+
+    t->slots[i].store ( e, memory_order_release );
+  }
+
+  Table* grow ( Table* old )
+  {
+    size_t live = 0;
+
+    for ( size_t i = 0; i <= old->mask; ++i )
+    {
+      Entry* e = old->slots[i].load ( memory_order_relaxed );
+      live += ( e && e->value.load ( memory_order_relaxed ) ) ? 1 : 0;
+    }
+
+    Table* t = new Table ( pow2 ( ( live + 1 ) * 2 ) );
+
+    for ( size_t i = 0; i <= old->mask; ++i )
+    {
+      Entry* e = old->slots[i].load ( memory_order_relaxed );
+
+      if ( !e )
+      {
+        continue;
+      }
+
+      if ( e->value.load ( memory_order_relaxed ) )
+      {
+        place ( t, e );
+        t->used++;
+      }
+      else
+      {
+        _domain.retire ( e );
+      }
+    }
+
+    _table.store ( t, memory_order_release );
+    _domain.retire ( old );
+
+    return t;
+  }
+};
+
+#endif
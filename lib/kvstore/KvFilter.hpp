@@ -1,21 +1,31 @@
 #ifndef KV_FILTER_HPP
 #define KV_FILTER_HPP
 
+#include "KvHash.hpp"
 #include <array>
-#include <chrono>
 #include <cmath>
+#include <cstring>
 #include <functional>
 #include <memory>
-#include <random>
 #include <stdexcept>
 #include <string>
+#include <string_view>
 #include <vector>
 
+#if defined( __AVX2__ )
+#  include <immintrin.h>
+#  define KVFILTER_USE_SIMD 1
+#endif
+
 using namespace std;
 
 constexpr size_t CUCKOO_BUCKET_SIZE = 4;
 constexpr size_t CUCKOO_FINGERPRINT_SIZE = 16;
 constexpr uint32_t CUCKOO_MAX_KICKS = 500;
+constexpr size_t BLOCKED_BLOOM_WORDS = 8;
+constexpr size_t BLOCKED_BLOOM_BATCH = 16;
+constexpr size_t COUNTING_BLOOM_HASHES = 8;
+constexpr uint64_t COUNTING_BLOOM_MAX = 15;
 
 /**
  * MHasher (https://github.com/aappleby/smhasher)
@@ -30,7 +40,7 @@ private:
   }
 
 public:
-  static uint32_t hash ( const string& key, uint32_t seed = 0 )
+  static uint32_t hash ( string_view key, uint32_t seed = 0 )
   {
     const uint8_t* data = ( const uint8_t* )key.data ();
     const int len = static_cast<int> ( key.length () );
@@ -38,11 +48,12 @@ public:
     uint32_t h1 = seed;
     const uint32_t c1 = 0xcc9e2d51;
     const uint32_t c2 = 0x1b873593;
-    const uint32_t* blocks = ( const uint32_t* )( data + blocknum * 4 );
+    const uint8_t* blocks = data + blocknum * 4;
 
     for ( int i = -blocknum; i; i++ )
     {
-      uint32_t k1 = blocks[i];
+      uint32_t k1;
+      memcpy ( &k1, blocks + i * 4, sizeof ( k1 ) );
 
       k1 *= c1;
       k1 = rotl32 ( k1, 15 );
@@ -88,11 +99,14 @@ public:
  * FILTER
  */
 
+/* values are stored in binary snapshots, append only */
 enum class KvFilterType
 {
-  BLOOM,
-  CUCKOO,
-  DEFAULT
+  BLOOM = 0,
+  CUCKOO = 1,
+  DEFAULT = 2,
+  BLOCKED_BLOOM = 3,
+  COUNTING_BLOOM = 4
 };
 
 class IKvFilter
@@ -102,14 +116,71 @@ public:
   IKvFilter () = default;
 
 
-  virtual void insert ( const string& key ) = 0;
-  virtual bool isContain ( const string& key ) const = 0;
-  virtual bool remove ( const string& key ) = 0;
+  /* filters derive every probe from one KvHash digest, see KvDigest */
+  virtual void insertHash ( uint64_t digest ) = 0;
+  virtual bool isContainHash ( uint64_t digest ) const = 0;
+  virtual bool removeHash ( uint64_t digest ) = 0;
   virtual void clear () = 0;
   virtual size_t size () const = 0;
   virtual KvFilterType getType () const = 0;
 
-  static uint32_t hash ( const string& key, uint32_t seed = 0 )
+  /**
+   * false when remove () can't clear a key, the owner rebuilds the filter instead
+   */
+  virtual bool isDeletable () const
+  {
+    return true;
+  }
+
+  /**
+   * out[i] = isContainHash ( digests[i] )
+   */
+  virtual void isContainBatch ( const vector<uint64_t>& digests, vector<uint8_t>& out ) const
+  {
+    out.resize ( digests.size () );
+
+    for ( size_t i = 0; i < digests.size (); ++i )
+    {
+      out[i] = isContainHash ( digests[i] );
+    }
+  }
+
+  void insert ( string_view key )
+  {
+    insertHash ( KvHash::hash ( key ) );
+  }
+
+  bool isContain ( string_view key ) const
+  {
+    return isContainHash ( KvHash::hash ( key ) );
+  }
+
+  bool remove ( string_view key )
+  {
+    return removeHash ( KvHash::hash ( key ) );
+  }
+
+  void insert ( const vector<string_view>& keys )
+  {
+    for ( auto key : keys )
+    {
+      insertHash ( KvHash::hash ( key ) );
+    }
+  }
+
+  void isContain ( const vector<string_view>& keys, vector<uint8_t>& out ) const
+  {
+    vector<uint64_t> digests ( keys.size () );
+
+    for ( size_t i = 0; i < keys.size (); ++i )
+    {
+      digests[i] = KvHash::hash ( keys[i] );
+    }
+
+    isContainBatch ( digests, out );
+  }
+
+  static uint32_t hash ( string_view key, uint32_t seed = 0 )
   {
     return MurmurHash3::hash ( key, seed );
   }
@@ -154,43 +225,29 @@ private:
   const size_t _hashed_num;
   const size_t _bits_num;
   vector<uint64_t> _bit_arr;
-  vector<uint32_t> _seeds;
 
 public:
   BloomFilter ( size_t expectedElements, double falsePositiveRate = 0.01 ) : _hashed_num ( genHash ( falsePositiveRate ) ), _bits_num ( genSize ( expectedElements, falsePositiveRate ) ), _bit_arr ( ( _bits_num + 63 ) / 64 )
   {
-    auto now = chrono::high_resolution_clock::now ();
-    auto seed = static_cast<unsigned int> ( now.time_since_epoch ().count () );
-
-    uniform_int_distribution<uint32_t> distribution;
-    random_device hwRand;
-    mt19937 generator ( hwRand () );
-
-    generator.seed ( generator () ^ seed );
-    _seeds.reserve ( _hashed_num );
-
-    for ( size_t i = 0; i < _hashed_num; ++i )
-    {
-      _seeds.push_back ( distribution ( generator ) );
-    }
   }
 
-  void insert ( const string& key ) override
+  /* Less Hashing, Same Performance (Kirsch, Mitzenmacher, 2006): bit i = h1 + i * h2 */
+  void insertHash ( uint64_t h ) override
   {
-    for ( uint32_t s : _seeds )
+    for ( size_t i = 0; i < _hashed_num; ++i )
     {
-      size_t hash = MurmurHash3::hash ( key, s ) % _bits_num;
-      _bit_arr[hash / 64] |= 1ULL << ( hash % 64 );
+      const size_t bit = probe ( h, i );
+      _bit_arr[bit / 64] |= 1ULL << ( bit % 64 );
     }
   }
 
-  bool isContain ( const string& key ) const override
+  bool isContainHash ( uint64_t h ) const override
   {
-    for ( uint32_t s : _seeds )
+    for ( size_t i = 0; i < _hashed_num; ++i )
     {
-      size_t hash = MurmurHash3::hash ( key, s ) % _bits_num;
+      const size_t bit = probe ( h, i );
 
-      if ( !( _bit_arr[hash / 64] & ( 1ULL << ( hash % 64 ) ) ) )
+      if ( !( _bit_arr[bit / 64] & ( 1ULL << ( bit % 64 ) ) ) )
       {
         return false;
       }
@@ -199,7 +256,12 @@ public:
     return true;
   }
 
-  bool remove ( const string& key ) override
+  bool removeHash ( uint64_t /* h */ ) override
+  {
+    return false;
+  }
+
+  bool isDeletable () const override
   {
     return false;
   }
@@ -216,13 +278,18 @@ public:
 
   KvFilterType getType () const override
   {
-    return KvFilterType::DEFAULT;
+    return KvFilterType::BLOOM;
   }
 
-private:
   static size_t genSize ( size_t n, double p )
   {
-    return static_cast<size_t> ( -double ( n ) * log ( p ) / ( log ( 2 ) * log ( 2 ) ) );
+    return max<size_t> ( 64, static_cast<size_t> ( -double ( n ) * log ( p ) / ( log ( 2 ) * log ( 2 ) ) ) );
+  }
+
+private:
+  size_t probe ( uint64_t h, size_t i ) const
+  {
+    return static_cast<size_t> ( ( ( h & 0xFFFFFFFFULL ) + i * ( ( h >> 32 ) | 1 ) ) % _bits_num );
   }
 
   static size_t genHash ( double p )
@@ -242,90 +309,157 @@ private:
 class CuckooFilter : public IKvFilter
 {
 private:
-  struct Bucket
+  static constexpr uint64_t LANES_LO = 0x0001000100010001ULL;
+  static constexpr uint64_t LANES_HI = 0x8000800080008000ULL;
+
+  /**
+   * 4 x 16 bit fingerprints packed in one uint64_t, 0 marks an empty slot.
+   * a table that ran out of kicks keeps the last displaced fingerprint as victim and stops taking inserts
+   */
+  struct Table
   {
-    array<uint16_t, CUCKOO_BUCKET_SIZE> items{};
-    array<bool, CUCKOO_BUCKET_SIZE> occupied{};
-
-    uint16_t& operator[] ( size_t index )
-    {
-      return items[index];
-    }
-
-    const uint16_t& operator[] ( size_t index ) const
+    vector<uint64_t> buckets;
+    size_t mask;
+    bool full = false;
+    bool victim = false;
+    size_t victim_index = 0;
+    uint16_t victim_fp = 0;
+
+    explicit Table ( size_t n ) : buckets ( n, 0 ), mask ( n - 1 )
     {
-      return items[index];
     }
   };
 
-  vector<Bucket> _buckets;
-  const size_t _buckets_num;
+  vector<Table> _tables;
+  uint64_t _rng = 0x9e3779b97f4a7c15ULL;
 
 public:
-  explicit CuckooFilter ( size_t expectedElements ) : _buckets_num ( nPow ( expectedElements / CUCKOO_BUCKET_SIZE * 1.05 ) )
+  explicit CuckooFilter ( size_t expectedElements )
   {
-    _buckets.resize ( _buckets_num );
+    _tables.emplace_back ( nPow ( max<size_t> ( 1, expectedElements / CUCKOO_BUCKET_SIZE * 1.05 ) ) );
   }
 
-  void insert ( const string& key ) override
+  /**
+   * never fails: when the newest table is full a table twice its size is appended
+   */
+  void insertHash ( uint64_t h ) override
   {
-    uint16_t fp = genFingerprint ( key );
-    size_t i1 = MurmurHash3::hash ( key ) % _buckets_num;
-    size_t i2 = altIndex ( i1, fp );
+    uint16_t fp = fingerprint ( h );
+
+    if ( _tables.back ().full )
+    {
+      _tables.emplace_back ( ( _tables.back ().mask + 1 ) * 2 );
+    }
 
-    if ( insertBucket ( i1, fp ) || insertBucket ( i2, fp ) )
+    Table& t = _tables.back ();
+    const size_t i1 = index ( t, h );
+    const size_t i2 = altIndex ( t, i1, fp );
+
+    if ( put ( t, i1, fp ) || put ( t, i2, fp ) )
     {
       return;
     }
 
-    size_t idx = i1;
+    size_t idx = ( next () & 1 ) ? i1 : i2;
+
     for ( uint32_t i = 0; i < CUCKOO_MAX_KICKS; i++ )
     {
-      size_t slot = rand () % CUCKOO_BUCKET_SIZE;
-      uint16_t old_pf = _buckets[idx][slot];
+      const uint32_t shift = static_cast<uint32_t> ( next () & ( CUCKOO_BUCKET_SIZE - 1 ) ) * CUCKOO_FINGERPRINT_SIZE;
+      uint64_t& b = t.buckets[idx];
+      const uint16_t old_fp = static_cast<uint16_t> ( b >> shift );
 
-      _buckets[idx][slot] = fp;
-      fp = old_pf;
-      idx = altIndex ( idx, fp );
+      b = ( b & ~( 0xFFFFULL << shift ) ) | ( static_cast<uint64_t> ( fp ) << shift );
+      fp = old_fp;
+      idx = altIndex ( t, idx, fp );
 
-      if ( insertBucket ( idx, fp ) )
+      if ( put ( t, idx, fp ) )
       {
         return;
       }
     }
 
-    throw runtime_error ( "Cuckoo filter is full" );
+    t.victim = true;
+    t.victim_index = idx;
+    t.victim_fp = fp;
+    t.full = true;
   }
 
-  bool isContain ( const string& key ) const override
+  bool isContainHash ( uint64_t h ) const override
   {
-    uint16_t fp = genFingerprint ( key );
-    size_t i1 = MurmurHash3::hash ( key ) % _buckets_num;
-    size_t i2 = altIndex ( i1, fp );
+    const uint16_t fp = fingerprint ( h );
+
+    for ( const auto& t : _tables )
+    {
+      const size_t i1 = index ( t, h );
+      const size_t i2 = altIndex ( t, i1, fp );
+
+      if ( hasLane ( t.buckets[i1], fp ) || hasLane ( t.buckets[i2], fp ) )
+      {
+        return true;
+      }
 
-    return isContainsBucket ( i1, fp ) || isContainsBucket ( i2, fp );
+      if ( t.victim && t.victim_fp == fp && ( t.victim_index == i1 || t.victim_index == i2 ) )
+      {
+        return true;
+      }
+    }
+
+    return false;
   }
 
-  bool remove ( const string& key ) override
+  bool removeHash ( uint64_t h ) override
   {
-    uint16_t fp = genFingerprint ( key );
-    size_t i1 = MurmurHash3::hash ( key ) % _buckets_num;
-    size_t i2 = altIndex ( i1, fp );
+    const uint16_t fp = fingerprint ( h );
+
+    for ( auto& t : _tables )
+    {
+      const size_t i1 = index ( t, h );
+      const size_t i2 = altIndex ( t, i1, fp );
+
+      if ( t.victim && t.victim_fp == fp && ( t.victim_index == i1 || t.victim_index == i2 ) )
+      {
+        t.victim = false;
+        t.full = false;
+        return true;
+      }
+
+      if ( erase ( t, i1, fp ) || erase ( t, i2, fp ) )
+      {
+        /* a slot was freed, give the victim its place back */
+        if ( t.victim && ( put ( t, t.victim_index, t.victim_fp ) || put ( t, altIndex ( t, t.victim_index, t.victim_fp ), t.victim_fp ) ) )
+        {
+          t.victim = false;
+          t.full = false;
+        }
+
+        return true;
+      }
+    }
 
-    return removeBucket ( i1, fp ) || removeBucket ( i2, fp );
+    return false;
   }
 
   void clear () override
   {
-    for ( auto& bucket : _buckets )
-    {
-      bucket.occupied.fill ( false );
-    }
+    _tables.erase ( _tables.begin () + 1, _tables.end () );
+
+    Table& t = _tables.front ();
+
+    fill ( t.buckets.begin (), t.buckets.end (), 0 );
+    t.full = false;
+    t.victim = false;
   }
 
   size_t size () const override
   {
-    return _buckets_num * CUCKOO_BUCKET_SIZE;
+    size_t total = 0;
+
+    for ( const auto& t : _tables )
+    {
+      total += t.buckets.size () * CUCKOO_BUCKET_SIZE;
+    }
+
+    return total;
   }
 
   KvFilterType getType () const override
@@ -334,29 +468,45 @@ public:
   }
 
 private:
-  static uint16_t genFingerprint ( const string& key )
+  static uint16_t fingerprint ( uint64_t h )
+  {
+    const uint16_t fp = static_cast<uint16_t> ( h );
+    return fp ? fp : 1;
+  }
+
+  /* remixed: the raw bits above 32 pick the KvShardedStore shard, so they are constant inside one shard's filter */
+  static size_t index ( const Table& t, uint64_t h )
+  {
+    return static_cast<size_t> ( KvHash::mix ( h, 0x9e3779b97f4a7c15ULL ) ) & t.mask;
+  }
+
+  /* partial-key cuckoo hashing, xor keeps it an involution: altIndex ( altIndex ( i, fp ), fp ) == i */
+  static size_t altIndex ( const Table& t, size_t index, uint16_t fp )
   {
-    uint32_t hash = MurmurHash3::hash ( key );
-    return ( ( hash & ( ( 1ULL << CUCKOO_FINGERPRINT_SIZE ) - 1 ) ) + 1 );
+    return ( index ^ ( fp * 0x5bd1e995ULL ) ) & t.mask;
   }
 
-  size_t altIndex ( size_t index, uint16_t fp ) const
+  /* SWAR compare of all 4 lanes at once */
+  static bool hasLane ( uint64_t bucket, uint16_t fp )
   {
-    size_t hash = MurmurHash3::hash ( to_string ( fp ) );
-    return ( index ^ hash ) % _buckets_num;
+    const uint64_t x = bucket ^ ( LANES_LO * fp );
+    return ( ( x - LANES_LO ) & ~x & LANES_HI ) != 0;
   }
 
-  bool insertBucket ( size_t idx, uint16_t fp )
+  static bool put ( Table& t, size_t idx, uint16_t fp )
   {
-    Bucket& b = _buckets[idx];
+    uint64_t& b = t.buckets[idx];
 
-    for ( size_t i = 0; i < CUCKOO_BUCKET_SIZE; i++ )
+    if ( !hasLane ( b, 0 ) )
     {
-      if ( !b.occupied[i] )
-      {
-        b.items[i] = fp;
-        b.occupied[i] = true;
+      return false;
+    }
 
+    for ( uint32_t shift = 0; shift < 64; shift += CUCKOO_FINGERPRINT_SIZE )
+    {
+      if ( !( ( b >> shift ) & 0xFFFF ) )
+      {
+        b |= static_cast<uint64_t> ( fp ) << shift;
         return true;
       }
     }
@@ -364,14 +514,20 @@ private:
     return false;
   }
 
-  bool isContainsBucket ( size_t idx, uint16_t fp ) const
+  static bool erase ( Table& t, size_t idx, uint16_t fp )
   {
-    const Bucket& b = _buckets[idx];
+    uint64_t& b = t.buckets[idx];
+
+    if ( !hasLane ( b, fp ) )
+    {
+      return false;
+    }
 
-    for ( size_t i = 0; i < CUCKOO_BUCKET_SIZE; i++ )
+    for ( uint32_t shift = 0; shift < 64; shift += CUCKOO_FINGERPRINT_SIZE )
     {
-      if ( b.occupied[i] && b.items[i] == fp )
+      if ( ( ( b >> shift ) & 0xFFFF ) == fp )
       {
+        b &= ~( 0xFFFFULL << shift );
         return true;
       }
     }
@@ -379,21 +535,282 @@ private:
     return false;
   }
 
-  bool removeBucket ( size_t idx, uint16_t fp )
+  /* xorshift64, replaces rand () for kick slots */
+  uint64_t next ()
+  {
+    _rng ^= _rng << 13;
+    _rng ^= _rng >> 7;
+    _rng ^= _rng << 17;
+
+    return _rng;
+  }
+};
+
+/**
+ * BLOCKED BLOOM FILTER
+ *
+ * Cache-, Hash- and Space-Efficient Bloom Filters (Putze, Sanders, Singler, 2007)
+ * split block layout as in Impala / Parquet / Kudu
+ * - one 64 bit hash per key: upper half picks a 256 bit block, lower half sets one bit in each of its 8 words
+ * - blocks are 32 byte aligned, so every probe touches a single cache line
+ * - AVX2: the 8 bit positions are one mullo/srli/sllv, the probe one testc
+ */
+class BlockedBloomFilter : public IKvFilter
+{
+private:
+  struct alignas ( 32 ) Block
+  {
+    uint32_t words[BLOCKED_BLOOM_WORDS];
+  };
+
+  static constexpr uint32_t SALT[BLOCKED_BLOOM_WORDS] = { 0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU, 0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U };
+
+  const size_t _blocks_num;
+  vector<Block> _blocks;
+
+public:
+  /* the blocked layout needs ~20% more bits than a standard bloom filter for the same rate */
+  BlockedBloomFilter ( size_t expectedElements, double falsePositiveRate = 0.01 ) : _blocks_num ( max<size_t> ( 1, BloomFilter::genSize ( expectedElements, falsePositiveRate ) * 6 / 5 / 256 + 1 ) ), _blocks ( _blocks_num )
+  {
+    clear ();
+  }
+
+  void insertHash ( uint64_t h ) override
   {
-    Bucket& b = _buckets[idx];
+    Block& b = block ( h );
 
-    for ( size_t i = 0; i < CUCKOO_BUCKET_SIZE; i++ )
+#ifdef KVFILTER_USE_SIMD
+    __m256i* p = reinterpret_cast<__m256i*> ( b.words );
+    _mm256_store_si256 ( p, _mm256_or_si256 ( _mm256_load_si256 ( p ), mask ( static_cast<uint32_t> ( h ) ) ) );
+#else
+    for ( size_t i = 0; i < BLOCKED_BLOOM_WORDS; ++i )
     {
-      if ( b.occupied[i] && b.items[i] == fp )
+      b.words[i] |= bit ( static_cast<uint32_t> ( h ), i );
+    }
+#endif
+  }
+
+  bool isContainHash ( uint64_t h ) const override
+  {
+    return test ( block ( h ), static_cast<uint32_t> ( h ) );
+  }
+
+  /**
+   * prefetches the blocks of a batch before probing any of them
+   */
+  void isContainBatch ( const vector<uint64_t>& digests, vector<uint8_t>& out ) const override
+  {
+    out.resize ( digests.size () );
+
+    for ( size_t base = 0; base < digests.size (); base += BLOCKED_BLOOM_BATCH )
+    {
+      const size_t n = min ( BLOCKED_BLOOM_BATCH, digests.size () - base );
+
+      for ( size_t i = 0; i < n; ++i )
       {
-        b.occupied[i] = false;
-        return true;
+        __builtin_prefetch ( &block ( digests[base + i] ) );
+      }
+
+      for ( size_t i = 0; i < n; ++i )
+      {
+        out[base + i] = test ( block ( digests[base + i] ), static_cast<uint32_t> ( digests[base + i] ) );
       }
     }
+  }
+
+  bool removeHash ( uint64_t /* h */ ) override
+  {
+    return false;
+  }
 
+  bool isDeletable () const override
+  {
     return false;
   }
+
+  void clear () override
+  {
+    memset ( _blocks.data (), 0, _blocks.size () * sizeof ( Block ) );
+  }
+
+  size_t size () const override
+  {
+    return _blocks_num * sizeof ( Block ) * 8;
+  }
+
+  KvFilterType getType () const override
+  {
+    return KvFilterType::BLOCKED_BLOOM;
+  }
+
+private:
+  const Block& block ( uint64_t h ) const
+  {
+    return _blocks[( ( h >> 32 ) * _blocks_num ) >> 32];
+  }
+
+  Block& block ( uint64_t h )
+  {
+    return _blocks[( ( h >> 32 ) * _blocks_num ) >> 32];
+  }
+
+  static uint32_t bit ( uint32_t h, size_t i )
+  {
+    return 1U << ( ( h * SALT[i] ) >> 27 );
+  }
+
+#ifdef KVFILTER_USE_SIMD
+  static __m256i mask ( uint32_t h )
+  {
+    const __m256i salt = _mm256_loadu_si256 ( reinterpret_cast<const __m256i*> ( SALT ) );
+    const __m256i shift = _mm256_srli_epi32 ( _mm256_mullo_epi32 ( _mm256_set1_epi32 ( static_cast<int> ( h ) ), salt ), 27 );
+
+    return _mm256_sllv_epi32 ( _mm256_set1_epi32 ( 1 ), shift );
+  }
+#endif
+
+  static bool test ( const Block& b, uint32_t h )
+  {
+#ifdef KVFILTER_USE_SIMD
+    return _mm256_testc_si256 ( _mm256_load_si256 ( reinterpret_cast<const __m256i*> ( b.words ) ), mask ( h ) );
+#else
+    for ( size_t i = 0; i < BLOCKED_BLOOM_WORDS; ++i )
+    {
+      if ( !( b.words[i] & bit ( h, i ) ) )
+      {
+        return false;
+      }
+    }
+
+    return true;
+#endif
+  }
+};
+
+/**
+ * COUNTING BLOOM FILTER
+ *
+ * Summary Cache: A Scalable Wide-Area Web Cache Sharing Protocol (Fan, Cao, Almeida, Broder, 2000)
+ * blocked like BlockedBloomFilter: a 64 byte block holds 128 4-bit counters,
+ * one 64 bit hash picks the block and 8 counters inside it
+ * - remove () decrements, so deleting a key is O(1)
+ * - a counter that reached 15 saturates and is never decremented again (may only add false positives)
+ */
+class CountingBloomFilter : public IKvFilter
+{
+private:
+  struct alignas ( 64 ) Block
+  {
+    uint64_t words[8];
+  };
+
+  static constexpr uint32_t SALT[COUNTING_BLOOM_HASHES] = { 0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU, 0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U };
+
+  const size_t _blocks_num;
+  vector<Block> _blocks;
+
+public:
+  /* 128 counters per block, ~1.2x the counters of a standard bloom filter for the same rate */
+  CountingBloomFilter ( size_t expectedElements, double falsePositiveRate = 0.01 ) : _blocks_num ( max<size_t> ( 1, BloomFilter::genSize ( expectedElements, falsePositiveRate ) * 6 / 5 / 128 + 1 ) ), _blocks ( _blocks_num )
+  {
+    clear ();
+  }
+
+  void insertHash ( uint64_t h ) override
+  {
+    Block& b = block ( h );
+
+    for ( size_t i = 0; i < COUNTING_BLOOM_HASHES; ++i )
+    {
+      const uint32_t pos = counter ( static_cast<uint32_t> ( h ), i );
+      uint64_t& w = b.words[pos >> 4];
+      const uint32_t shift = ( pos & 15 ) * 4;
+
+      if ( ( ( w >> shift ) & COUNTING_BLOOM_MAX ) != COUNTING_BLOOM_MAX )
+      {
+        w += 1ULL << shift;
+      }
+    }
+  }
+
+  bool isContainHash ( uint64_t h ) const override
+  {
+    return test ( block ( h ), static_cast<uint32_t> ( h ) );
+  }
+
+  /**
+   * only for keys that were inserted, removing a false positive would clear counters of other keys
+   */
+  bool removeHash ( uint64_t h ) override
+  {
+    Block& b = block ( h );
+
+    if ( !test ( b, static_cast<uint32_t> ( h ) ) )
+    {
+      return false;
+    }
+
+    for ( size_t i = 0; i < COUNTING_BLOOM_HASHES; ++i )
+    {
+      const uint32_t pos = counter ( static_cast<uint32_t> ( h ), i );
+      uint64_t& w = b.words[pos >> 4];
+      const uint32_t shift = ( pos & 15 ) * 4;
+      const uint64_t c = ( w >> shift ) & COUNTING_BLOOM_MAX;
+
+      if ( c != 0 && c != COUNTING_BLOOM_MAX )
+      {
+        w -= 1ULL << shift;
+      }
+    }
+
+    return true;
+  }
+
+  void clear () override
+  {
+    memset ( _blocks.data (), 0, _blocks.size () * sizeof ( Block ) );
+  }
+
+  size_t size () const override
+  {
+    return _blocks_num * 128;
+  }
+
+  KvFilterType getType () const override
+  {
+    return KvFilterType::COUNTING_BLOOM;
+  }
+
+private:
+  const Block& block ( uint64_t h ) const
+  {
+    return _blocks[( ( h >> 32 ) * _blocks_num ) >> 32];
+  }
+
+  Block& block ( uint64_t h )
+  {
+    return _blocks[( ( h >> 32 ) * _blocks_num ) >> 32];
+  }
+
+  static uint32_t counter ( uint32_t h, size_t i )
+  {
+    return ( h * SALT[i] ) >> 25;
+  }
+
+  static bool test ( const Block& b, uint32_t h )
+  {
+    for ( size_t i = 0; i < COUNTING_BLOOM_HASHES; ++i )
+    {
+      const uint32_t pos = counter ( h, i );
+
+      if ( !( ( b.words[pos >> 4] >> ( ( pos & 15 ) * 4 ) ) & COUNTING_BLOOM_MAX ) )
+      {
+        return false;
+      }
+    }
+
+    return true;
+  }
 };
 
 class FilterFactory
@@ -409,6 +826,12 @@ public:
       case KvFilterType::CUCKOO:
         return make_unique<CuckooFilter> ( elements );
 
+      case KvFilterType::BLOCKED_BLOOM:
+        return make_unique<BlockedBloomFilter> ( elements, falseRate );
+
+      case KvFilterType::COUNTING_BLOOM:
+        return make_unique<CountingBloomFilter> ( elements, falseRate );
+
       default:
       case KvFilterType::DEFAULT:
         return nullptr;
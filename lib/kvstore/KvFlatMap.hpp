@@ -0,0 +1,514 @@
+#ifndef KV_FLAT_MAP_HPP
+#define KV_FLAT_MAP_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <functional>
+#include <iterator>
+#include <new>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#ifdef _MSC_VER
+#  include <intrin.h>
+#endif
+
+#if defined( __SSE2__ ) || defined( _M_X64 )
+#  include <emmintrin.h>
+#  define KVFLATMAP_USE_SIMD 1
+#endif
+
+using namespace std;
+
+constexpr size_t FLAT_MAP_GROUP = 16;
+
+/**
+ * FLAT HASH MAP
+ *
+ * open addressing, Swiss table layout (Abseil / F14)
+ * - one control byte per slot: EMPTY, DELETED or the low 7 bits of the hash
+ * - slots are probed 16 at a time: one SSE2 compare of the control bytes gives every candidate of a group,
+ *   the key is compared only on a 7 bit match
+ * - groups are probed triangularly, a group with an EMPTY byte ends the probe
+ * - pair<const K, V> is stored inline in one array, no node or bucket list
+ * - references and iterators are invalidated by any insert that grows the table
+ */
+template <typename K, typename V, typename H = hash<K>, typename E = equal_to<K>> class FlatHashMap
+{
+public:
+  using key_type = K;
+  using mapped_type = V;
+  using value_type = pair<const K, V>;
+
+private:
+  static constexpr int8_t EMPTY = -128;
+  static constexpr int8_t DELETED = -2;
+  static constexpr size_t NPOS = ~size_t ( 0 );
+
+  int8_t* _ctrl = nullptr;
+  value_type* _slots = nullptr;
+  size_t _capacity = 0;
+  size_t _size = 0;
+  size_t _deleted = 0;
+  H _hasher;
+  E _equal;
+
+  template <bool CONST> class Iterator
+  {
+    friend class FlatHashMap;
+    template <bool> friend class Iterator;
+
+    using Map = conditional_t<CONST, const FlatHashMap, FlatHashMap>;
+
+    Map* _map;
+    size_t _i;
+
+    Iterator ( Map* map, size_t i ) : _map ( map ), _i ( i )
+    {
+      skip ();
+    }
+
+    void skip ()
+    {
+      while ( _i < _map->_capacity && _map->_ctrl[_i] < 0 )
+      {
+        ++_i;
+      }
+    }
+
+  public:
+    using iterator_category = forward_iterator_tag;
+    using value_type = FlatHashMap::value_type;
+    using difference_type = ptrdiff_t;
+    using pointer = conditional_t<CONST, const value_type*, value_type*>;
+    using reference = conditional_t<CONST, const value_type&, value_type&>;
+
+    Iterator () : _map ( nullptr ), _i ( 0 )
+    {
+    }
+
+    operator Iterator<true> () const
+    {
+      return Iterator<true> ( _map, _i );
+    }
+
+    reference operator* () const
+    {
+      return _map->_slots[_i];
+    }
+
+    pointer operator->() const
+    {
+      return &_map->_slots[_i];
+    }
+
+    Iterator& operator++ ()
+    {
+      ++_i;
+      skip ();
+      return *this;
+    }
+
+    Iterator operator++ ( int )
+    {
+      Iterator it = *this;
+      ++*this;
+      return it;
+    }
+
+    bool operator== ( const Iterator& o ) const
+    {
+      return _i == o._i;
+    }
+
+    bool operator!= ( const Iterator& o ) const
+    {
+      return _i != o._i;
+    }
+  };
+
+public:
+  using iterator = Iterator<false>;
+  using const_iterator = Iterator<true>;
+
+  FlatHashMap () = default;
+
+  explicit FlatHashMap ( size_t n )
+  {
+    reserve ( n );
+  }
+
+  ~FlatHashMap ()
+  {
+    destroy ();
+    release ();
+  }
+
+  FlatHashMap ( const FlatHashMap& ) = delete;
+  FlatHashMap& operator= ( const FlatHashMap& ) = delete;
+
+  iterator begin ()
+  {
+    return iterator ( this, 0 );
+  }
+
+  iterator end ()
+  {
+    return iterator ( this, _capacity );
+  }
+
+  const_iterator begin () const
+  {
+    return const_iterator ( this, 0 );
+  }
+
+  const_iterator end () const
+  {
+    return const_iterator ( this, _capacity );
+  }
+
+  size_t size () const
+  {
+    return _size;
+  }
+
+  bool empty () const
+  {
+    return _size == 0;
+  }
+
+  size_t capacity () const
+  {
+    return _capacity;
+  }
+
+  iterator find ( const K& k )
+  {
+    const size_t i = lookup ( k );
+    return iterator ( this, i == NPOS ? _capacity : i );
+  }
+
+  const_iterator find ( const K& k ) const
+  {
+    const size_t i = lookup ( k );
+    return const_iterator ( this, i == NPOS ? _capacity : i );
+  }
+
+  size_t count ( const K& k ) const
+  {
+    return lookup ( k ) != NPOS ? 1 : 0;
+  }
+
+  V& operator[] ( const K& k )
+  {
+    const size_t i = prepare ( k ).first;
+    return _slots[i].second;
+  }
+
+  template <typename... A> pair<iterator, bool> try_emplace ( const K& k, A&&... args )
+  {
+    auto [i, inserted] = prepare ( k, forward<A> ( args )... );
+    return { iterator ( this, i ), inserted };
+  }
+
+  pair<iterator, bool> insert ( const value_type& v )
+  {
+    return try_emplace ( v.first, v.second );
+  }
+
+  void erase ( iterator it )
+  {
+    erase ( it._i );
+  }
+
+  size_t erase ( const K& k )
+  {
+    const size_t i = lookup ( k );
+
+    if ( i == NPOS )
+    {
+      return 0;
+    }
+
+    erase ( i );
+    return 1;
+  }
+
+  /**
+   * keeps the capacity, rehash ( 0 ) releases it
+   */
+  void clear ()
+  {
+    destroy ();
+
+    if ( _ctrl )
+    {
+      memset ( _ctrl, static_cast<uint8_t> ( EMPTY ), _capacity );
+    }
+
+    _size = 0;
+    _deleted = 0;
+  }
+
+  void reserve ( size_t n )
+  {
+    const size_t c = capacityFor ( n );
+
+    if ( c > _capacity )
+    {
+      resize ( c );
+    }
+  }
+
+  void rehash ( size_t n )
+  {
+    const size_t c = ( n || _size ) ? capacityFor ( max ( n, _size ) ) : 0;
+
+    if ( c != _capacity || _deleted )
+    {
+      resize ( c );
+    }
+  }
+
+private:
+  /* max load 7/8 including tombstones, so every probe meets an EMPTY byte */
+  static size_t capacityFor ( size_t n )
+  {
+    if ( n == 0 )
+    {
+      return 0;
+    }
+
+    size_t c = FLAT_MAP_GROUP;
+
+    while ( c - c / 8 < n )
+    {
+      c <<= 1;
+    }
+
+    return c;
+  }
+
+  static uint32_t match ( const int8_t* ctrl, int8_t h2 )
+  {
+#ifdef KVFLATMAP_USE_SIMD
+    return static_cast<uint32_t> ( _mm_movemask_epi8 ( _mm_cmpeq_epi8 ( _mm_set1_epi8 ( h2 ), _mm_loadu_si128 ( reinterpret_cast<const __m128i*> ( ctrl ) ) ) ) );
+#else
+    uint32_t m = 0;
+
+    for ( size_t i = 0; i < FLAT_MAP_GROUP; ++i )
+    {
+      m |= static_cast<uint32_t> ( ctrl[i] == h2 ) << i;
+    }
+
+    return m;
+#endif
+  }
+
+  /* EMPTY and DELETED are the only negative control bytes */
+  static uint32_t matchFree ( const int8_t* ctrl )
+  {
+#ifdef KVFLATMAP_USE_SIMD
+    return static_cast<uint32_t> ( _mm_movemask_epi8 ( _mm_loadu_si128 ( reinterpret_cast<const __m128i*> ( ctrl ) ) ) );
+#else
+    uint32_t m = 0;
+
+    for ( size_t i = 0; i < FLAT_MAP_GROUP; ++i )
+    {
+      m |= static_cast<uint32_t> ( ctrl[i] < 0 ) << i;
+    }
+
+    return m;
+#endif
+  }
+
+  static uint32_t ctz ( uint32_t m )
+  {
+#ifdef _MSC_VER
+    unsigned long i;
+    _BitScanForward ( &i, m );
+    return i;
+#else
+    return static_cast<uint32_t> ( __builtin_ctz ( m ) );
+#endif
+  }
+
+  size_t lookup ( const K& k ) const
+  {
+    if ( _size == 0 )
+    {
+      return NPOS;
+    }
+
+    const size_t h = _hasher ( k );
+    const int8_t h2 = static_cast<int8_t> ( h & 0x7F );
+    const size_t mask = _capacity / FLAT_MAP_GROUP - 1;
+
+    for ( size_t g = ( h >> 7 ) & mask, step = 1;; g = ( g + step++ ) & mask )
+    {
+      const int8_t* ctrl = _ctrl + g * FLAT_MAP_GROUP;
+
+      for ( uint32_t m = match ( ctrl, h2 ); m; m &= m - 1 )
+      {
+        const size_t i = g * FLAT_MAP_GROUP + ctz ( m );
+
+        if ( _equal ( _slots[i].first, k ) )
+        {
+          return i;
+        }
+      }
+
+      if ( match ( ctrl, EMPTY ) )
+      {
+        return NPOS;
+      }
+    }
+  }
+
+  template <typename... A> pair<size_t, bool> prepare ( const K& k, A&&... args )
+  {
+    const size_t found = lookup ( k );
+
+    if ( found != NPOS )
+    {
+      return { found, false };
+    }
+
+    if ( _size + _deleted + 1 > _capacity - _capacity / 8 )
+    {
+      /* same capacity only when tombstones are a real share (live <= 25/32), double otherwise, as abseil does.
+         a live size just under 7/8 would otherwise rehash in place on nearly every insert after an erase */
+      resize ( _capacity && _size * 32 <= _capacity * 25 ? _capacity : max ( capacityFor ( _size + 1 ), _capacity * 2 ) );
+    }
+
+    const size_t h = _hasher ( k );
+    const size_t mask = _capacity / FLAT_MAP_GROUP - 1;
+
+    for ( size_t g = ( h >> 7 ) & mask, step = 1;; g = ( g + step++ ) & mask )
+    {
+      const uint32_t m = matchFree ( _ctrl + g * FLAT_MAP_GROUP );
+
+      if ( m )
+      {
+        const size_t i = g * FLAT_MAP_GROUP + ctz ( m );
+
+        if ( _ctrl[i] == DELETED )
+        {
+          _deleted--;
+        }
+
+        _ctrl[i] = static_cast<int8_t> ( h & 0x7F );
+        new ( _slots + i ) value_type ( piecewise_construct, forward_as_tuple ( k ), forward_as_tuple ( forward<A> ( args )... ) );
+        _size++;
+
+        return { i, true };
+      }
+    }
+  }
+
+  void erase ( size_t i )
+  {
+    const int8_t* group = _ctrl + ( i / FLAT_MAP_GROUP ) * FLAT_MAP_GROUP;
+
+    _slots[i].~value_type ();
+    _size--;
+
+    /* no probe ran past a group that still has an EMPTY byte */
+    if ( match ( group, EMPTY ) )
+    {
+      _ctrl[i] = EMPTY;
+    }
+    else
+    {
+      _ctrl[i] = DELETED;
+      _deleted++;
+    }
+  }
+
+  void resize ( size_t capacity )
+  {
+    int8_t* ctrl = _ctrl;
+    value_type* slots = _slots;
+    const size_t old = _capacity;
+
+    _capacity = capacity;
+    _size = 0;
+    _deleted = 0;
+    _ctrl = nullptr;
+    _slots = nullptr;
+
+    if ( capacity )
+    {
+      _ctrl = static_cast<int8_t*> ( ::operator new ( capacity ) );
+      _slots = static_cast<value_type*> ( ::operator new ( capacity * sizeof ( value_type ), align_val_t ( alignof ( value_type ) ) ) );
+      memset ( _ctrl, static_cast<uint8_t> ( EMPTY ), capacity );
+    }
+
+    for ( size_t i = 0; i < old; ++i )
+    {
+      if ( ctrl[i] >= 0 )
+      {
+        place ( move ( slots[i] ) );
+        slots[i].~value_type ();
+      }
+    }
+
+    if ( old )
+    {
+      ::operator delete ( ctrl );
+      ::operator delete ( slots, align_val_t ( alignof ( value_type ) ) );
+    }
+  }
+
+  /* rehash path, the key is known to be absent and there are no tombstones */
+  void place ( value_type&& v )
+  {
+    const size_t h = _hasher ( v.first );
+    const size_t mask = _capacity / FLAT_MAP_GROUP - 1;
+
+    for ( size_t g = ( h >> 7 ) & mask, step = 1;; g = ( g + step++ ) & mask )
+    {
+      const uint32_t m = matchFree ( _ctrl + g * FLAT_MAP_GROUP );
+
+      if ( m )
+      {
+        const size_t i = g * FLAT_MAP_GROUP + ctz ( m );
+
+        _ctrl[i] = static_cast<int8_t> ( h & 0x7F );
+        new ( _slots + i ) value_type ( move ( v ) );
+        _size++;
+
+        return;
+      }
+    }
+  }
+
+  void destroy ()
+  {
+    for ( size_t i = 0; i < _capacity; ++i )
+    {
+      if ( _ctrl[i] >= 0 )
+      {
+        _slots[i].~value_type ();
+      }
+    }
+  }
+
+  void release ()
+  {
+    if ( _capacity )
+    {
+      ::operator delete ( _ctrl );
+      ::operator delete ( _slots, align_val_t ( alignof ( value_type ) ) );
+    }
+
+    _ctrl = nullptr;
+    _slots = nullptr;
+    _capacity = 0;
+  }
+};
+
+#endif
@@ -0,0 +1,186 @@
+#ifndef KV_HASH_HPP
+#define KV_HASH_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+#ifdef _MSC_VER
+#  include <intrin.h>
+#endif
+
+using namespace std;
+
+/**
+ * KV HASH
+ *
+ * wyhash final4 (https://github.com/wangyi-fudan/wyhash, public domain)
+ * - keys up to 16 bytes ( NID names ) take 4 overlapping loads and one 64x64->128 multiply, no loop
+ * - longer keys consume 48 / 16 byte stripes
+ */
+class KvHash
+{
+private:
+  static constexpr uint64_t SECRET[4] = { 0x2d358dccaa6c78a5ULL, 0x8bb84b93962eacc9ULL, 0x4b33a62ed433d4a3ULL, 0x4d5a2da51de1aa47ULL };
+
+public:
+  static uint64_t hash ( string_view key, uint64_t seed = 0 )
+  {
+    const uint8_t* p = reinterpret_cast<const uint8_t*> ( key.data () );
+    const size_t len = key.size ();
+    uint64_t a;
+    uint64_t b;
+
+    seed ^= mix ( seed ^ SECRET[0], SECRET[1] );
+
+    if ( len <= 16 )
+    {
+      if ( len >= 4 )
+      {
+        const size_t d = ( len >> 3 ) << 2;
+
+        a = ( r4 ( p ) << 32 ) | r4 ( p + d );
+        b = ( r4 ( p + len - 4 ) << 32 ) | r4 ( p + len - 4 - d );
+      }
+      else if ( len > 0 )
+      {
+        a = ( static_cast<uint64_t> ( p[0] ) << 16 ) | ( static_cast<uint64_t> ( p[len >> 1] ) << 8 ) | p[len - 1];
+        b = 0;
+      }
+      else
+      {
+        a = b = 0;
+      }
+    }
+    else
+    {
+      size_t i = len;
+
+      if ( i > 48 )
+      {
+        uint64_t see1 = seed;
+        uint64_t see2 = seed;
+
+        do
+        {
+          seed = mix ( r8 ( p ) ^ SECRET[1], r8 ( p + 8 ) ^ seed );
+          see1 = mix ( r8 ( p + 16 ) ^ SECRET[2], r8 ( p + 24 ) ^ see1 );
+          see2 = mix ( r8 ( p + 32 ) ^ SECRET[3], r8 ( p + 40 ) ^ see2 );
+          p += 48;
+          i -= 48;
+        } while ( i > 48 );
+
+        seed ^= see1 ^ see2;
+      }
+
+      while ( i > 16 )
+      {
+        seed = mix ( r8 ( p ) ^ SECRET[1], r8 ( p + 8 ) ^ seed );
+        i -= 16;
+        p += 16;
+      }
+
+      a = r8 ( p + i - 16 );
+      b = r8 ( p + i - 8 );
+    }
+
+    a ^= SECRET[1];
+    b ^= seed;
+    mum ( a, b );
+
+    return mix ( a ^ SECRET[0] ^ len, b ^ SECRET[1] );
+  }
+
+  static uint64_t mix ( uint64_t a, uint64_t b )
+  {
+    mum ( a, b );
+    return a ^ b;
+  }
+
+private:
+  static void mum ( uint64_t& a, uint64_t& b )
+  {
+#if defined( __SIZEOF_INT128__ )
+    const __uint128_t r = static_cast<__uint128_t> ( a ) * b;
+
+    a = static_cast<uint64_t> ( r );
+    b = static_cast<uint64_t> ( r >> 64 );
+#elif defined( _MSC_VER ) && defined( _M_X64 )
+    a = _umul128 ( a, b, &b );
+#else
+    const uint64_t ha = a >> 32, hb = b >> 32, la = static_cast<uint32_t> ( a ), lb = static_cast<uint32_t> ( b );
+    const uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb, t = rl + ( rm0 << 32 );
+    uint64_t lo = t + ( rm1 << 32 );
+    uint64_t hi = rh + ( rm0 >> 32 ) + ( rm1 >> 32 ) + ( t < rl ) + ( lo < t );
+
+    a = lo;
+    b = hi;
+#endif
+  }
+
+  static uint64_t r8 ( const uint8_t* p )
+  {
+    uint64_t v;
+    memcpy ( &v, p, sizeof ( v ) );
+    return v;
+  }
+
+  static uint64_t r4 ( const uint8_t* p )
+  {
+    uint32_t v;
+    memcpy ( &v, p, sizeof ( v ) );
+    return v;
+  }
+};
+
+/**
+ * key + its hash, computed once and handed to the store, the hot cache and the filter.
+ * the view must outlive the digest
+ *
+ * bits of value per consumer, so that one does not see bits another has fixed:
+ * - KvShardedStore    shard: 32 and up
+ * - ClockCache        shard: 48 and up
+ * - FlatHashMap       control byte: 0 - 6, group: 7 and up
+ * - BloomFilter       probes: low half + i * high half
+ * - BlockedBloomFilter, CountingBloomFilter  block: top of the high half, bits in the block: value * salt
+ * - CuckooFilter      fingerprint: 0 - 15, bucket: mix ( value ) (bits 32 and up are constant inside a shard)
+ */
+struct KvDigest
+{
+  string_view key;
+  uint64_t value = 0;
+
+  KvDigest () = default;
+
+  explicit KvDigest ( string_view k ) : key ( k ), value ( KvHash::hash ( k ) )
+  {
+  }
+
+  KvDigest ( string_view k, uint64_t v ) : key ( k ), value ( v )
+  {
+  }
+
+  bool operator== ( const KvDigest& o ) const
+  {
+    return value == o.value && key == o.key;
+  }
+};
+
+struct KvDigestHash
+{
+  size_t operator() ( const KvDigest& d ) const noexcept
+  {
+    return static_cast<size_t> ( d.value );
+  }
+};
+
+/* std::hash<int> is the identity, open addressing needs the low and high bits mixed */
+struct KvIntHash
+{
+  size_t operator() ( int k ) const noexcept
+  {
+    return static_cast<size_t> ( KvHash::mix ( static_cast<uint64_t> ( static_cast<uint32_t> ( k ) ), 0x9e3779b97f4a7c15ULL ) );
+  }
+};
+
+#endif
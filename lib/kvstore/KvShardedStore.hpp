@@ -0,0 +1,295 @@
+#ifndef KV_SHARDED_STORE_HPP
+#define KV_SHARDED_STORE_HPP
+
+#include "KvStore.hpp"
+#include <algorithm>
+#include <fstream>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+constexpr size_t KVSTORE_SHARD_NUM = 16;
+
+/**
+ * SHARDED STORE
+ *
+ * lock striping over KvStore: keys are partitioned by FastStringHash into independently
+ * locked shards, each with its own _store, _id_map, filter and hot cache.
+ * ids are interleaved ( shard i issues i + 1, i + 1 + n, i + 1 + 2n ... ) so id () needs no lookup table
+ */
+class KVSTORE_EXPORT KvShardedStore
+{
+public:
+  explicit KvShardedStore ( size_t size = 1024, size_t shards = KVSTORE_SHARD_NUM )
+  {
+    const size_t n = IKvFilter::nPow ( max<size_t> ( shards, 1 ) );
+
+    _mask = n - 1;
+    _shards.reserve ( n );
+
+    for ( size_t i = 0; i < n; ++i )
+    {
+      auto shard = make_unique<KvStore> ( max<size_t> ( size / n, 16 ) );
+
+      shard->_id_offset = static_cast<int> ( i ) + 1;
+      shard->_id_stride = static_cast<int> ( n );
+
+      _shards.push_back ( move ( shard ) );
+    }
+  }
+
+  explicit KvShardedStore ( const string& filename, size_t size = 1024, size_t shards = KVSTORE_SHARD_NUM ) : KvShardedStore ( size, shards )
+  {
+    _filename = filename;
+    load ( filename );
+  }
+
+  void push ( string_view k, const KvValue& v )
+  {
+    shard ( k ).push ( k, v );
+  }
+
+  /**
+   * items are grouped by shard first, every shard is locked once
+   */
+  void pushBatch ( const vector<pair<string_view, KvValue>>& items )
+  {
+    vector<vector<pair<string_view, KvValue>>> groups ( _shards.size () );
+
+    for ( auto& g : groups )
+    {
+      g.reserve ( items.size () / _shards.size () + 1 );
+    }
+
+    for ( const auto& item : items )
+    {
+      groups[index ( item.first )].push_back ( item );
+    }
+
+    for ( size_t i = 0; i < groups.size (); ++i )
+    {
+      if ( !groups[i].empty () )
+      {
+        _shards[i]->pushBatch ( groups[i] );
+      }
+    }
+  }
+
+  void getBatch ( const vector<string_view>& keys, vector<shared_ptr<KvData>>& out ) const
+  {
+    vector<vector<string_view>> groups ( _shards.size () );
+    vector<vector<size_t>> positions ( _shards.size () );
+    vector<shared_ptr<KvData>> found;
+
+    out.resize ( keys.size () );
+
+    for ( size_t i = 0; i < keys.size (); ++i )
+    {
+      const size_t s = index ( keys[i] );
+
+      groups[s].push_back ( keys[i] );
+      positions[s].push_back ( i );
+    }
+
+    for ( size_t s = 0; s < groups.size (); ++s )
+    {
+      if ( groups[s].empty () )
+      {
+        continue;
+      }
+
+      _shards[s]->getBatch ( groups[s], found );
+
+      for ( size_t j = 0; j < found.size (); ++j )
+      {
+        out[positions[s][j]] = move ( found[j] );
+      }
+    }
+  }
+
+  bool remove ( string_view k )
+  {
+    return shard ( k ).remove ( k );
+  }
+
+  bool hasKey ( string_view k ) const
+  {
+    return shard ( k ).hasKey ( k );
+  }
+
+  bool hasId ( int id ) const
+  {
+    return id > 0 && _shards[( id - 1 ) & _mask]->hasId ( id );
+  }
+
+  shared_ptr<KvData> id ( int id ) const
+  {
+    return ( id > 0 ) ? _shards[( id - 1 ) & _mask]->id ( id ) : nullptr;
+  }
+
+  shared_ptr<KvData> key ( string_view k ) const
+  {
+    return shard ( k ).key ( k );
+  }
+
+  template <typename F> bool read ( string_view k, F&& fn ) const
+  {
+    return shard ( k ).read ( k, forward<F> ( fn ) );
+  }
+
+  template <typename F> bool readId ( int id, F&& fn ) const
+  {
+    return id > 0 && _shards[( id - 1 ) & _mask]->readId ( id, forward<F> ( fn ) );
+  }
+
+  void flush ()
+  {
+    if ( _filename.empty () )
+    {
+      return;
+    }
+    flush ( _filename );
+  }
+
+  /**
+   * shards are captured one after another, not at a single point in time
+   */
+  void flush ( const string& filename )
+  {
+    vector<pair<string, shared_ptr<KvData>>> items;
+    KvFilterType filter = KvFilterType::DEFAULT;
+
+    items.reserve ( size () );
+
+    for ( const auto& s : _shards )
+    {
+      s->snapshot ( items, filter );
+    }
+
+    if ( _format == KvFormat::BINARY )
+    {
+      KvStore::writeBinary ( filename, filter, 0, items );
+    }
+    else
+    {
+      KvStore::writeYaml ( filename, filter, 0, items );
+    }
+  }
+
+  void load ( const string& filename )
+  {
+    _filename = filename;
+
+    ifstream file ( filename );
+
+    if ( !file.good () )
+    {
+      flush ( filename );
+      return;
+    }
+
+    try
+    {
+      auto info = KvStore::readSnapshot (
+          filename, [this] ( size_t size ) { reserve ( size ); }, [this] ( string_view k, const KvValue& v ) { push ( k, v ); } );
+
+      _format = info.format;
+
+      if ( info.filter )
+      {
+        setFilter ( *info.filter );
+      }
+    }
+    catch ( const runtime_error& e )
+    {
+      clear ();
+    }
+  }
+
+  void close ()
+  {
+    flush ();
+    clear ();
+  }
+
+  void clear ()
+  {
+    for ( auto& s : _shards )
+    {
+      s->clear ();
+    }
+  }
+
+  void setFilter ( KvFilterType filter )
+  {
+    for ( auto& s : _shards )
+    {
+      s->setFilter ( filter );
+    }
+  }
+
+  void setReadMode ( KvReadMode mode )
+  {
+    for ( auto& s : _shards )
+    {
+      s->setReadMode ( mode );
+    }
+  }
+
+  void setFormat ( KvFormat format )
+  {
+    _format = format;
+  }
+
+  KvFormat getFormat () const
+  {
+    return _format;
+  }
+
+  void reserve ( size_t size )
+  {
+    for ( auto& s : _shards )
+    {
+      s->reserve ( size / _shards.size () + 1 );
+    }
+  }
+
+  size_t size () const
+  {
+    size_t total = 0;
+
+    for ( const auto& s : _shards )
+    {
+      total += s->size ();
+    }
+
+    return total;
+  }
+
+  size_t shards () const
+  {
+    return _shards.size ();
+  }
+
+private:
+  vector<unique_ptr<KvStore>> _shards;
+  size_t _mask;
+  string _filename;
+  KvFormat _format = KvFormat::YAML;
+
+  /* upper half of the hash, keeps the shard choice independent of the bucket index inside it */
+  size_t index ( string_view k ) const
+  {
+    return ( FastStringHash{}( k ) >> 32 ) & _mask;
+  }
+
+  KvStore& shard ( string_view k ) const
+  {
+    return *_shards[index ( k )];
+  }
+};
+
+#endif
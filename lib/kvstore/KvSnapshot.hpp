@@ -0,0 +1,374 @@
+#ifndef KV_SNAPSHOT_HPP
+#define KV_SNAPSHOT_HPP
+
+#include <zlib.h>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#ifdef _WIN32
+#  include <iterator>
+#else
+#  include <fcntl.h>
+#  include <unistd.h>
+#  include <sys/mman.h>
+#  include <sys/stat.h>
+#endif
+
+using namespace std;
+
+/**
+ * BINARY SNAPSHOT
+ *
+ * little-endian, length-prefixed and checksummed (crc32)
+ *
+ * [header]  magic(8) version(2) filter(1) reserved(5) lsn(8)
+ *           v1 has no lsn, v2 stores the last write-ahead log lsn the snapshot covers
+ * [record]  length(4) crc(4) payload(length)
+ *           payload = id(4) type(1) created(8) key_len(2) key value
+ * [footer]  magic(8) count(8) crc(4) reserved(4)
+ */
+constexpr char KV_SNAPSHOT_MAGIC[8] = { 'R', 'I', 'K', 'S', 'N', 'A', 'P', '\0' };
+constexpr char KV_SNAPSHOT_END[8] = { 'R', 'I', 'K', 'S', 'E', 'N', 'D', '\0' };
+constexpr uint16_t KV_SNAPSHOT_VERSION = 2;
+constexpr size_t KV_SNAPSHOT_HEADER_V1_SIZE = 16;
+constexpr size_t KV_SNAPSHOT_HEADER_SIZE = 24;
+constexpr size_t KV_SNAPSHOT_FOOTER_SIZE = 24;
+constexpr size_t KV_SNAPSHOT_RECORD_FIXED = 4 + 1 + 8 + 2;
+constexpr size_t KV_SNAPSHOT_BUFFER_SIZE = 1 << 20;
+
+struct KvSnapshotRecord
+{
+  int32_t id;
+  uint8_t type;
+  int64_t created;
+  string_view key;
+  string_view value;
+};
+
+class KvSnapshotWriter
+{
+private:
+  ofstream _out;
+  string _buf;
+  uint64_t _count = 0;
+  uint32_t _crc = 0;
+
+public:
+  KvSnapshotWriter ( const string& filename, uint8_t filter, uint64_t lsn = 0 ) : _out ( filename, ios::binary | ios::trunc )
+  {
+    if ( !_out )
+    {
+      throw runtime_error ( "RUNTIME_ERROR: snapshot open " + filename );
+    }
+
+    _buf.reserve ( KV_SNAPSHOT_BUFFER_SIZE );
+    _buf.append ( KV_SNAPSHOT_MAGIC, sizeof ( KV_SNAPSHOT_MAGIC ) );
+    put<uint16_t> ( KV_SNAPSHOT_VERSION );
+    put<uint8_t> ( filter );
+    _buf.append ( 5, '\0' );
+    put<uint64_t> ( lsn );
+  }
+
+  ~KvSnapshotWriter ()
+  {
+    if ( _out.is_open () )
+    {
+      try
+      {
+        close ();
+      }
+      catch ( ... )
+      {
+      }
+    }
+  }
+
+  void write ( const KvSnapshotRecord& r )
+  {
+    if ( r.key.size () > UINT16_MAX )
+    {
+      throw runtime_error ( "RUNTIME_ERROR: snapshot key length" );
+    }
+
+    const uint32_t length = static_cast<uint32_t> ( KV_SNAPSHOT_RECORD_FIXED + r.key.size () + r.value.size () );
+    const size_t offset = _buf.size ();
+
+    put<uint32_t> ( length );
+    put<uint32_t> ( 0 );
+    put<int32_t> ( r.id );
+    put<uint8_t> ( r.type );
+    put<int64_t> ( r.created );
+    put<uint16_t> ( static_cast<uint16_t> ( r.key.size () ) );
+    _buf.append ( r.key );
+    _buf.append ( r.value );
+
+    const uint32_t crc = checksum ( 0, _buf.data () + offset + 8, length );
+    memcpy ( &_buf[offset + 4], &crc, sizeof ( crc ) );
+
+    _crc = checksum ( _crc, &crc, sizeof ( crc ) );
+    _count++;
+
+    if ( _buf.size () >= KV_SNAPSHOT_BUFFER_SIZE )
+    {
+      drain ();
+    }
+  }
+
+  void close ()
+  {
+    _buf.append ( KV_SNAPSHOT_END, sizeof ( KV_SNAPSHOT_END ) );
+    put<uint64_t> ( _count );
+    put<uint32_t> ( _crc );
+    put<uint32_t> ( 0 );
+
+    drain ();
+    _out.flush ();
+
+    if ( _out.fail () )
+    {
+      _out.close ();
+      throw runtime_error ( "RUNTIME_ERROR: snapshot write" );
+    }
+
+    _out.close ();
+  }
+
+  uint64_t count () const
+  {
+    return _count;
+  }
+
+  static uint32_t checksum ( uint32_t crc, const void* data, size_t len )
+  {
+    return static_cast<uint32_t> ( crc32 ( crc, reinterpret_cast<const Bytef*> ( data ), static_cast<uInt> ( len ) ) );
+  }
+
+private:
+  template <typename T> void put ( T v )
+  {
+    _buf.append ( reinterpret_cast<const char*> ( &v ), sizeof ( T ) );
+  }
+
+  void drain ()
+  {
+    _out.write ( _buf.data (), static_cast<streamsize> ( _buf.size () ) );
+    _buf.clear ();
+  }
+};
+
+class KvSnapshotReader
+{
+private:
+  const char* _data = nullptr;
+  size_t _size = 0;
+  uint16_t _version = 0;
+  uint8_t _filter = 0;
+  uint64_t _lsn = 0;
+  uint64_t _count = 0;
+  size_t _header_size = KV_SNAPSHOT_HEADER_SIZE;
+
+#ifdef _WIN32
+  vector<char> _file;
+#else
+  void* _map = MAP_FAILED;
+#endif
+
+public:
+  explicit KvSnapshotReader ( const string& filename )
+  {
+    open ( filename );
+
+    if ( _size < KV_SNAPSHOT_HEADER_V1_SIZE + KV_SNAPSHOT_FOOTER_SIZE || memcmp ( _data, KV_SNAPSHOT_MAGIC, sizeof ( KV_SNAPSHOT_MAGIC ) ) != 0 )
+    {
+      release ();
+      throw runtime_error ( "RUNTIME_ERROR: snapshot header" );
+    }
+
+    _version = get<uint16_t> ( _data + 8 );
+    _filter = get<uint8_t> ( _data + 10 );
+    _header_size = ( _version < 2 ) ? KV_SNAPSHOT_HEADER_V1_SIZE : KV_SNAPSHOT_HEADER_SIZE;
+
+    const char* footer = _data + _size - KV_SNAPSHOT_FOOTER_SIZE;
+
+    if ( _version > KV_SNAPSHOT_VERSION || _size < _header_size + KV_SNAPSHOT_FOOTER_SIZE || memcmp ( footer, KV_SNAPSHOT_END, sizeof ( KV_SNAPSHOT_END ) ) != 0 )
+    {
+      release ();
+      throw runtime_error ( "RUNTIME_ERROR: snapshot footer" );
+    }
+
+    if ( _version >= 2 )
+    {
+      _lsn = get<uint64_t> ( _data + 16 );
+    }
+
+    _count = get<uint64_t> ( footer + 8 );
+  }
+
+  ~KvSnapshotReader ()
+  {
+    release ();
+  }
+
+  KvSnapshotReader ( const KvSnapshotReader& ) = delete;
+  KvSnapshotReader& operator= ( const KvSnapshotReader& ) = delete;
+
+  uint16_t version () const
+  {
+    return _version;
+  }
+
+  uint8_t filter () const
+  {
+    return _filter;
+  }
+
+  uint64_t lsn () const
+  {
+    return _lsn;
+  }
+
+  uint64_t count () const
+  {
+    return _count;
+  }
+
+  /**
+   * record views point into the mapped file and are valid until the reader is destroyed
+   */
+  template <typename F> void forEach ( F&& fn ) const
+  {
+    const char* pos = _data + _header_size;
+    const char* end = _data + _size - KV_SNAPSHOT_FOOTER_SIZE;
+    uint32_t crc = 0;
+    uint64_t n = 0;
+
+    while ( pos < end )
+    {
+      if ( end - pos < 8 )
+      {
+        throw runtime_error ( "RUNTIME_ERROR: snapshot truncated" );
+      }
+
+      const uint32_t length = get<uint32_t> ( pos );
+      const uint32_t record_crc = get<uint32_t> ( pos + 4 );
+      const char* p = pos + 8;
+
+      if ( length < KV_SNAPSHOT_RECORD_FIXED || static_cast<size_t> ( end - p ) < length )
+      {
+        throw runtime_error ( "RUNTIME_ERROR: snapshot truncated" );
+      }
+
+      if ( KvSnapshotWriter::checksum ( 0, p, length ) != record_crc )
+      {
+        throw runtime_error ( "RUNTIME_ERROR: snapshot checksum" );
+      }
+
+      KvSnapshotRecord r;
+      const uint16_t key_len = get<uint16_t> ( p + 13 );
+
+      if ( KV_SNAPSHOT_RECORD_FIXED + key_len > length )
+      {
+        throw runtime_error ( "RUNTIME_ERROR: snapshot key length" );
+      }
+
+      r.id = get<int32_t> ( p );
+      r.type = get<uint8_t> ( p + 4 );
+      r.created = get<int64_t> ( p + 5 );
+      r.key = string_view ( p + KV_SNAPSHOT_RECORD_FIXED, key_len );
+      r.value = string_view ( p + KV_SNAPSHOT_RECORD_FIXED + key_len, length - KV_SNAPSHOT_RECORD_FIXED - key_len );
+
+      fn ( r );
+
+      crc = KvSnapshotWriter::checksum ( crc, &record_crc, sizeof ( record_crc ) );
+      pos = p + length;
+      n++;
+    }
+
+    if ( n != _count || crc != get<uint32_t> ( end + 16 ) )
+    {
+      throw runtime_error ( "RUNTIME_ERROR: snapshot checksum" );
+    }
+  }
+
+  static bool isSnapshot ( const string& filename )
+  {
+    char magic[sizeof ( KV_SNAPSHOT_MAGIC )] = { 0 };
+    ifstream in ( filename, ios::binary );
+
+    in.read ( magic, sizeof ( magic ) );
+    return in.gcount () == sizeof ( magic ) && memcmp ( magic, KV_SNAPSHOT_MAGIC, sizeof ( magic ) ) == 0;
+  }
+
+private:
+  template <typename T> static T get ( const char* p )
+  {
+    T v;
+    memcpy ( &v, p, sizeof ( T ) );
+    return v;
+  }
+
+  void open ( const string& filename )
+  {
+#ifdef _WIN32
+    ifstream in ( filename, ios::binary );
+
+    if ( !in )
+    {
+      throw runtime_error ( "RUNTIME_ERROR: snapshot open " + filename );
+    }
+
+    _file.assign ( istreambuf_iterator<char> ( in ), istreambuf_iterator<char> () );
+    _data = _file.data ();
+    _size = _file.size ();
+#else
+    int fd = ::open ( filename.c_str (), O_RDONLY );
+
+    if ( fd < 0 )
+    {
+      throw runtime_error ( "RUNTIME_ERROR: snapshot open " + filename );
+    }
+
+    struct stat st;
+
+    if ( fstat ( fd, &st ) != 0 || st.st_size == 0 )
+    {
+      ::close ( fd );
+      throw runtime_error ( "RUNTIME_ERROR: snapshot stat " + filename );
+    }
+
+    _size = static_cast<size_t> ( st.st_size );
+    _map = mmap ( nullptr, _size, PROT_READ, MAP_PRIVATE, fd, 0 );
+    ::close ( fd );
+
+    if ( _map == MAP_FAILED )
+    {
+      throw runtime_error ( "RUNTIME_ERROR: snapshot mmap " + filename );
+    }
+
+    madvise ( _map, _size, MADV_SEQUENTIAL );
+    _data = static_cast<const char*> ( _map );
+#endif
+  }
+
+  void release ()
+  {
+#ifdef _WIN32
+    _file.clear ();
+#else
+    if ( _map != MAP_FAILED )
+    {
+      munmap ( _map, _size );
+      _map = MAP_FAILED;
+    }
+#endif
+    _data = nullptr;
+    _size = 0;
+  }
+};
+
+#endif
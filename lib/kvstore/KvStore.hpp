@@ -2,12 +2,20 @@
 #define KV_STORE_HPP
 
 #include <boost/pool/pool_alloc.hpp>
-#include <tbb/concurrent_unordered_map.h>
 #include <yaml-cpp/yaml.h>
+#include "KvCache.hpp"
+#include "KvEpoch.hpp"
 #include "KvFilter.hpp"
+#include "KvFlatMap.hpp"
+#include "KvHash.hpp"
+#include "KvSnapshot.hpp"
+#include "KvStringPool.hpp"
+#include "KvWal.hpp"
 #include <algorithm>
 #include <atomic>
 #include <chrono>
+#include <cstdio>
+#include <cstring>
 #include <fstream>
 #include <memory>
 #include <mutex>
@@ -15,7 +23,7 @@
 #include <shared_mutex>
 #include <string>
 #include <string_view>
-#include <unordered_set>
+#include <unordered_map>
 #include <variant>
 #include <vector>
 
@@ -51,94 +59,36 @@ enum class KvType
   BOOLEAN
 };
 
-struct FastStringHash
+enum class KvFormat
 {
-  size_t operator() ( string_view str ) const noexcept
-  {
-    static const size_t FNV_offset = 14695981039346656037ULL;
-    static const size_t FNV_prime = 1099511628211ULL;
-    size_t hash = FNV_offset;
-
-    for ( char c : str )
-    {
-      hash ^= static_cast<size_t> ( c );
-      hash *= FNV_prime;
-    }
-
-    return hash;
-  }
+  YAML,
+  BINARY
 };
 
-
-class StringPool
+enum class KvReadMode
 {
-private:
-  unordered_set<string, FastStringHash> _pool;
-  mutex _mutex;
-
-public:
-  string_view intern ( string_view str )
-  {
-    /* @MUTEX-LOCK */
-    lock_guard<mutex> lock ( _mutex );
-    return *_pool.insert ( string ( str ) ).first;
-  }
+  LOCKED,
+  EPOCH
 };
 
-
-template <typename T> class LockFreeCache
+struct FastStringHash
 {
-public:
-  explicit LockFreeCache ( size_t c = 10000 ) : _capacity ( c )
-  {
-  }
-
-  void insert ( string_view k, T v )
-  {
-    auto keyStr = string ( k );
-    _cache.insert_or_assign ( keyStr, move ( v ) );
-
-    if ( _cache.size () > _capacity )
-    {
-      auto victim = _cache.begin ();
-      _cache.erase ( victim );
-    }
-  }
-
-  optional<T> get ( string_view k ) const
-  {
-    auto it = _cache.find ( string ( k ) );
-
-    if ( it != _cache.end () )
-    {
-      return it->second;
-    }
-
-    return nullopt;
-  }
-
-  void clear ()
-  {
-    _cache.clear ();
-  }
-
-  void setCapacity ( size_t c )
+  size_t operator() ( string_view str ) const noexcept
   {
-    _capacity = c;
+    return static_cast<size_t> ( KvHash::hash ( str ) );
   }
-
-private:
-  tbb::concurrent_unordered_map<string, T, FastStringHash> _cache;
-  atomic<size_t> _capacity;
 };
 
+
 /**
  * HASHMAP POOL
  */
-template <typename K, typename V> using HashmapPool = unordered_map<K, V, FastStringHash, equal_to<K>, boost::fast_pool_allocator<pair<const K, V>>>;
+template <typename K, typename V, typename H = FastStringHash> using HashmapPool = unordered_map<K, V, H, equal_to<K>, boost::fast_pool_allocator<pair<const K, V>>>;
 
 class KVSTORE_EXPORT KvData
 {
+  friend class KvStore; /* assigns the id under its lock, before the entry is published */
+
 private:
   int _id;
   string _key;
@@ -158,7 +108,7 @@ public:
   {
     try
     {
-      return get<T> ( _value );
+      return std::get<T> ( _value );
     }
     catch ( const bad_variant_access& )
     {
@@ -220,6 +170,8 @@ public:
 
 class KVSTORE_EXPORT KvStore
 {
+  friend class KvShardedStore;
+
 public:
   explicit KvStore ( size_t size = 1024 )
   {
@@ -234,6 +186,16 @@ public:
     load ( filename );
   }
 
+  /**
+   * snapshot + write-ahead log, load () replays the log tail after the snapshot
+   */
+  KvStore ( const string& filename, const KvWalOptions& wal, size_t size = 1024 ) : KvStore ( size )
+  {
+    _filename = filename;
+    _wal = make_unique<KvWal> ( wal );
+    load ( filename );
+  }
+
   void push ( string_view k, const KvValue& v )
   {
     if ( k.empty () || k.length () > 255 )
@@ -242,98 +204,240 @@ public:
     }
 
     auto type = determineType ( v );
-    int new_id = static_cast<int> ( _store.size () ) + 1;
-    auto inter_key = _str_pool.intern ( k );
-    auto data = make_shared<KvData> ( new_id, inter_key, type, v );
+    const KvDigest digest = _str_pool.digest ( k );
+    const string_view inter_key = digest.key;
+    auto data = make_shared<KvData> ( 0, inter_key, type, v );
+    uint64_t lsn = 0;
+    string bytes;
+
+    if ( _wal && !_recovering )
+    {
+      encodeValue ( v, bytes );
+    }
 
     /* @MUTEX-LOCK */
     unique_lock<shared_mutex> lock ( _mutex );
 
-    _store[string ( inter_key )] = data;
-    _id_map[new_id] = data;
-    _hot_cache.insert ( inter_key, data );
+    if ( _wal && !_recovering )
+    {
+      lsn = _wal->append ( KvWalOp::PUSH, static_cast<uint8_t> ( type ), inter_key, bytes );
+    }
 
-    if ( _filter )
+    shared_ptr<KvData>& slot = _store[digest];
+    const bool fresh = !slot;
+
+    publish ( digest, slot, data );
+    _id_map[data->getId ()] = data;
+    _hot_cache.insert ( digest, data );
+
+    /* only new keys: an update would add the digest again (saturating counters, duplicate fingerprints) */
+    if ( _filter && fresh )
     {
-      _filter->insert ( string ( inter_key ) );
+      _filter->insertHash ( digest.value );
     }
+
+    lock.unlock ();
+    commitWal ( lsn );
+    _epoch.collect ();
   }
 
-  bool remove ( string_view k )
+  /**
+   * one lock acquisition and one intern pass per batch, keys are hashed outside the lock
+   */
+  void pushBatch ( const vector<pair<string_view, KvValue>>& items )
   {
-    /* @MUTEX-LOCK */
-    unique_lock<shared_mutex> lock ( _mutex );
+    vector<string_view> keys;
+    vector<shared_ptr<KvData>> datas;
+    vector<string> bytes;
+    const bool logged = _wal && !_recovering;
 
-    auto it = _store.find ( string ( k ) );
-    if ( it == _store.end () )
+    keys.reserve ( items.size () );
+
+    for ( const auto& [k, v] : items )
     {
-      return false;
+      if ( !k.empty () && k.length () <= 255 )
+      {
+        keys.push_back ( k );
+      }
     }
 
-    if ( _filter && _filter->getType () == KvFilterType::BLOOM )
+    if ( keys.empty () )
     {
-      vector<pair<string, shared_ptr<KvData>>> temp;
+      return;
+    }
 
-      temp.reserve ( _store.size () - 1 );
+    vector<KvDigest> digests;
 
-      for ( const auto& [k, v] : _store )
+    digests.reserve ( keys.size () );
+
+    for ( auto& key : keys )
+    {
+      digests.push_back ( _str_pool.digest ( key ) );
+      key = digests.back ().key;
+    }
+
+    datas.reserve ( keys.size () );
+    bytes.resize ( logged ? keys.size () : 0 );
+
+    for ( size_t i = 0, j = 0; i < items.size (); ++i )
+    {
+      const auto& [k, v] = items[i];
+
+      if ( k.empty () || k.length () > 255 )
       {
-        if ( k != k )
-        {
-          temp.emplace_back ( k, v );
-        }
+        continue;
       }
 
-      clear ();
+      datas.push_back ( make_shared<KvData> ( 0, keys[j], determineType ( v ), v ) );
 
-      _filter = FilterFactory::createFilter ( KvFilterType::BLOOM, temp.size () );
+      if ( logged )
+      {
+        encodeValue ( v, bytes[j] );
+      }
+
+      j++;
+    }
+
+    uint64_t lsn = 0;
+
+    /* @MUTEX-LOCK */
+    unique_lock<shared_mutex> lock ( _mutex );
 
-      for ( const auto& [k, v] : temp )
+    _store.reserve ( _store.size () + keys.size () );
+    _id_map.reserve ( _id_map.size () + keys.size () );
+
+    for ( size_t i = 0; i < keys.size (); ++i )
+    {
+      const auto& data = datas[i];
+
+      if ( logged )
       {
-        _store[k] = v;
-        _id_map[v->getId ()] = v;
-        _filter->insert ( k );
-        _hot_cache.insert ( k, v );
+        lsn = _wal->append ( KvWalOp::PUSH, static_cast<uint8_t> ( data->getType () ), keys[i], bytes[i] );
       }
 
-      return true;
+      shared_ptr<KvData>& slot = _store[digests[i]];
+      const bool fresh = !slot;
+
+      publish ( digests[i], slot, data );
+      _id_map[data->getId ()] = data;
+      _hot_cache.insert ( digests[i], data );
+
+      if ( _filter && fresh )
+      {
+        _filter->insertHash ( digests[i].value );
+      }
     }
-    else
+
+    lock.unlock ();
+    commitWal ( lsn );
+    _epoch.collect ();
+  }
+
+  /**
+   * out[i] is the entry of keys[i] or nullptr
+   */
+  void getBatch ( const vector<string_view>& keys, vector<shared_ptr<KvData>>& out ) const
+  {
+    vector<KvDigest> digests ( keys.begin (), keys.end () );
+    vector<uint64_t> hashes ( keys.size () );
+    vector<uint8_t> maybe;
+
+    out.resize ( keys.size () );
+
+    for ( size_t i = 0; i < keys.size (); ++i )
     {
-      auto id = it->second->getId ();
+      hashes[i] = digests[i].value;
+    }
 
-      _store.erase ( it );
-      _id_map.erase ( id );
-      _hot_cache.clear ();
+    /* @MUTEX-LOCK */
+    shared_lock<shared_mutex> lock ( _mutex );
+
+    if ( _filter )
+    {
+      _filter->isContainBatch ( hashes, maybe );
+    }
 
-      if ( _filter )
+    for ( size_t i = 0; i < keys.size (); ++i )
+    {
+      if ( _filter && !maybe[i] )
       {
-        _filter->remove ( string ( k ) );
+        out[i] = nullptr;
+        continue;
       }
 
-      return true;
+      auto find = _store.find ( digests[i] );
+      out[i] = ( find != _store.end () ) ? find->second : nullptr;
+    }
+  }
+
+  bool remove ( string_view k )
+  {
+    const KvDigest digest ( k );
+
+    /* @MUTEX-LOCK */
+    unique_lock<shared_mutex> lock ( _mutex );
+
+    auto it = _store.find ( digest );
+    if ( it == _store.end () )
+    {
+      return false;
+    }
+
+    uint64_t lsn = 0;
+
+    if ( _wal && !_recovering )
+    {
+      lsn = _wal->append ( KvWalOp::REMOVE, 0, k, {} );
     }
+
+    auto id = it->second->getId ();
+
+    unpublish ( digest, it->second );
+    _store.erase ( it );
+    _id_map.erase ( id );
+    _hot_cache.remove ( digest );
+
+    if ( _filter )
+    {
+      if ( _filter->isDeletable () )
+      {
+        _filter->removeHash ( digest.value );
+      }
+      else if ( ++_filter_stale > _store.size () / 4 )
+      {
+        /* stale keys only cost false positives, rebuilt once they are a quarter of the store ( amortized O(1) ) */
+        resetFilter ( _filter->getType () );
+      }
+    }
+
+    lock.unlock ();
+    commitWal ( lsn );
+    _epoch.collect ();
+
+    return true;
   }
 
   bool hasKey ( string_view k ) const
   {
+    const KvDigest digest ( k );
+
     /* @MUTEX-LOCK */
     shared_lock<shared_mutex> lock ( _mutex );
 
-    if ( auto cache = _hot_cache.get ( k ) )
+    if ( auto cache = _hot_cache.get ( digest ) )
     {
       return true;
     }
 
     if ( _filter )
     {
-      if ( !_filter->isContain ( string ( k ) ) )
+      if ( !_filter->isContainHash ( digest.value ) )
       {
         return false;
       }
     }
 
-    return _store.find ( string ( k ) ) != _store.end ();
+    return _store.find ( digest ) != _store.end ();
   }
 
   bool hasId ( int id ) const
@@ -354,203 +458,288 @@ public:
 
   shared_ptr<KvData> key ( string_view k ) const
   {
+    const KvDigest digest ( k );
+
     /* @MUTEX-LOCK */
     shared_lock<shared_mutex> lock ( _mutex );
 
-    if ( auto cached = _hot_cache.get ( k ) )
+    if ( auto cached = _hot_cache.get ( digest ) )
     {
       return *cached;
     }
 
-    auto find = _store.find ( string ( k ) );
+    auto find = _store.find ( digest );
     return ( find != _store.end () ) ? find->second : nullptr;
   }
 
-
-  void flush ()
+  /**
+   * fn ( const KvData& ) without copying the shared_ptr, true when the key exists.
+   * in KvReadMode::EPOCH no lock is taken, the reference is valid until fn returns
+   */
+  template <typename F> bool read ( string_view k, F&& fn ) const
   {
-    if ( _filename.empty () )
+    const KvDigest digest ( k );
+
+    if ( _read_mode.load ( memory_order_acquire ) == KvReadMode::EPOCH )
     {
-      return;
+      EpochDomain::Guard guard ( _epoch );
+
+      if ( const KvData* data = _rcu_keys.find ( digest ) )
+      {
+        fn ( *data );
+        return true;
+      }
+
+      return false;
     }
-    flush ( _filename );
-  }
 
-  void flush ( const string& filename )
-  {
     /* @MUTEX-LOCK */
     shared_lock<shared_mutex> lock ( _mutex );
 
-    YAML::Node yml;
-    yml["filter"] = filterToString ( _filter ? _filter->getType () : KvFilterType::DEFAULT );
-
-    YAML::Node dataNode;
-    dataNode.SetStyle ( YAML::EmitterStyle::Block );
-
-    vector<pair<string, shared_ptr<KvData>>> items;
-    items.reserve ( _store.size () );
+    auto find = _store.find ( digest );
 
-    for ( const auto& [key, value] : _store )
+    if ( find == _store.end () )
     {
-      items.emplace_back ( key, value );
+      return false;
     }
 
-    PARALLEL_FOR ( items.begin (), items.end (), [] ( auto& item ) {} );
-    sort ( items.begin (), items.end () );
+    fn ( *find->second );
+    return true;
+  }
 
-    for ( const auto& [k, v] : items )
+  template <typename F> bool readId ( int id, F&& fn ) const
+  {
+    if ( _read_mode.load ( memory_order_acquire ) == KvReadMode::EPOCH )
     {
-      YAML::Node o;
+      EpochDomain::Guard guard ( _epoch );
 
-      o["id"] = v->getId ();
-      o["key"] = k;
-      o["value"] = valueToYaml ( v->getValue () );
-      o["type"] = typeToString ( v->getType () );
-      o["created"] = v->getCreated ();
+      if ( const KvData* data = _rcu_ids.find ( id ) )
+      {
+        fn ( *data );
+        return true;
+      }
 
-      dataNode.push_back ( o );
+      return false;
     }
 
-    yml["data"] = dataNode;
+    /* @MUTEX-LOCK */
+    shared_lock<shared_mutex> lock ( _mutex );
 
-    ofstream out ( filename );
+    auto find = _id_map.find ( id );
 
-    if ( out )
+    if ( find == _id_map.end () )
     {
-      out << YAML::Dump ( yml );
+      return false;
     }
+
+    fn ( *find->second );
+    return true;
   }
 
-  void load ( const string& filename )
+  /**
+   * EPOCH keeps a second, lock-free index next to _store / _id_map.
+   * writers publish new KvData versions into it and retire the replaced ones,
+   * which are freed once no reader of the previous epoch is left
+   */
+  void setReadMode ( KvReadMode mode )
   {
     /* @MUTEX-LOCK */
     unique_lock<shared_mutex> lock ( _mutex );
 
-    _filename = filename;
-
-    ifstream file ( filename );
-
-    if ( !file.good () )
+    if ( mode == _read_mode.load ( memory_order_relaxed ) )
     {
-      ofstream newFile ( filename );
-
-      if ( newFile.good () )
-      {
-        YAML::Node yml;
-
-        yml["filter"] = "default";
-        yml["data"] = YAML::Node ( YAML::NodeType::Sequence );
-
-        newFile << YAML::Dump ( yml );
-      }
       return;
     }
 
-    try
+    if ( mode == KvReadMode::EPOCH )
     {
-      YAML::Node yml = YAML::LoadFile ( filename );
-
-      if ( yml["filter"] )
+      for ( const auto& [k, v] : _store )
       {
-        auto filterType = stringToFilter ( yml["filter"].as<string> () );
-        setFilter ( filterType );
+        _rcu_keys.store ( k, v.get () );
       }
 
-      if ( yml["data"] )
+      for ( const auto& [id, v] : _id_map )
       {
-        const auto& data = yml["data"];
-        const size_t size = data.size ();
-        const size_t threshold = 10000;
-
-        if ( size > threshold )
-        {
-          vector<pair<string, KvValue>> temp;
-          temp.reserve ( size );
+        _rcu_ids.store ( id, v.get () );
+      }
 
-          /* clang-format off */
-          #pragma omp parallel for
-          for ( size_t i = 0; i < size; ++i )
-          {
-            const auto& item = data[i];
-            auto key = item["key"].as<string> ();
-            auto type = stringToType ( item["type"].as<string> () );
-            auto value = yamlToValue ( item["value"], type );
-
-            #pragma omp critical
-            temp.emplace_back ( key, value );
-            /* clang-format on */
-          }
+      _read_mode.store ( mode, memory_order_release );
+      return;
+    }
 
-          for ( const auto& [k, v] : temp )
-          {
-            push ( k, v );
-          }
-        }
-        else
-        {
-          for ( const auto& item : data )
-          {
-            auto k = item["key"].as<string> ();
-            auto type = stringToType ( item["type"].as<string> () );
-            auto v = yamlToValue ( item["value"], type );
+    _read_mode.store ( mode, memory_order_release );
+    _rcu_keys.clear ();
+    _rcu_ids.clear ();
 
-            push ( k, v );
-          }
-        }
-      }
-    }
-    catch ( const YAML::Exception& e )
-    {
-      clear ();
-    }
+    /* writers stop retiring from here on, wait out the readers still inside an epoch */
+    _epoch.collect ( true );
   }
 
-  void close ()
+  KvReadMode getReadMode () const
   {
-    flush ();
-    clear ();
+    return _read_mode.load ( memory_order_relaxed );
   }
 
 
-  void clear ()
+  void flush ()
   {
-    /* @MUTEX-LOCK */
-    unique_lock<shared_mutex> lock ( _mutex );
-
-    _store.clear ();
-    _id_map.clear ();
-    _store.rehash ( 0 );
-    _id_map.rehash ( 0 );
-    _hot_cache.clear ();
-
-    if ( _filter )
+    if ( _filename.empty () )
     {
-      _filter.reset ();
+      return;
     }
+    flush ( _filename );
   }
 
-  void setFilter ( KvFilterType filter )
+  void flush ( const string& filename )
   {
-    /* @MUTEX-LOCK */
-    unique_lock<shared_mutex> lock ( _mutex );
+    vector<pair<string, shared_ptr<KvData>>> items;
+    KvFilterType filter = KvFilterType::DEFAULT;
+    const uint64_t lsn = snapshot ( items, filter );
 
-    _filter = FilterFactory::createFilter ( filter, _store.size () );
+    bool written = true;
 
-    if ( _filter )
+    if ( _format == KvFormat::BINARY )
     {
-      for ( const auto& [key, _] : _store )
-      {
-        _filter->insert ( key );
-      }
+      writeBinary ( filename, filter, lsn, items );
     }
-  }
-
+    else
+    {
+      written = writeYaml ( filename, filter, lsn, items );
+    }
+
+    /* the rename must be durable before checkpoint () drops the segments the snapshot replaces */
+    if ( _wal && written )
+    {
+      KvWal::syncDirectory ( filename );
+      _wal->checkpoint ( lsn );
+    }
+  }
+
+  void load ( const string& filename )
+  {
+    _recovering = true;
+
+    try
+    {
+      recover ( filename );
+    }
+    catch ( ... )
+    {
+      _recovering = false;
+      throw;
+    }
+
+    _recovering = false;
+  }
+
+  void openWal ( const KvWalOptions& options )
+  {
+    _wal = make_unique<KvWal> ( options );
+
+    _recovering = true;
+    replayWal ();
+    _recovering = false;
+  }
+
+  /**
+   * yaml <-> binary snapshot
+   */
+  static void convert ( const string& src, const string& dst, KvFormat format )
+  {
+    KvStore store;
+
+    store.load ( src );
+    store.setFormat ( format );
+    store.flush ( dst );
+  }
+
+  void setFormat ( KvFormat format )
+  {
+    _format = format;
+  }
+
+  KvFormat getFormat () const
+  {
+    return _format;
+  }
+
+  void close ()
+  {
+    flush ();
+    clear ();
+
+    if ( _wal )
+    {
+      _wal->close ();
+    }
+  }
+
+
+  void clear ()
+  {
+    /* @MUTEX-LOCK */
+    unique_lock<shared_mutex> lock ( _mutex );
+
+    if ( _read_mode.load ( memory_order_relaxed ) == KvReadMode::EPOCH )
+    {
+      auto retired = new vector<shared_ptr<KvData>> ();
+
+      retired->reserve ( _id_map.size () );
+
+      for ( const auto& [_, v] : _id_map )
+      {
+        retired->push_back ( v );
+      }
+
+      _epoch.retire ( retired );
+      _rcu_keys.clear ();
+      _rcu_ids.clear ();
+    }
+
+    _store.clear ();
+    _id_map.clear ();
+    _store.rehash ( 0 );
+    _id_map.rehash ( 0 );
+    _hot_cache.clear ();
+
+    if ( _filter )
+    {
+      _filter.reset ();
+    }
+
+    _filter_stale = 0;
+
+    lock.unlock ();
+    _epoch.collect ();
+  }
+
+  void setFilter ( KvFilterType filter )
+  {
+    /* @MUTEX-LOCK */
+    unique_lock<shared_mutex> lock ( _mutex );
+    resetFilter ( filter );
+  }
+
   size_t size () const
   {
     shared_lock<shared_mutex> lock ( _mutex );
     return _store.size ();
   }
 
+  KvCacheStats cacheStats () const
+  {
+    return _hot_cache.stats ();
+  }
+
+  void reserve ( size_t size )
+  {
+    /* @MUTEX-LOCK */
+    unique_lock<shared_mutex> lock ( _mutex );
+
+    _store.reserve ( size );
+    _id_map.reserve ( size );
+  }
+
 #ifdef KVSTORE_USE_SIMD
   template <typename T> vector<size_t> findValuesAVX ( const vector<T>& values, T target ) const
   {
@@ -598,11 +787,363 @@ public:
 private:
   mutable shared_mutex _mutex;
   string _filename;
+  KvFormat _format = KvFormat::YAML;
+  unique_ptr<KvWal> _wal;
+  uint64_t _snapshot_lsn = 0;
+  bool _recovering = false;
+  atomic<int> _id_seq{ 0 };
+  int _id_offset = 1;
+  int _id_stride = 1;
   unique_ptr<IKvFilter> _filter;
-  HashmapPool<string, shared_ptr<KvData>> _store;
-  HashmapPool<int, shared_ptr<KvData>> _id_map;
-  StringPool _str_pool;
-  LockFreeCache<shared_ptr<KvData>> _hot_cache;
+  size_t _filter_stale = 0;
+  FlatHashMap<KvDigest, shared_ptr<KvData>, KvDigestHash> _store; /* keys view into _str_pool, which never releases a string */
+  FlatHashMap<int, shared_ptr<KvData>, KvIntHash> _id_map;
+  StringPool _str_pool; /* lock-free on hits, striped on misses */
+  ClockCache<shared_ptr<KvData>> _hot_cache;
+  atomic<KvReadMode> _read_mode{ KvReadMode::LOCKED };
+  EpochDomain _epoch;
+  RcuIndex<KvDigest, KvData, KvDigestHash> _rcu_keys{ _epoch };
+  RcuIndex<int, KvData, hash<int>> _rcu_ids{ _epoch };
+
+  /* under the exclusive lock */
+  void resetFilter ( KvFilterType filter )
+  {
+    _filter = FilterFactory::createFilter ( filter, _store.size () );
+    _filter_stale = 0;
+
+    if ( _filter )
+    {
+      for ( const auto& [key, _] : _store )
+      {
+        _filter->insertHash ( key.value );
+      }
+    }
+  }
+
+  /**
+   * under the exclusive lock: slot = data, and in EPOCH mode the previous version is retired.
+   * an update keeps the id of the version it replaces, only a new key draws one from _id_seq
+   */
+  void publish ( const KvDigest& k, shared_ptr<KvData>& slot, const shared_ptr<KvData>& data )
+  {
+    data->_id = slot ? slot->getId () : _id_offset + _id_seq.fetch_add ( 1 ) * _id_stride;
+
+    if ( _read_mode.load ( memory_order_relaxed ) == KvReadMode::EPOCH )
+    {
+      _rcu_keys.store ( k, data.get () );
+      _rcu_ids.store ( data->getId (), data.get () );
+
+      if ( slot )
+      {
+        _epoch.retire ( new shared_ptr<KvData> ( slot ) );
+      }
+    }
+
+    slot = data;
+  }
+
+  void unpublish ( const KvDigest& k, const shared_ptr<KvData>& data )
+  {
+    if ( _read_mode.load ( memory_order_relaxed ) == KvReadMode::EPOCH )
+    {
+      _rcu_keys.erase ( k );
+      _rcu_ids.erase ( data->getId () );
+      _epoch.retire ( new shared_ptr<KvData> ( data ) );
+    }
+  }
+
+  void recover ( const string& filename )
+  {
+    {
+      /* @MUTEX-LOCK */
+      unique_lock<shared_mutex> lock ( _mutex );
+      _filename = filename;
+    }
+
+    ifstream file ( filename );
+
+    if ( !file.good () )
+    {
+      if ( _wal )
+      {
+        replayWal ();
+      }
+
+      if ( _format == KvFormat::BINARY )
+      {
+        flush ( filename );
+        return;
+      }
+
+      ofstream newFile ( filename );
+
+      if ( newFile.good () )
+      {
+        YAML::Node yml;
+
+        yml["filter"] = "default";
+        yml["data"] = YAML::Node ( YAML::NodeType::Sequence );
+
+        newFile << YAML::Dump ( yml );
+      }
+      return;
+    }
+
+    try
+    {
+      auto info = readSnapshot (
+          filename, [this] ( size_t size ) { reserve ( size ); }, [this] ( string_view k, const KvValue& v ) { push ( k, v ); } );
+
+      _format = info.format;
+      _snapshot_lsn = info.lsn;
+
+      if ( info.filter )
+      {
+        setFilter ( *info.filter );
+      }
+    }
+    catch ( const YAML::Exception& e )
+    {
+      clear ();
+    }
+    catch ( const runtime_error& e )
+    {
+      clear ();
+    }
+
+    if ( _wal )
+    {
+      replayWal ();
+    }
+  }
+
+  void replayWal ()
+  {
+    _wal->advance ( _snapshot_lsn );
+
+    _wal->replay ( _snapshot_lsn,
+                   [this] ( const KvWalRecord& r )
+                   {
+                     if ( r.op == KvWalOp::PUSH )
+                     {
+                       push ( r.key, decodeValue ( r.type, r.value ) );
+                     }
+                     else
+                     {
+                       remove ( r.key );
+                     }
+                   } );
+  }
+
+  void commitWal ( uint64_t lsn )
+  {
+    if ( lsn )
+    {
+      _wal->commit ( lsn );
+    }
+  }
+
+  uint64_t snapshot ( vector<pair<string, shared_ptr<KvData>>>& items, KvFilterType& filter ) const
+  {
+    /* @MUTEX-LOCK */
+    shared_lock<shared_mutex> lock ( _mutex );
+
+    items.reserve ( items.size () + _store.size () );
+
+    for ( const auto& [key, value] : _store )
+    {
+      items.emplace_back ( string ( key.key ), value );
+    }
+
+    filter = _filter ? _filter->getType () : KvFilterType::DEFAULT;
+    return _wal ? _wal->lsn () : _snapshot_lsn;
+  }
+
+  static bool writeYaml ( const string& filename, KvFilterType filter, uint64_t lsn, vector<pair<string, shared_ptr<KvData>>>& items )
+  {
+    YAML::Node yml;
+    yml["filter"] = filterToString ( filter );
+    yml["lsn"] = lsn;
+
+    YAML::Node dataNode;
+    dataNode.SetStyle ( YAML::EmitterStyle::Block );
+
+    PARALLEL_FOR ( items.begin (), items.end (), [] ( auto& item ) {} );
+    sort ( items.begin (), items.end () );
+
+    for ( const auto& [k, v] : items )
+    {
+      YAML::Node o;
+
+      o["id"] = v->getId ();
+      o["key"] = k;
+      o["value"] = valueToYaml ( v->getValue () );
+      o["type"] = typeToString ( v->getType () );
+      o["created"] = v->getCreated ();
+
+      dataNode.push_back ( o );
+    }
+
+    yml["data"] = dataNode;
+
+    /* written beside and renamed over, a crash mid-write leaves the previous snapshot intact */
+    const string tmp = filename + ".tmp";
+    ofstream out ( tmp );
+
+    if ( !out )
+    {
+      return false;
+    }
+
+    out << YAML::Dump ( yml );
+    out.close ();
+
+    if ( out.fail () )
+    {
+      std::remove ( tmp.c_str () );
+      return false;
+    }
+
+    try
+    {
+      KvWal::syncFile ( tmp );
+    }
+    catch ( ... )
+    {
+      std::remove ( tmp.c_str () );
+      throw;
+    }
+
+    if ( std::rename ( tmp.c_str (), filename.c_str () ) != 0 )
+    {
+      std::remove ( tmp.c_str () );
+      return false;
+    }
+
+    return true;
+  }
+
+  static void writeBinary ( const string& filename, KvFilterType filter, uint64_t lsn, const vector<pair<string, shared_ptr<KvData>>>& items )
+  {
+    const string tmp = filename + ".tmp";
+
+    {
+      KvSnapshotWriter writer ( tmp, static_cast<uint8_t> ( filter ), lsn );
+      string value;
+
+      for ( const auto& [k, v] : items )
+      {
+        encodeValue ( v->getValue (), value );
+        writer.write ( { v->getId (), static_cast<uint8_t> ( v->getType () ), v->getCreated (), k, value } );
+      }
+
+      writer.close ();
+    }
+
+    try
+    {
+      KvWal::syncFile ( tmp );
+    }
+    catch ( ... )
+    {
+      std::remove ( tmp.c_str () );
+      throw;
+    }
+
+    if ( std::rename ( tmp.c_str (), filename.c_str () ) != 0 )
+    {
+      std::remove ( tmp.c_str () );
+      throw runtime_error ( "RUNTIME_ERROR: snapshot rename " + filename );
+    }
+  }
+
+  struct SnapshotInfo
+  {
+    KvFormat format = KvFormat::YAML;
+    optional<KvFilterType> filter;
+    uint64_t lsn = 0;
+  };
+
+  /**
+   * parses a yaml or binary snapshot, fn ( key, value ) per entry
+   */
+  template <typename R, typename F> static SnapshotInfo readSnapshot ( const string& filename, R&& reserve, F&& fn )
+  {
+    SnapshotInfo info;
+
+    if ( KvSnapshotReader::isSnapshot ( filename ) )
+    {
+      KvSnapshotReader reader ( filename );
+
+      info.format = KvFormat::BINARY;
+      info.filter = static_cast<KvFilterType> ( reader.filter () );
+      info.lsn = reader.lsn ();
+
+      reserve ( reader.count () );
+      reader.forEach ( [&fn] ( const KvSnapshotRecord& r ) { fn ( r.key, decodeValue ( r.type, r.value ) ); } );
+
+      return info;
+    }
+
+    YAML::Node yml = YAML::LoadFile ( filename );
+
+    if ( yml["lsn"] )
+    {
+      info.lsn = yml["lsn"].as<uint64_t> ();
+    }
+
+    if ( yml["data"] )
+    {
+      const auto& data = yml["data"];
+      const size_t size = data.size ();
+      const size_t threshold = 10000;
+
+      reserve ( size );
+
+      if ( size > threshold )
+      {
+        vector<pair<string, KvValue>> temp;
+        temp.reserve ( size );
+
+        /* clang-format off */
+        #pragma omp parallel for
+        for ( size_t i = 0; i < size; ++i )
+        {
+          const auto& item = data[i];
+          auto key = item["key"].as<string> ();
+          auto type = stringToType ( item["type"].as<string> () );
+          auto value = yamlToValue ( item["value"], type );
+
+          #pragma omp critical
+          temp.emplace_back ( key, value );
+          /* clang-format on */
+        }
+
+        for ( const auto& [k, v] : temp )
+        {
+          fn ( k, v );
+        }
+      }
+      else
+      {
+        for ( const auto& item : data )
+        {
+          auto k = item["key"].as<string> ();
+          auto type = stringToType ( item["type"].as<string> () );
+          auto v = yamlToValue ( item["value"], type );
+
+          fn ( k, v );
+        }
+      }
+    }
+
+    if ( yml["filter"] )
+    {
+      info.filter = stringToFilter ( yml["filter"].as<string> () );
+    }
+
+    return info;
+  }
 
   static KvType determineType ( const KvValue& value )
   {
@@ -667,6 +1208,12 @@ private:
       case KvFilterType::CUCKOO:
         return "cuckoo";
 
+      case KvFilterType::BLOCKED_BLOOM:
+        return "blocked_bloom";
+
+      case KvFilterType::COUNTING_BLOOM:
+        return "counting_bloom";
+
       default:
       case KvFilterType::DEFAULT:
         return "default";
@@ -683,6 +1230,14 @@ private:
     {
       return KvFilterType::CUCKOO;
     }
+    else if ( str == "blocked_bloom" )
+    {
+      return KvFilterType::BLOCKED_BLOOM;
+    }
+    else if ( str == "counting_bloom" )
+    {
+      return KvFilterType::COUNTING_BLOOM;
+    }
     else
     {
       return KvFilterType::DEFAULT;
@@ -739,6 +1294,60 @@ private:
         return node.as<string> ();
     }
   }
+
+  static void encodeValue ( const KvValue& value, string& out )
+  {
+    visit (
+        [&out] ( auto&& arg )
+        {
+          using T = decay_t<decltype ( arg )>;
+
+          if constexpr ( is_same_v<T, string> )
+          {
+            out.assign ( arg );
+          }
+          else
+          {
+            out.assign ( reinterpret_cast<const char*> ( &arg ), sizeof ( T ) );
+          }
+        },
+        value );
+  }
+
+  template <typename T> static T decodeScalar ( string_view bytes )
+  {
+    T v;
+
+    if ( bytes.size () != sizeof ( T ) )
+    {
+      throw runtime_error ( "RUNTIME_ERROR: snapshot value size" );
+    }
+
+    memcpy ( &v, bytes.data (), sizeof ( T ) );
+    return v;
+  }
+
+  static KvValue decodeValue ( uint8_t type, string_view bytes )
+  {
+    switch ( static_cast<KvType> ( type ) )
+    {
+      case KvType::DOUBLE:
+        return decodeScalar<double> ( bytes );
+
+      case KvType::INTEGER:
+        return decodeScalar<int64_t> ( bytes );
+
+      case KvType::FLOAT:
+        return decodeScalar<float> ( bytes );
+
+      case KvType::BOOLEAN:
+        return decodeScalar<bool> ( bytes );
+
+      default:
+      case KvType::STRING:
+        return string ( bytes );
+    }
+  }
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,352 @@
+#ifndef KV_STRING_POOL_HPP
+#define KV_STRING_POOL_HPP
+
+#include "KvHash.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#ifdef _MSC_VER
+#  include <intrin.h>
+#endif
+
+using namespace std;
+
+constexpr size_t STRING_POOL_STRIPES = 64;
+constexpr size_t STRING_POOL_CHUNK_MIN = 256;
+constexpr size_t STRING_POOL_CHUNK_MAX = 64 * 1024;
+constexpr size_t STRING_POOL_SYMBOL_BASE = 6; /* first symbol segment holds 1 << 6 ids */
+constexpr size_t STRING_POOL_SYMBOL_SEGMENTS = 32;
+
+/**
+ * STRING POOL
+ *
+ * concurrent interner, strings are never released until the pool is destroyed
+ * - bytes live in append-only arena chunks: a 16 byte header (hash, symbol id, length) followed by the string,
+ *   the returned string_view stays valid for the lifetime of the pool
+ * - the hash picks one of 64 stripes, each stripe owns an open addressing table of entry pointers
+ * - a hit is a lock-free probe (acquire loads only, nothing written); a miss takes the stripe mutex,
+ *   probes again and appends
+ * - a grown table is published as a whole, the old one is kept until destruction so readers never
+ *   see freed memory (the retired tables together are smaller than the live one)
+ * - every string gets a dense uint32_t symbol id, name ( id ) resolves it lock-free
+ */
+class StringPool
+{
+private:
+  struct Entry
+  {
+    uint64_t hash;
+    uint32_t id;
+    uint32_t len;
+
+    string_view view () const
+    {
+      return string_view ( reinterpret_cast<const char*> ( this + 1 ), len );
+    }
+  };
+
+  struct Table
+  {
+    size_t mask;
+    unique_ptr<atomic<const Entry*>[]> slots;
+
+    explicit Table ( size_t capacity ) : mask ( capacity - 1 ), slots ( new atomic<const Entry*>[capacity] )
+    {
+      for ( size_t i = 0; i < capacity; ++i )
+      {
+        slots[i].store ( nullptr, memory_order_relaxed );
+      }
+    }
+  };
+
+  struct alignas ( 64 ) Stripe
+  {
+    atomic<Table*> table{ nullptr };
+    mutex lock;
+    size_t used = 0;
+    char* cur = nullptr;
+    size_t left = 0;
+    size_t chunk = STRING_POOL_CHUNK_MIN;
+    vector<unique_ptr<char[]>> chunks;
+    vector<unique_ptr<Table>> tables; /* back () is the live table */
+  };
+
+  unique_ptr<Stripe[]> _stripes;
+  atomic<atomic<const Entry*>*> _symbols[STRING_POOL_SYMBOL_SEGMENTS];
+  atomic<uint32_t> _count{ 0 };
+  atomic<size_t> _bytes{ 0 };
+
+public:
+  StringPool () : _stripes ( new Stripe[STRING_POOL_STRIPES] )
+  {
+    for ( size_t i = 0; i < STRING_POOL_STRIPES; ++i )
+    {
+      _stripes[i].tables.emplace_back ( new Table ( 16 ) );
+      _stripes[i].table.store ( _stripes[i].tables.back ().get (), memory_order_relaxed );
+    }
+
+    for ( auto& s : _symbols )
+    {
+      s.store ( nullptr, memory_order_relaxed );
+    }
+  }
+
+  ~StringPool ()
+  {
+    for ( auto& s : _symbols )
+    {
+      delete[] s.load ( memory_order_relaxed );
+    }
+  }
+
+  StringPool ( const StringPool& ) = delete;
+  StringPool& operator= ( const StringPool& ) = delete;
+
+  string_view intern ( string_view str )
+  {
+    return get ( str )->view ();
+  }
+
+  void intern ( vector<string_view>& strs )
+  {
+    for ( auto& str : strs )
+    {
+      str = get ( str )->view ();
+    }
+  }
+
+  /**
+   * interns and returns the interned view with the KvHash value the pool already computed
+   */
+  KvDigest digest ( string_view str )
+  {
+    const Entry* e = get ( str );
+    return KvDigest ( e->view (), e->hash );
+  }
+
+  /**
+   * interns and returns the dense symbol id, ids start at 0 and are never reused
+   */
+  uint32_t symbol ( string_view str )
+  {
+    return get ( str )->id;
+  }
+
+  string_view name ( uint32_t id ) const
+  {
+    if ( id < _count.load ( memory_order_acquire ) )
+    {
+      size_t offset;
+      const atomic<const Entry*>* seg = _symbols[segment ( id, offset )].load ( memory_order_acquire );
+
+      if ( seg )
+      {
+        if ( const Entry* e = seg[offset].load ( memory_order_acquire ) )
+        {
+          return e->view ();
+        }
+      }
+    }
+
+    throw runtime_error ( "RUNTIME_ERROR: Unknown symbol id " + to_string ( id ) );
+  }
+
+  /**
+   * lookup without interning, empty view when the string is not in the pool
+   */
+  string_view find ( string_view str ) const
+  {
+    const uint64_t h = KvHash::hash ( str );
+    const Entry* e = probe ( _stripes[stripe ( h )].table.load ( memory_order_acquire ), str, h );
+
+    return e ? e->view () : string_view ();
+  }
+
+  size_t size () const
+  {
+    return _count.load ( memory_order_relaxed );
+  }
+
+  /**
+   * arena bytes in use (headers and strings)
+   */
+  size_t bytes () const
+  {
+    return _bytes.load ( memory_order_relaxed );
+  }
+
+private:
+  static size_t stripe ( uint64_t h )
+  {
+    return static_cast<size_t> ( h >> 58 ) & ( STRING_POOL_STRIPES - 1 );
+  }
+
+  static const Entry* probe ( const Table* t, string_view str, uint64_t h )
+  {
+    for ( size_t i = h & t->mask;; i = ( i + 1 ) & t->mask )
+    {
+      const Entry* e = t->slots[i].load ( memory_order_acquire );
+
+      if ( !e || ( e->hash == h && e->view () == str ) )
+      {
+        return e;
+      }
+    }
+  }
+
+  /**
+   * segment k holds ids [ (2^k - 1) << BASE, (2^(k+1) - 1) << BASE ), so the directory never moves
+   */
+  static size_t segment ( uint32_t id, size_t& offset )
+  {
+    const uint64_t pos = static_cast<uint64_t> ( id ) + ( 1ULL << STRING_POOL_SYMBOL_BASE );
+    const size_t k = log2 ( pos ) - STRING_POOL_SYMBOL_BASE;
+
+    offset = static_cast<size_t> ( pos - ( 1ULL << ( k + STRING_POOL_SYMBOL_BASE ) ) );
+    return k;
+  }
+
+  static size_t log2 ( uint64_t x )
+  {
+#ifdef _MSC_VER
+    unsigned long i;
+    _BitScanReverse64 ( &i, x );
+    return i;
+#else
+    return static_cast<size_t> ( 63 - __builtin_clzll ( x ) );
+#endif
+  }
+
+  const Entry* get ( string_view str )
+  {
+    const uint64_t h = KvHash::hash ( str );
+    Stripe& s = _stripes[stripe ( h )];
+
+    if ( const Entry* e = probe ( s.table.load ( memory_order_acquire ), str, h ) )
+    {
+      return e;
+    }
+
+    /* @MUTEX-LOCK */
+    lock_guard<mutex> lock ( s.lock );
+    Table* t = s.tables.back ().get ();
+
+    if ( const Entry* e = probe ( t, str, h ) )
+    {
+      return e;
+    }
+
+    if ( ( s.used + 1 ) * 4 > ( t->mask + 1 ) * 3 )
+    {
+      t = grow ( s );
+    }
+
+    Entry* e = append ( s, str, h );
+    size_t i = h & t->mask;
+
+    while ( t->slots[i].load ( memory_order_relaxed ) )
+    {
+      i = ( i + 1 ) & t->mask;
+    }
+
+    t->slots[i].store ( e, memory_order_release );
+    s.used++;
+
+    return e;
+  }
+
+  Entry* append ( Stripe& s, string_view str, uint64_t h )
+  {
+    const size_t need = ( sizeof ( Entry ) + str.size () + 1 + alignof ( Entry ) - 1 ) & ~( alignof ( Entry ) - 1 );
+
+    if ( need > s.left )
+    {
+      const size_t size = max ( s.chunk, need );
+
+      s.chunks.emplace_back ( new char[size] );
+      s.cur = s.chunks.back ().get ();
+      s.left = size;
+      s.chunk = min ( s.chunk * 2, STRING_POOL_CHUNK_MAX );
+    }
+
+    Entry* e = new ( s.cur ) Entry{ h, 0, static_cast<uint32_t> ( str.size () ) };
+    char* data = reinterpret_cast<char*> ( e + 1 );
+
+    memcpy ( data, str.data (), str.size () );
+    data[str.size ()] = '\0';
+    s.cur += need;
+    s.left -= need;
+    _bytes.fetch_add ( need, memory_order_relaxed );
+
+    e->id = _count.fetch_add ( 1, memory_order_relaxed );
+    publish ( e );
+
+    return e;
+  }
+
+  void publish ( const Entry* e )
+  {
+    size_t offset;
+    const size_t k = segment ( e->id, offset );
+    atomic<const Entry*>* seg = _symbols[k].load ( memory_order_acquire );
+
+    if ( !seg )
+    {
+      const size_t n = static_cast<size_t> ( 1 ) << ( k + STRING_POOL_SYMBOL_BASE );
+      atomic<const Entry*>* fresh = new atomic<const Entry*>[n];
+
+      for ( size_t i = 0; i < n; ++i )
+      {
+        fresh[i].store ( nullptr, memory_order_relaxed );
+      }
+
+      if ( _symbols[k].compare_exchange_strong ( seg, fresh, memory_order_acq_rel ) )
+      {
+        seg = fresh;
+      }
+      else
+      {
+        delete[] fresh;
+      }
+    }
+
+    seg[offset].store ( e, memory_order_release );
+  }
+
+  Table* grow ( Stripe& s )
+  {
+    const Table* old = s.tables.back ().get ();
+    Table* t = new Table ( ( old->mask + 1 ) * 2 );
+
+    for ( size_t i = 0; i <= old->mask; ++i )
+    {
+      if ( const Entry* e = old->slots[i].load ( memory_order_relaxed ) )
+      {
+        size_t j = e->hash & t->mask;
+
+        while ( t->slots[j].load ( memory_order_relaxed ) )
+        {
+          j = ( j + 1 ) & t->mask;
+        }
+
+        t->slots[j].store ( e, memory_order_relaxed );
+      }
+    }
+
+    s.tables.emplace_back ( t );
+    s.table.store ( t, memory_order_release );
+
+    return t;
+  }
+};
+
+#endif
@@ -0,0 +1,546 @@
+#ifndef KV_WAL_HPP
+#define KV_WAL_HPP
+
+#include <zlib.h>
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace std;
+
+/**
+ * WRITE-AHEAD LOG
+ *
+ * append-only segments (wal-[first lsn].log), little-endian
+ *
+ * [record]  length(4) crc(4) payload(length)
+ *           payload = lsn(8) op(1) type(1) key_len(2) key value
+ *
+ * appenders only copy into the pending buffer, a single writer thread
+ * drains it, so one write(2)/fdatasync(2) commits every record queued meanwhile (group commit)
+ */
+constexpr size_t KV_WAL_RECORD_FIXED = 8 + 1 + 1 + 2;
+constexpr size_t KV_WAL_SEGMENT_SIZE = 64 << 20;
+constexpr size_t KV_WAL_BATCH_SIZE = 1 << 20;
+constexpr uint32_t KV_WAL_INTERVAL = 100;
+
+enum class KvWalSync
+{
+  ALWAYS,   /* fsync before push/remove returns */
+  INTERVAL, /* fsync every interval_ms */
+  NONE      /* leave it to the page cache */
+};
+
+enum class KvWalOp : uint8_t
+{
+  PUSH = 1,
+  REMOVE = 2
+};
+
+struct KvWalOptions
+{
+  string path = "wal";
+  KvWalSync sync = KvWalSync::INTERVAL;
+  uint32_t interval_ms = KV_WAL_INTERVAL;
+  size_t segment_size = KV_WAL_SEGMENT_SIZE;
+  size_t batch_size = KV_WAL_BATCH_SIZE;
+};
+
+struct KvWalRecord
+{
+  uint64_t lsn;
+  KvWalOp op;
+  uint8_t type;
+  string_view key;
+  string_view value;
+};
+
+class KvWal
+{
+private:
+  KvWalOptions _options;
+
+  mutex _mutex;
+  condition_variable _write_cv;
+  condition_variable _durable_cv;
+  string _pending;
+  string _writing;
+  uint64_t _lsn = 0;
+  uint64_t _durable_lsn = 0;
+  bool _stop = false;
+  int _fd = -1;
+  size_t _segment_bytes = 0;
+  string _segment;
+  string _error;
+  thread _worker;
+
+public:
+  explicit KvWal ( const KvWalOptions& options ) : _options ( options )
+  {
+    filesystem::create_directories ( _options.path );
+
+    for ( const auto& segment : segments () )
+    {
+      const size_t valid = scan ( segment, [this] ( const KvWalRecord& r ) { _lsn = max ( _lsn, r.lsn ); } );
+
+      /* cut a torn tail, so nothing written after the restart lands behind it where replay stops */
+      if ( valid == 0 )
+      {
+        filesystem::remove ( segment );
+        syncDirectory ( segment );
+      }
+      else if ( valid < filesystem::file_size ( segment ) )
+      {
+        filesystem::resize_file ( segment, valid );
+        syncFile ( segment );
+      }
+    }
+
+    _durable_lsn = _lsn;
+    _pending.reserve ( _options.batch_size );
+    _writing.reserve ( _options.batch_size );
+    _worker = thread ( [this] { run (); } );
+  }
+
+  ~KvWal ()
+  {
+    close ();
+  }
+
+  KvWal ( const KvWal& ) = delete;
+  KvWal& operator= ( const KvWal& ) = delete;
+
+  /**
+   * call under the store's exclusive lock so lsn order equals apply order,
+   * then commit () the returned lsn after releasing it
+   */
+  uint64_t append ( KvWalOp op, uint8_t type, string_view key, string_view value )
+  {
+    const uint32_t length = static_cast<uint32_t> ( KV_WAL_RECORD_FIXED + key.size () + value.size () );
+
+    /* @MUTEX-LOCK */
+    lock_guard<mutex> lock ( _mutex );
+
+    if ( !_error.empty () )
+    {
+      throw runtime_error ( _error );
+    }
+
+    const uint64_t lsn = ++_lsn;
+    const size_t offset = _pending.size ();
+
+    put<uint32_t> ( length );
+    put<uint32_t> ( 0 );
+    put<uint64_t> ( lsn );
+    put<uint8_t> ( static_cast<uint8_t> ( op ) );
+    put<uint8_t> ( type );
+    put<uint16_t> ( static_cast<uint16_t> ( key.size () ) );
+    _pending.append ( key );
+    _pending.append ( value );
+
+    const uint32_t crc = checksum ( _pending.data () + offset + 8, length );
+    memcpy ( &_pending[offset + 4], &crc, sizeof ( crc ) );
+
+    if ( _options.sync == KvWalSync::ALWAYS || _pending.size () >= _options.batch_size )
+    {
+      _write_cv.notify_one ();
+    }
+
+    return lsn;
+  }
+
+  void commit ( uint64_t lsn )
+  {
+    if ( _options.sync != KvWalSync::ALWAYS )
+    {
+      return;
+    }
+
+    /* @MUTEX-LOCK */
+    unique_lock<mutex> lock ( _mutex );
+    _durable_cv.wait ( lock, [this, lsn] { return _durable_lsn >= lsn || _stop || !_error.empty (); } );
+
+    if ( !_error.empty () )
+    {
+      throw runtime_error ( _error );
+    }
+  }
+
+  /**
+   * blocks until everything appended so far is written (and synced unless NONE)
+   */
+  void sync ()
+  {
+    /* @MUTEX-LOCK */
+    unique_lock<mutex> lock ( _mutex );
+
+    const uint64_t lsn = _lsn;
+
+    _write_cv.notify_one ();
+    _durable_cv.wait ( lock, [this, lsn] { return _durable_lsn >= lsn || _stop || !_error.empty (); } );
+
+    if ( !_error.empty () )
+    {
+      throw runtime_error ( _error );
+    }
+  }
+
+  uint64_t lsn ()
+  {
+    /* @MUTEX-LOCK */
+    lock_guard<mutex> lock ( _mutex );
+    return _lsn;
+  }
+
+  /**
+   * continue numbering after a snapshot that is newer than the log
+   */
+  void advance ( uint64_t lsn )
+  {
+    /* @MUTEX-LOCK */
+    lock_guard<mutex> lock ( _mutex );
+
+    if ( lsn > _lsn )
+    {
+      _lsn = lsn;
+      _durable_lsn = max ( _durable_lsn, lsn );
+    }
+  }
+
+  /**
+   * drop segments fully covered by a durable snapshot at lsn
+   */
+  void checkpoint ( uint64_t lsn )
+  {
+    /* @MUTEX-LOCK */
+    lock_guard<mutex> lock ( _mutex );
+
+    auto files = segments ();
+
+    for ( size_t i = 0; i + 1 < files.size (); ++i )
+    {
+      if ( files[i] == _segment || firstLsn ( files[i + 1] ) > lsn + 1 )
+      {
+        break;
+      }
+
+      filesystem::remove ( files[i] );
+    }
+  }
+
+  /**
+   * a torn or corrupt record ends its segment, replay resumes at the next one
+   */
+  template <typename F> void replay ( uint64_t from, F&& fn )
+  {
+    for ( const auto& segment : segments () )
+    {
+      scan ( segment,
+             [from, &fn] ( const KvWalRecord& r )
+             {
+               if ( r.lsn > from )
+               {
+                 fn ( r );
+               }
+             } );
+    }
+  }
+
+  void close ()
+  {
+    {
+      /* @MUTEX-LOCK */
+      lock_guard<mutex> lock ( _mutex );
+
+      if ( _stop )
+      {
+        return;
+      }
+
+      _stop = true;
+    }
+
+    _write_cv.notify_one ();
+
+    if ( _worker.joinable () )
+    {
+      _worker.join ();
+    }
+
+    if ( _fd >= 0 )
+    {
+      ::close ( _fd );
+      _fd = -1;
+    }
+
+    _durable_cv.notify_all ();
+  }
+
+  static void syncFile ( const string& filename )
+  {
+    int fd = ::open ( filename.c_str (), O_RDONLY );
+
+    if ( fd < 0 || fsync ( fd ) != 0 )
+    {
+      if ( fd >= 0 )
+      {
+        ::close ( fd );
+      }
+
+      throw runtime_error ( "RUNTIME_ERROR: sync " + filename );
+    }
+
+    ::close ( fd );
+  }
+
+  /**
+   * fsync of the directory holding filename, makes a rename into it durable
+   */
+  static void syncDirectory ( const string& filename )
+  {
+    const filesystem::path parent = filesystem::path ( filename ).parent_path ();
+
+    syncFile ( parent.empty () ? string ( "." ) : parent.string () );
+  }
+
+private:
+  template <typename T> void put ( T v )
+  {
+    _pending.append ( reinterpret_cast<const char*> ( &v ), sizeof ( T ) );
+  }
+
+  template <typename T> static T get ( const char* p )
+  {
+    T v;
+    memcpy ( &v, p, sizeof ( T ) );
+    return v;
+  }
+
+  static uint32_t checksum ( const void* data, size_t len )
+  {
+    return static_cast<uint32_t> ( crc32 ( 0, reinterpret_cast<const Bytef*> ( data ), static_cast<uInt> ( len ) ) );
+  }
+
+  void run ()
+  {
+    const auto interval = chrono::milliseconds ( _options.interval_ms );
+
+    /* @MUTEX-LOCK */
+    unique_lock<mutex> lock ( _mutex );
+
+    while ( true )
+    {
+      _write_cv.wait_for ( lock, interval, [this] { return _stop || _pending.size () >= _options.batch_size || ( _options.sync == KvWalSync::ALWAYS && !_pending.empty () ); } );
+
+      const bool stop = _stop;
+      const uint64_t lsn = _lsn;
+
+      if ( !_pending.empty () )
+      {
+        const uint64_t first = get<uint64_t> ( _pending.data () + 8 );
+
+        _writing.swap ( _pending );
+        lock.unlock ();
+
+        string error;
+
+        try
+        {
+          write ( first );
+        }
+        catch ( const runtime_error& e )
+        {
+          error = e.what ();
+        }
+
+        lock.lock ();
+        _writing.clear ();
+
+        if ( !error.empty () )
+        {
+          _error = error;
+          _durable_cv.notify_all ();
+          break;
+        }
+      }
+
+      _durable_lsn = max ( _durable_lsn, lsn );
+      _durable_cv.notify_all ();
+
+      if ( stop )
+      {
+        break;
+      }
+    }
+  }
+
+  void write ( uint64_t first )
+  {
+    if ( _fd < 0 || _segment_bytes >= _options.segment_size )
+    {
+      rotate ( first );
+    }
+
+    const char* p = _writing.data ();
+    size_t remain = _writing.size ();
+
+    while ( remain > 0 )
+    {
+      ssize_t n = ::write ( _fd, p, remain );
+
+      if ( n < 0 )
+      {
+        if ( errno == EINTR )
+        {
+          continue;
+        }
+
+        throw runtime_error ( "RUNTIME_ERROR: wal write " + _segment );
+      }
+
+      p += n;
+      remain -= static_cast<size_t> ( n );
+    }
+
+    _segment_bytes += _writing.size ();
+
+    /* a failed sync is latched by run (), _durable_lsn stays behind */
+    if ( _options.sync != KvWalSync::NONE && fdatasync ( _fd ) != 0 )
+    {
+      throw runtime_error ( "RUNTIME_ERROR: wal sync " + _segment );
+    }
+  }
+
+  void rotate ( uint64_t first )
+  {
+    if ( _fd >= 0 )
+    {
+      if ( _options.sync != KvWalSync::NONE && fdatasync ( _fd ) != 0 )
+      {
+        throw runtime_error ( "RUNTIME_ERROR: wal sync " + _segment );
+      }
+
+      ::close ( _fd );
+      _fd = -1;
+    }
+
+    char name[32];
+    snprintf ( name, sizeof ( name ), "wal-%020llu.log", static_cast<unsigned long long> ( first ) );
+
+    /* always a new file: lsns only grow and recovery removed a segment that was torn from its first record */
+    string segment = ( filesystem::path ( _options.path ) / name ).string ();
+    int fd = ::open ( segment.c_str (), O_WRONLY | O_CREAT | O_EXCL, 0644 );
+
+    if ( fd < 0 )
+    {
+      throw runtime_error ( "RUNTIME_ERROR: wal open " + segment );
+    }
+
+    if ( _options.sync != KvWalSync::NONE )
+    {
+      try
+      {
+        syncDirectory ( segment );
+      }
+      catch ( ... )
+      {
+        ::close ( fd );
+        throw;
+      }
+    }
+
+    {
+      /* @MUTEX-LOCK */
+      lock_guard<mutex> lock ( _mutex );
+
+      _fd = fd;
+      _segment = segment;
+      _segment_bytes = 0;
+    }
+  }
+
+  vector<string> segments () const
+  {
+    vector<string> files;
+
+    for ( const auto& entry : filesystem::directory_iterator ( _options.path ) )
+    {
+      const string name = entry.path ().filename ().string ();
+
+      if ( entry.is_regular_file () && name.rfind ( "wal-", 0 ) == 0 && name.size () > 8 && name.compare ( name.size () - 4, 4, ".log" ) == 0 )
+      {
+        files.push_back ( entry.path ().string () );
+      }
+    }
+
+    sort ( files.begin (), files.end () );
+    return files;
+  }
+
+  static uint64_t firstLsn ( const string& segment )
+  {
+    const string name = filesystem::path ( segment ).filename ().string ();
+    return strtoull ( name.c_str () + 4, nullptr, 10 );
+  }
+
+  /**
+   * fn per valid record, returns the bytes up to the first torn or corrupt one
+   */
+  template <typename F> static size_t scan ( const string& segment, F&& fn )
+  {
+    ifstream in ( segment, ios::binary );
+    const string data ( ( istreambuf_iterator<char> ( in ) ), istreambuf_iterator<char> () );
+
+    const char* pos = data.data ();
+    const char* end = pos + data.size ();
+
+    while ( end - pos >= 8 )
+    {
+      const uint32_t length = get<uint32_t> ( pos );
+      const uint32_t crc = get<uint32_t> ( pos + 4 );
+      const char* p = pos + 8;
+
+      if ( length < KV_WAL_RECORD_FIXED || static_cast<size_t> ( end - p ) < length || checksum ( p, length ) != crc )
+      {
+        break;
+      }
+
+      const uint16_t key_len = get<uint16_t> ( p + 10 );
+
+      if ( KV_WAL_RECORD_FIXED + key_len > length )
+      {
+        break;
+      }
+
+      KvWalRecord r;
+
+      r.lsn = get<uint64_t> ( p );
+      r.op = static_cast<KvWalOp> ( get<uint8_t> ( p + 8 ) );
+      r.type = get<uint8_t> ( p + 9 );
+      r.key = string_view ( p + KV_WAL_RECORD_FIXED, key_len );
+      r.value = string_view ( p + KV_WAL_RECORD_FIXED + key_len, length - KV_WAL_RECORD_FIXED - key_len );
+
+      fn ( r );
+      pos = p + length;
+    }
+
+    return static_cast<size_t> ( pos - data.data () );
+  }
+};
+
+#endif
@@ -0,0 +1,299 @@
+#ifndef NID_TABLE_HPP
+#define NID_TABLE_HPP
+
+#include "../types/AdvancedType.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <shared_mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+constexpr uint32_t NID_MAX = 0xFFFFFF;
+constexpr size_t NID_NAME_SIZE = 255;
+constexpr size_t NID_CACHE_LINE = 64;
+constexpr size_t NID_PAGE_SIZE = 4096;       /* NIDs per page */
+constexpr size_t NID_NAME_COMPACT = 1 << 20; /* dead name bytes before the arena is compacted */
+
+struct NidRecord
+{
+  int32_t value;
+  uint8_t status;
+  uint64_t updated;
+  bool valid;
+};
+
+/**
+ * NID TABLE
+ *
+ * memory DB directly indexed by uint24_t NID, structure-of-arrays:
+ * - state   : atomic<uint64_t> = VALUE(32) | STATUS(8) << 32 | VALID << 40
+ * - updated : atomic<uint64_t> UPDATED_AT
+ * - name    : append-only arena, read only on the cold path, compacted once renames left enough dead bytes
+ *
+ * 16 hot bytes per NID (+9 bytes of name index and the name itself) instead of a 271 byte record.
+ * the arrays are split in 64 byte aligned pages of NID_PAGE_SIZE NIDs, allocated on the first write into them,
+ * so memory follows the NIDs in use (about 100KB per 4096 NIDs) and not the capacity
+ */
+class NidTable
+{
+private:
+  struct alignas ( NID_CACHE_LINE ) Page
+  {
+    atomic<uint64_t> state[NID_PAGE_SIZE];
+    atomic<uint64_t> updated[NID_PAGE_SIZE];
+    uint64_t name_offset[NID_PAGE_SIZE]; /* under _name_mutex */
+    uint8_t name_length[NID_PAGE_SIZE];
+  };
+
+  static constexpr uint64_t VALID = 1ULL << 40;
+
+  size_t _capacity;
+  unique_ptr<atomic<Page*>[]> _pages;
+
+  mutable shared_mutex _name_mutex;
+  string _names;
+  size_t _name_live = 0;
+
+public:
+  explicit NidTable ( size_t capacity = NID_MAX + 1 ) : _capacity ( min<size_t> ( capacity, NID_MAX + 1 ) )
+  {
+    /* value-initialized: every page starts unallocated */
+    _pages = make_unique<atomic<Page*>[]> ( pageCount () );
+  }
+
+  ~NidTable ()
+  {
+    for ( size_t i = 0; i < pageCount (); ++i )
+    {
+      delete _pages[i].load ( memory_order_relaxed );
+    }
+  }
+
+  NidTable ( const NidTable& ) = delete;
+  NidTable& operator= ( const NidTable& ) = delete;
+
+  /**
+   * true when VALUE or STATUS differs from the stored record (or the NID was never set),
+   * i.e. when the caller has to emit a log record
+   */
+  bool update ( uint24_t nid, int32_t value, uint8_t status, uint64_t updated )
+  {
+    const size_t i = index ( nid );
+    Page& p = page ( i );
+    const uint64_t next = pack ( value, status );
+    const uint64_t prev = p.state[i % NID_PAGE_SIZE].exchange ( next, memory_order_acq_rel );
+
+    p.updated[i % NID_PAGE_SIZE].store ( updated, memory_order_release );
+
+    return prev != next;
+  }
+
+  NidRecord get ( uint24_t nid ) const
+  {
+    const size_t i = index ( nid );
+    const Page* p = find ( i );
+
+    if ( !p )
+    {
+      return { 0, 0, 0, false };
+    }
+
+    const uint64_t state = p->state[i % NID_PAGE_SIZE].load ( memory_order_acquire );
+
+    return { static_cast<int32_t> ( static_cast<uint32_t> ( state ) ), static_cast<uint8_t> ( state >> 32 ), p->updated[i % NID_PAGE_SIZE].load ( memory_order_acquire ), ( state & VALID ) != 0 };
+  }
+
+  bool has ( uint24_t nid ) const
+  {
+    const uint32_t i = nid.to_uint32 ();
+    const Page* p = i < _capacity ? find ( i ) : nullptr;
+
+    return p && ( p->state[i % NID_PAGE_SIZE].load ( memory_order_acquire ) & VALID ) != 0;
+  }
+
+  void reset ( uint24_t nid )
+  {
+    const size_t i = index ( nid );
+    Page* p = find ( i );
+
+    if ( p )
+    {
+      p->state[i % NID_PAGE_SIZE].store ( 0, memory_order_release );
+      p->updated[i % NID_PAGE_SIZE].store ( 0, memory_order_release );
+    }
+  }
+
+  void setName ( uint24_t nid, string_view name )
+  {
+    const size_t i = index ( nid );
+
+    if ( name.size () > NID_NAME_SIZE )
+    {
+      throw length_error ( "RUNTIME_ERROR: NID name length" );
+    }
+
+    Page& p = page ( i );
+
+    /* @MUTEX-LOCK */
+    unique_lock<shared_mutex> lock ( _name_mutex );
+
+    _name_live += name.size ();
+    _name_live -= p.name_length[i % NID_PAGE_SIZE];
+    p.name_offset[i % NID_PAGE_SIZE] = _names.size ();
+    p.name_length[i % NID_PAGE_SIZE] = static_cast<uint8_t> ( name.size () );
+    _names.append ( name );
+
+    /* renames only append, rewrite the arena once most of it is dead */
+    if ( _names.size () - _name_live > max ( _name_live, NID_NAME_COMPACT ) )
+    {
+      compact ();
+    }
+  }
+
+  string name ( uint24_t nid ) const
+  {
+    const size_t i = index ( nid );
+    const Page* p = find ( i );
+
+    if ( !p )
+    {
+      return string ();
+    }
+
+    /* @MUTEX-LOCK */
+    shared_lock<shared_mutex> lock ( _name_mutex );
+    return _names.substr ( p->name_offset[i % NID_PAGE_SIZE], p->name_length[i % NID_PAGE_SIZE] );
+  }
+
+  /**
+   * fn ( uint32_t nid, const NidRecord& ) for every record that was set
+   */
+  template <typename F> void forEach ( F&& fn ) const
+  {
+    for ( size_t n = 0; n < pageCount (); ++n )
+    {
+      const Page* p = _pages[n].load ( memory_order_acquire );
+
+      if ( !p )
+      {
+        continue;
+      }
+
+      for ( size_t j = 0; j < NID_PAGE_SIZE && n * NID_PAGE_SIZE + j < _capacity; ++j )
+      {
+        const uint64_t state = p->state[j].load ( memory_order_acquire );
+
+        if ( state & VALID )
+        {
+          fn ( static_cast<uint32_t> ( n * NID_PAGE_SIZE + j ), NidRecord{ static_cast<int32_t> ( static_cast<uint32_t> ( state ) ), static_cast<uint8_t> ( state >> 32 ), p->updated[j].load ( memory_order_acquire ), true } );
+        }
+      }
+    }
+  }
+
+  size_t capacity () const
+  {
+    return _capacity;
+  }
+
+  /**
+   * bytes allocated for records and the name index (pages in use)
+   */
+  size_t memory () const
+  {
+    size_t pages = 0;
+
+    for ( size_t n = 0; n < pageCount (); ++n )
+    {
+      pages += _pages[n].load ( memory_order_relaxed ) != nullptr;
+    }
+
+    return pages * sizeof ( Page ) + pageCount () * sizeof ( atomic<Page*> );
+  }
+
+private:
+  static uint64_t pack ( int32_t value, uint8_t status )
+  {
+    return static_cast<uint64_t> ( static_cast<uint32_t> ( value ) ) | ( static_cast<uint64_t> ( status ) << 32 ) | VALID;
+  }
+
+  size_t index ( uint24_t nid ) const
+  {
+    const uint32_t i = nid.to_uint32 ();
+
+    if ( i >= _capacity )
+    {
+      throw out_of_range ( "RUNTIME_ERROR: NID out of range" );
+    }
+
+    return i;
+  }
+
+  size_t pageCount () const
+  {
+    return ( _capacity + NID_PAGE_SIZE - 1 ) / NID_PAGE_SIZE;
+  }
+
+  Page* find ( size_t i ) const
+  {
+    return _pages[i / NID_PAGE_SIZE].load ( memory_order_acquire );
+  }
+
+  /**
+   * the page of i, allocated (zeroed) by the first writer, a writer losing the race frees its copy
+   */
+  Page& page ( size_t i )
+  {
+    atomic<Page*>& slot = _pages[i / NID_PAGE_SIZE];
+    Page* p = slot.load ( memory_order_acquire );
+
+    if ( !p )
+    {
+      Page* fresh = new Page ();
+
+      if ( slot.compare_exchange_strong ( p, fresh, memory_order_acq_rel, memory_order_acquire ) )
+      {
+        p = fresh;
+      }
+      else
+      {
+        delete fresh;
+      }
+    }
+
+    return *p;
+  }
+
+  /* under the exclusive _name_mutex */
+  void compact ()
+  {
+    string names;
+
+    names.reserve ( _name_live );
+
+    for ( size_t n = 0; n < pageCount (); ++n )
+    {
+      Page* p = _pages[n].load ( memory_order_acquire );
+
+      for ( size_t j = 0; p && j < NID_PAGE_SIZE; ++j )
+      {
+        const uint64_t offset = names.size ();
+
+        names.append ( _names, p->name_offset[j], p->name_length[j] );
+        p->name_offset[j] = offset;
+      }
+    }
+
+    _names.swap ( names );
+  }
+};
+
+#endif
@@ -0,0 +1,1069 @@
+#ifndef LOG_ARCHIVE_HPP
+#define LOG_ARCHIVE_HPP
+
+#include "LogCodec.hpp"
+#include "LogRecord.hpp"
+#include "LogSegment.hpp"
+#include <zlib.h>
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <memory>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if __has_include( <zstd.h> )
+#  include <zstd.h>
+#  define LOG_USE_ZSTD 1
+#endif
+
+using namespace std;
+
+/**
+ * LOG ARCHIVE
+ *
+ * one day on the cold tier, [cold]/YYYY/MM/DD.arc, little-endian
+ *
+ * [frames]  independently compressed frames, NIDs ascending
+ *           frame = entries: nid(4) count(4) bytes(4) + records (RAW) or a LogCodec block (PACKED)
+ * [index]   frame(40): first nid(4) last nid(4) offset(8) size(4) raw size(4) first TIME(4) last TIME(4)
+ *           crc32 of the raw frame(4) reserved(4)
+ * [footer]  index offset(8) frames(4) day(4) crc32 of the index(4) version(2) codec(1) encoding(1) magic(8)
+ *
+ * a NID that does not fit the rest of a frame starts the next one, and one longer than a frame gets frames of
+ * its own, so a query reads only the frames whose NID and TIME ranges overlap it. a frame that does not shrink
+ * is stored as is (size == raw size)
+ */
+constexpr char LOG_ARCHIVE_MAGIC[8] = { 'R', 'I', 'K', 'L', 'A', 'R', 'C', '\0' };
+constexpr uint16_t LOG_ARCHIVE_VERSION = 1;
+constexpr size_t LOG_ARCHIVE_FOOTER_SIZE = 32;
+constexpr size_t LOG_ARCHIVE_ENTRY_SIZE = 12;
+constexpr size_t LOG_ARCHIVE_FRAME_BYTES = 256 << 10; /* records per frame before encoding, in bytes */
+constexpr size_t LOG_ARCHIVE_BATCH_FRAMES = 4;        /* frames per thread compressed at once */
+
+enum class LogCompress : uint8_t
+{
+  NONE = 0,
+  ZLIB = 1,
+  ZSTD = 2 /* only when built with <zstd.h> (-lzstd) */
+};
+
+struct LogFrame
+{
+  uint32_t first_nid;
+  uint32_t last_nid;
+  uint64_t offset;
+  uint32_t size;
+  uint32_t raw;
+  uint32_t first; /* smallest TIME */
+  uint32_t last;  /* largest TIME */
+  uint32_t crc;
+  uint32_t reserved;
+};
+
+static_assert ( sizeof ( LogFrame ) == 40, "LogFrame must stay 40 bytes" );
+
+struct LogArchiveOptions
+{
+  LogCompress codec = LogCompress::ZLIB;       /* storage.cold.compress: false -> NONE */
+  int level = 6;                               /* zlib 1 - 9, zstd 1 - 19 */
+  LogEncoding encoding = LogEncoding::PACKED;  /* LogCodec blocks under the compressor */
+  size_t frame_bytes = LOG_ARCHIVE_FRAME_BYTES;
+  size_t threads = 0;                          /* compressing threads, 0: one per core */
+};
+
+struct LogArchiveStats
+{
+  uint64_t frames;
+  uint64_t records;
+  uint64_t raw;   /* record bytes added */
+  uint64_t bytes; /* compressed frame bytes */
+};
+
+/**
+ * LOG ARCHIVE CODEC
+ *
+ * the frame compressors
+ */
+class LogArchiveCodec
+{
+public:
+  static bool available ( LogCompress codec )
+  {
+#ifdef LOG_USE_ZSTD
+    return codec <= LogCompress::ZSTD;
+#else
+    return codec <= LogCompress::ZLIB;
+#endif
+  }
+
+  static void compress ( LogCompress codec, int level, const string& in, string& out )
+  {
+    if ( codec == LogCompress::ZLIB )
+    {
+      uLongf n = compressBound ( static_cast<uLong> ( in.size () ) );
+
+      out.resize ( n );
+
+      if ( compress2 ( reinterpret_cast<Bytef*> ( &out[0] ), &n, reinterpret_cast<const Bytef*> ( in.data () ), static_cast<uLong> ( in.size () ), level ) != Z_OK )
+      {
+        throw runtime_error ( "RUNTIME_ERROR: archive zlib compress" );
+      }
+
+      out.resize ( n );
+      return;
+    }
+
+#ifdef LOG_USE_ZSTD
+    if ( codec == LogCompress::ZSTD )
+    {
+      out.resize ( ZSTD_compressBound ( in.size () ) );
+
+      const size_t n = ZSTD_compress ( &out[0], out.size (), in.data (), in.size (), level );
+
+      if ( ZSTD_isError ( n ) )
+      {
+        throw runtime_error ( string ( "RUNTIME_ERROR: archive zstd compress " ) + ZSTD_getErrorName ( n ) );
+      }
+
+      out.resize ( n );
+      return;
+    }
+#endif
+
+    if ( codec != LogCompress::NONE )
+    {
+      throw runtime_error ( "RUNTIME_ERROR: archive codec not available" );
+    }
+
+    out = in;
+  }
+
+  static void decompress ( LogCompress codec, const char* in, size_t size, size_t raw, string& out )
+  {
+    out.resize ( raw );
+
+    if ( codec == LogCompress::ZLIB )
+    {
+      uLongf n = static_cast<uLongf> ( raw );
+
+      if ( uncompress ( reinterpret_cast<Bytef*> ( &out[0] ), &n, reinterpret_cast<const Bytef*> ( in ), static_cast<uLong> ( size ) ) != Z_OK || n != raw )
+      {
+        throw runtime_error ( "RUNTIME_ERROR: archive zlib decompress" );
+      }
+
+      return;
+    }
+
+#ifdef LOG_USE_ZSTD
+    if ( codec == LogCompress::ZSTD )
+    {
+      const size_t n = ZSTD_decompress ( &out[0], raw, in, size );
+
+      if ( ZSTD_isError ( n ) || n != raw )
+      {
+        throw runtime_error ( "RUNTIME_ERROR: archive zstd decompress" );
+      }
+
+      return;
+    }
+#endif
+
+    throw runtime_error ( "RUNTIME_ERROR: archive codec not available" );
+  }
+};
+
+/**
+ * LOG ARCHIVE WRITER
+ *
+ * streams an archive to DD.arc.tmp and renames it on close (), the archive and the rename are synced before
+ * close () returns (the hot files are removed after it). NIDs are added in ascending order.
+ * full frames are encoded and compressed in batches of LOG_ARCHIVE_BATCH_FRAMES per thread, one frame per
+ * thread at a time, and written in order
+ */
+class LogArchiveWriter
+{
+private:
+  struct Frame
+  {
+    LogFrame index;
+    string raw;  /* entries with RAW records until seal () */
+    string data; /* what goes to the file */
+  };
+
+  string _file;
+  string _tmp;
+  int _fd = -1;
+  uint32_t _day;
+  LogArchiveOptions _options;
+  size_t _threads;
+  uint64_t _offset = 0;
+  vector<Frame> _pending;
+  vector<LogFrame> _frames;
+  bool _started = false;
+  uint32_t _nid = 0;
+  bool _alone = false; /* the last NID spanned frames, the next one starts a new frame */
+  LogArchiveStats _stats{ 0, 0, 0, 0 };
+
+public:
+  LogArchiveWriter ( const string& root, uint32_t day, const LogArchiveOptions& options = LogArchiveOptions () )
+      : _file ( LogPath::archive ( root, day ) ), _tmp ( _file + ".tmp" ), _day ( day ), _options ( options )
+  {
+    if ( !LogArchiveCodec::available ( _options.codec ) )
+    {
+      throw runtime_error ( "RUNTIME_ERROR: archive codec not available" );
+    }
+
+    _options.frame_bytes = max<size_t> ( _options.frame_bytes, sizeof ( LogRecord ) );
+    _threads = _options.threads ? _options.threads : max<size_t> ( thread::hardware_concurrency (), 1 );
+
+    filesystem::create_directories ( LogPath::directory ( root, day ) );
+
+    _fd = ::open ( _tmp.c_str (), O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+
+    if ( _fd < 0 )
+    {
+      throw runtime_error ( "RUNTIME_ERROR: archive open " + _tmp );
+    }
+  }
+
+  /**
+   * an unclosed archive is discarded
+   */
+  ~LogArchiveWriter ()
+  {
+    if ( _fd >= 0 )
+    {
+      ::close ( _fd );
+      ::unlink ( _tmp.c_str () );
+    }
+  }
+
+  LogArchiveWriter ( const LogArchiveWriter& ) = delete;
+  LogArchiveWriter& operator= ( const LogArchiveWriter& ) = delete;
+
+  void add ( uint32_t nid, const LogRecord* records, size_t count )
+  {
+    if ( count == 0 )
+    {
+      return;
+    }
+
+    if ( _started && nid < _nid )
+    {
+      throw runtime_error ( "RUNTIME_ERROR: archive NIDs must be added in ascending order" );
+    }
+
+    bool fresh = _alone || ( !_pending.empty () && _pending.back ().raw.size () + LOG_ARCHIVE_ENTRY_SIZE + count * sizeof ( LogRecord ) > _options.frame_bytes );
+    size_t pieces = 0;
+
+    _started = true;
+    _nid = nid;
+    _stats.records += count;
+    _stats.raw += count * sizeof ( LogRecord );
+
+    while ( count > 0 )
+    {
+      if ( fresh || _pending.empty () || _pending.back ().raw.size () >= _options.frame_bytes )
+      {
+        if ( _pending.size () >= _threads * LOG_ARCHIVE_BATCH_FRAMES )
+        {
+          drain ();
+        }
+
+        _pending.emplace_back ();
+        _pending.back ().index = { nid, nid, 0, 0, 0, UINT32_MAX, 0, 0, 0 };
+        fresh = false;
+      }
+
+      Frame& f = _pending.back ();
+      const size_t n = min ( count, max<size_t> ( ( _options.frame_bytes - f.raw.size () ) / sizeof ( LogRecord ), 1 ) );
+      const uint32_t entry[3] = { nid, static_cast<uint32_t> ( n ), static_cast<uint32_t> ( n * sizeof ( LogRecord ) ) };
+
+      f.raw.append ( reinterpret_cast<const char*> ( entry ), sizeof ( entry ) );
+      f.raw.append ( reinterpret_cast<const char*> ( records ), n * sizeof ( LogRecord ) );
+      f.index.last_nid = nid;
+
+      for ( size_t i = 0; i < n; ++i )
+      {
+        const uint32_t t = records[i].time.to_uint32 ();
+
+        f.index.first = min ( f.index.first, t );
+        f.index.last = max ( f.index.last, t );
+      }
+
+      records += n;
+      count -= n;
+      pieces++;
+    }
+
+    _alone = pieces > 1;
+  }
+
+  /**
+   * compresses what is left, writes the index and the footer and publishes the archive
+   */
+  void close ()
+  {
+    if ( _fd < 0 )
+    {
+      return;
+    }
+
+    drain ();
+
+    const uint64_t index = _offset;
+    const uint32_t frames = static_cast<uint32_t> ( _frames.size () );
+    const uint32_t crc = static_cast<uint32_t> ( crc32 ( 0, reinterpret_cast<const Bytef*> ( _frames.data () ), static_cast<uInt> ( _frames.size () * sizeof ( LogFrame ) ) ) );
+    const uint8_t codec = static_cast<uint8_t> ( _options.codec );
+    const uint8_t encoding = static_cast<uint8_t> ( _options.encoding );
+    string footer;
+
+    footer.append ( reinterpret_cast<const char*> ( _frames.data () ), _frames.size () * sizeof ( LogFrame ) );
+    footer.append ( reinterpret_cast<const char*> ( &index ), sizeof ( index ) );
+    footer.append ( reinterpret_cast<const char*> ( &frames ), sizeof ( frames ) );
+    footer.append ( reinterpret_cast<const char*> ( &_day ), sizeof ( _day ) );
+    footer.append ( reinterpret_cast<const char*> ( &crc ), sizeof ( crc ) );
+    footer.append ( reinterpret_cast<const char*> ( &LOG_ARCHIVE_VERSION ), sizeof ( LOG_ARCHIVE_VERSION ) );
+    footer.append ( reinterpret_cast<const char*> ( &codec ), sizeof ( codec ) );
+    footer.append ( reinterpret_cast<const char*> ( &encoding ), sizeof ( encoding ) );
+    footer.append ( LOG_ARCHIVE_MAGIC, sizeof ( LOG_ARCHIVE_MAGIC ) );
+    write ( footer.data (), footer.size () );
+
+    if ( fdatasync ( _fd ) != 0 )
+    {
+      throw runtime_error ( "RUNTIME_ERROR: archive sync " + _tmp );
+    }
+
+    ::close ( _fd );
+    _fd = -1;
+
+    if ( ::rename ( _tmp.c_str (), _file.c_str () ) != 0 )
+    {
+      ::unlink ( _tmp.c_str () );
+      throw runtime_error ( "RUNTIME_ERROR: archive rename " + _file );
+    }
+
+    syncDirectory ( filesystem::path ( _file ).parent_path ().string () );
+  }
+
+  LogArchiveStats stats () const
+  {
+    return _stats;
+  }
+
+  const string& file () const
+  {
+    return _file;
+  }
+
+private:
+  /**
+   * fsync of dir, makes the rename into it durable
+   */
+  static void syncDirectory ( const string& dir )
+  {
+    int fd = ::open ( dir.c_str (), O_RDONLY | O_DIRECTORY );
+
+    if ( fd < 0 || fsync ( fd ) != 0 )
+    {
+      if ( fd >= 0 )
+      {
+        ::close ( fd );
+      }
+
+      throw runtime_error ( "RUNTIME_ERROR: archive sync " + dir );
+    }
+
+    ::close ( fd );
+  }
+
+  /**
+   * seals the pending frames on up to _threads threads and writes them in order
+   */
+  void drain ()
+  {
+    if ( _pending.empty () )
+    {
+      return;
+    }
+
+    atomic<size_t> next{ 0 };
+    exception_ptr error;
+    atomic<bool> failed{ false };
+    const size_t workers = min ( _threads, _pending.size () );
+    vector<thread> pool;
+
+    auto work = [&] ()
+    {
+      try
+      {
+        for ( size_t i = next++; i < _pending.size () && !failed.load ( memory_order_relaxed ); i = next++ )
+        {
+          seal ( _pending[i] );
+        }
+      }
+      catch ( ... )
+      {
+        /* the first failure wins, the others stop at their next frame */
+        if ( !failed.exchange ( true ) )
+        {
+          error = current_exception ();
+        }
+      }
+    };
+
+    for ( size_t i = 1; i < workers; ++i )
+    {
+      pool.emplace_back ( work );
+    }
+
+    work ();
+
+    for ( auto& t : pool )
+    {
+      t.join ();
+    }
+
+    if ( error )
+    {
+      rethrow_exception ( error );
+    }
+
+    for ( auto& f : _pending )
+    {
+      f.index.offset = _offset;
+      write ( f.data.data (), f.data.size () );
+      _offset += f.data.size ();
+      _frames.push_back ( f.index );
+      _stats.frames++;
+      _stats.bytes += f.data.size ();
+    }
+
+    _pending.clear ();
+  }
+
+  /**
+   * RAW entries -> LogCodec blocks (PACKED), crc, compression
+   */
+  void seal ( Frame& f ) const
+  {
+    if ( _options.encoding == LogEncoding::PACKED )
+    {
+      string packed;
+      string block;
+
+      for ( size_t at = 0; at < f.raw.size (); )
+      {
+        uint32_t entry[3];
+
+        memcpy ( entry, f.raw.data () + at, sizeof ( entry ) );
+        LogCodec::encode ( reinterpret_cast<const LogRecord*> ( f.raw.data () + at + sizeof ( entry ) ), entry[1], block );
+        at += sizeof ( entry ) + entry[2];
+        entry[2] = static_cast<uint32_t> ( block.size () );
+        packed.append ( reinterpret_cast<const char*> ( entry ), sizeof ( entry ) );
+        packed += block;
+      }
+
+      f.raw.swap ( packed );
+    }
+
+    f.index.raw = static_cast<uint32_t> ( f.raw.size () );
+    f.index.crc = static_cast<uint32_t> ( crc32 ( 0, reinterpret_cast<const Bytef*> ( f.raw.data () ), static_cast<uInt> ( f.raw.size () ) ) );
+
+    LogArchiveCodec::compress ( _options.codec, _options.level, f.raw, f.data );
+
+    if ( f.data.size () >= f.raw.size () )
+    {
+      f.data.swap ( f.raw );
+    }
+
+    f.index.size = static_cast<uint32_t> ( f.data.size () );
+    f.raw.clear ();
+    f.raw.shrink_to_fit ();
+  }
+
+  void write ( const char* p, size_t remain )
+  {
+    while ( remain > 0 )
+    {
+      ssize_t n = ::write ( _fd, p, remain );
+
+      if ( n < 0 )
+      {
+        if ( errno == EINTR )
+        {
+          continue;
+        }
+
+        throw runtime_error ( "RUNTIME_ERROR: archive write " + _tmp );
+      }
+
+      p += n;
+      remain -= static_cast<size_t> ( n );
+    }
+  }
+};
+
+/**
+ * LOG ARCHIVE READER
+ *
+ * the index is loaded on open (footer and index crc checked), frames are read with pread and decompressed
+ * per query. const member functions are thread safe
+ */
+class LogArchiveReader
+{
+private:
+  int _fd = -1;
+  string _file;
+  vector<LogFrame> _index;
+  uint32_t _day = 0;
+  LogCompress _codec = LogCompress::NONE;
+  LogEncoding _encoding = LogEncoding::RAW;
+  mutable atomic<uint64_t> _loaded{ 0 };
+
+public:
+  explicit LogArchiveReader ( const string& file ) : _file ( file )
+  {
+    _fd = ::open ( file.c_str (), O_RDONLY );
+
+    if ( _fd < 0 )
+    {
+      throw runtime_error ( "RUNTIME_ERROR: archive open " + file );
+    }
+
+    struct stat st;
+    char footer[LOG_ARCHIVE_FOOTER_SIZE];
+
+    if ( fstat ( _fd, &st ) != 0 || static_cast<size_t> ( st.st_size ) < LOG_ARCHIVE_FOOTER_SIZE ||
+         !readAt ( footer, sizeof ( footer ), static_cast<uint64_t> ( st.st_size ) - LOG_ARCHIVE_FOOTER_SIZE ) )
+    {
+      fail ( "RUNTIME_ERROR: archive stat " );
+    }
+
+    const uint64_t size = static_cast<uint64_t> ( st.st_size );
+    const uint64_t index = get<uint64_t> ( footer );
+    const uint32_t frames = get<uint32_t> ( footer + 8 );
+
+    _day = get<uint32_t> ( footer + 12 );
+    _codec = static_cast<LogCompress> ( footer[22] );
+    _encoding = static_cast<LogEncoding> ( footer[23] );
+
+    if ( memcmp ( footer + 24, LOG_ARCHIVE_MAGIC, sizeof ( LOG_ARCHIVE_MAGIC ) ) != 0 || get<uint16_t> ( footer + 20 ) != LOG_ARCHIVE_VERSION ||
+         ( _encoding != LogEncoding::RAW && _encoding != LogEncoding::PACKED ) || index + static_cast<uint64_t> ( frames ) * sizeof ( LogFrame ) + LOG_ARCHIVE_FOOTER_SIZE != size )
+    {
+      fail ( "RUNTIME_ERROR: archive footer " );
+    }
+
+    _index.resize ( frames );
+
+    if ( !readAt ( reinterpret_cast<char*> ( _index.data () ), frames * sizeof ( LogFrame ), index ) ||
+         static_cast<uint32_t> ( crc32 ( 0, reinterpret_cast<const Bytef*> ( _index.data () ), static_cast<uInt> ( frames * sizeof ( LogFrame ) ) ) ) != get<uint32_t> ( footer + 16 ) )
+    {
+      fail ( "RUNTIME_ERROR: archive index crc " );
+    }
+
+    for ( const auto& f : _index )
+    {
+      if ( f.offset + f.size > index )
+      {
+        fail ( "RUNTIME_ERROR: archive index " );
+      }
+    }
+  }
+
+  ~LogArchiveReader ()
+  {
+    if ( _fd >= 0 )
+    {
+      ::close ( _fd );
+    }
+  }
+
+  LogArchiveReader ( const LogArchiveReader& ) = delete;
+  LogArchiveReader& operator= ( const LogArchiveReader& ) = delete;
+
+  /**
+   * appends the records of nid with from <= TIME <= to, returns how many. only the frames holding nid
+   * whose TIME range overlaps [from, to] are read
+   */
+  size_t read ( uint32_t nid, vector<LogRecord>& out, uint32_t from = 0, uint32_t to = UINT32_MAX ) const
+  {
+    const size_t before = out.size ();
+    string raw;
+    vector<LogRecord> records;
+    auto it = lower_bound ( _index.begin (), _index.end (), nid, [] ( const LogFrame& f, uint32_t n ) { return f.last_nid < n; } );
+
+    for ( ; it != _index.end () && it->first_nid <= nid; ++it )
+    {
+      if ( it->last < from || it->first > to )
+      {
+        continue;
+      }
+
+      load ( *it, raw );
+      entries ( raw,
+                [&] ( uint32_t n, const char* data, uint32_t count, uint32_t bytes )
+                {
+                  if ( n != nid )
+                  {
+                    return;
+                  }
+
+                  records.clear ();
+                  decode ( data, count, bytes, records );
+
+                  for ( const auto& r : records )
+                  {
+                    const uint32_t t = r.time.to_uint32 ();
+
+                    if ( from <= t && t <= to )
+                    {
+                      out.push_back ( r );
+                    }
+                  }
+                } );
+    }
+
+    return out.size () - before;
+  }
+
+  /**
+   * fn ( uint32_t nid, const LogRecord* records, size_t count ) for every entry, NIDs ascending.
+   * a NID split across frames comes in consecutive calls
+   */
+  template <typename F> void forEach ( F&& fn ) const
+  {
+    string raw;
+    vector<LogRecord> records;
+
+    for ( const auto& f : _index )
+    {
+      load ( f, raw );
+      entries ( raw,
+                [&] ( uint32_t nid, const char* data, uint32_t count, uint32_t bytes )
+                {
+                  records.clear ();
+                  decode ( data, count, bytes, records );
+                  fn ( nid, records.data (), records.size () );
+                } );
+    }
+  }
+
+  const vector<LogFrame>& frames () const
+  {
+    return _index;
+  }
+
+  /**
+   * frames read and decompressed so far
+   */
+  uint64_t loaded () const
+  {
+    return _loaded.load ( memory_order_relaxed );
+  }
+
+  uint32_t day () const
+  {
+    return _day;
+  }
+
+  LogCompress codec () const
+  {
+    return _codec;
+  }
+
+  LogEncoding encoding () const
+  {
+    return _encoding;
+  }
+
+private:
+  template <typename T> static T get ( const char* p )
+  {
+    T v;
+    memcpy ( &v, p, sizeof ( T ) );
+    return v;
+  }
+
+  [[noreturn]] void fail ( const char* what )
+  {
+    ::close ( _fd );
+    _fd = -1;
+    throw runtime_error ( what + _file );
+  }
+
+  bool readAt ( char* p, size_t remain, uint64_t offset ) const
+  {
+    while ( remain > 0 )
+    {
+      ssize_t n = pread ( _fd, p, remain, static_cast<off_t> ( offset ) );
+
+      if ( n < 0 && errno == EINTR )
+      {
+        continue;
+      }
+
+      if ( n <= 0 )
+      {
+        return false;
+      }
+
+      p += n;
+      offset += static_cast<uint64_t> ( n );
+      remain -= static_cast<size_t> ( n );
+    }
+
+    return true;
+  }
+
+  void load ( const LogFrame& f, string& raw ) const
+  {
+    string data ( f.size, '\0' );
+
+    if ( !readAt ( &data[0], data.size (), f.offset ) )
+    {
+      throw runtime_error ( "RUNTIME_ERROR: archive read " + _file );
+    }
+
+    if ( f.size == f.raw )
+    {
+      raw.swap ( data );
+    }
+    else
+    {
+      LogArchiveCodec::decompress ( _codec, data.data (), data.size (), f.raw, raw );
+    }
+
+    if ( static_cast<uint32_t> ( crc32 ( 0, reinterpret_cast<const Bytef*> ( raw.data () ), static_cast<uInt> ( raw.size () ) ) ) != f.crc )
+    {
+      throw runtime_error ( "RUNTIME_ERROR: archive frame crc " + _file );
+    }
+
+    _loaded.fetch_add ( 1, memory_order_relaxed );
+  }
+
+  /**
+   * fn ( nid, data, count, bytes ) for every entry of a raw frame
+   */
+  template <typename F> void entries ( const string& raw, F&& fn ) const
+  {
+    for ( size_t at = 0; at < raw.size (); )
+    {
+      uint32_t entry[3];
+
+      if ( raw.size () - at < sizeof ( entry ) )
+      {
+        throw runtime_error ( "RUNTIME_ERROR: archive frame entry " + _file );
+      }
+
+      memcpy ( entry, raw.data () + at, sizeof ( entry ) );
+      at += sizeof ( entry );
+
+      if ( raw.size () - at < entry[2] )
+      {
+        throw runtime_error ( "RUNTIME_ERROR: archive frame entry " + _file );
+      }
+
+      fn ( entry[0], raw.data () + at, entry[1], entry[2] );
+      at += entry[2];
+    }
+  }
+
+  void decode ( const char* data, uint32_t count, uint32_t bytes, vector<LogRecord>& out ) const
+  {
+    if ( _encoding == LogEncoding::PACKED )
+    {
+      if ( LogCodec::decode ( data, bytes, out ) != count )
+      {
+        throw runtime_error ( "RUNTIME_ERROR: archive frame entry " + _file );
+      }
+
+      return;
+    }
+
+    if ( static_cast<uint64_t> ( count ) * sizeof ( LogRecord ) != bytes )
+    {
+      throw runtime_error ( "RUNTIME_ERROR: archive frame entry " + _file );
+    }
+
+    const size_t before = out.size ();
+
+    out.resize ( before + count );
+    memcpy ( out.data () + before, data, bytes );
+  }
+};
+
+/**
+ * LOG COLD TIER
+ *
+ * moves closed days from the hot tier (storage.hot.path, [NID]-DD.db or DD.seg) to DD.arc on the cold tier
+ * (storage.cold.path). storage.cold.compress: false maps to LogCompress::NONE
+ */
+class LogColdTier
+{
+public:
+  /**
+   * archives one day, returns the NID count (0 and no archive when the day has no data).
+   * DD.seg and [NID]-DD.db files written after it (late records) are merged by NID, the segment's records first.
+   * an existing DD.arc is merged the same way, its records before the hot ones. hot records already at the end of
+   * the archive's (LogConvert::overlap) are not added again, so a rerun changes nothing
+   * remove deletes the hot files once the archive and its rename are on disk, a file that grew meanwhile is kept
+   */
+  static size_t archive ( const string& hot, const string& cold, uint32_t day, const LogArchiveOptions& options = LogArchiveOptions (), bool remove = true )
+  {
+    const string file = LogPath::segment ( hot, day );
+    const vector<pair<uint32_t, string>> files = LogConvert::dayFiles ( hot, day );
+    unique_ptr<LogSegmentReader> segment;
+    vector<uint32_t> nids;
+    vector<size_t> archived ( files.size (), 0 ); /* records read from each file */
+    size_t count = 0;
+
+    if ( filesystem::exists ( file ) )
+    {
+      segment = make_unique<LogSegmentReader> ( file );
+      nids = segment->nids ();
+    }
+
+    for ( const auto& f : files )
+    {
+      nids.push_back ( f.first );
+    }
+
+    sort ( nids.begin (), nids.end () );
+    nids.erase ( unique ( nids.begin (), nids.end () ), nids.end () );
+
+    if ( nids.empty () )
+    {
+      return 0;
+    }
+
+    {
+      const string existing = LogPath::archive ( cold, day );
+      const bool merge = filesystem::exists ( existing );
+      LogArchiveWriter archive ( cold, day, options );
+      vector<LogRecord> stored; /* the existing archive's records of one NID */
+      vector<LogRecord> records;
+      vector<LogRecord> late;
+      size_t i = 0;
+      size_t next = 0;
+      size_t added = 0;
+
+      /* one NID: the archive's records, then the hot ones it does not hold yet. a rerun (remove off, a crash before
+         the delete) or a file kept because it grew finds its records at the end of the archive's and skips them */
+      auto put = [&] ( uint32_t nid )
+      {
+        if ( i < nids.size () && nids[i] == nid )
+        {
+          records.clear ();
+
+          if ( segment )
+          {
+            segment->read ( nid, records );
+          }
+
+          if ( next < files.size () && files[next].first == nid )
+          {
+            LogConvert::readFile ( files[next].second, late );
+            records.insert ( records.end (), late.begin () + static_cast<ptrdiff_t> ( LogConvert::overlap ( records.data (), records.size (), late.data (), late.size () ) ), late.end () );
+            archived[next++] = late.size ();
+          }
+
+          const size_t skip = LogConvert::overlap ( stored.data (), stored.size (), records.data (), records.size () );
+
+          stored.insert ( stored.end (), records.begin () + static_cast<ptrdiff_t> ( skip ), records.end () );
+          added += records.size () - skip;
+          i++;
+        }
+
+        if ( !stored.empty () )
+        {
+          archive.add ( nid, stored.data (), stored.size () );
+          count++;
+        }
+
+        stored.clear ();
+      };
+
+      /* the hot NIDs below nid */
+      auto flush = [&] ( uint32_t nid )
+      {
+        while ( i < nids.size () && nids[i] < nid )
+        {
+          put ( nids[i] );
+        }
+      };
+
+      /* a day archived before (late records after archiveBefore) is merged, not replaced */
+      if ( merge )
+      {
+        LogArchiveReader reader ( existing );
+        bool started = false;
+        uint32_t last = 0;
+
+        reader.forEach (
+            [&] ( uint32_t nid, const LogRecord* r, size_t n )
+            {
+              if ( !started || nid != last )
+              {
+                if ( started )
+                {
+                  put ( last );
+                }
+
+                flush ( nid );
+                started = true;
+                last = nid;
+              }
+
+              stored.insert ( stored.end (), r, r + n );
+            } );
+
+        if ( started )
+        {
+          put ( last );
+        }
+      }
+
+      flush ( UINT32_MAX );
+
+      /* nothing new for an existing archive: it stays as it is (the writer drops its temporary file) */
+      if ( !merge || added > 0 )
+      {
+        archive.close ();
+      }
+    }
+
+    if ( remove )
+    {
+      segment.reset ();
+      filesystem::remove ( file );
+
+      for ( size_t i = 0; i < files.size (); ++i )
+      {
+        error_code ec;
+        const uintmax_t size = filesystem::file_size ( files[i].second, ec );
+
+        if ( !ec && size / sizeof ( LogRecord ) <= archived[i] )
+        {
+          filesystem::remove ( files[i].second );
+        }
+      }
+    }
+
+    return count;
+  }
+
+  /**
+   * archives every day of the hot tier before day (today - storage.hot.duration), returns the days moved
+   */
+  static size_t archiveBefore ( const string& hot, const string& cold, uint32_t day, const LogArchiveOptions& options = LogArchiveOptions (), bool remove = true )
+  {
+    size_t moved = 0;
+
+    for ( uint32_t d : days ( hot ) )
+    {
+      if ( d < day && archive ( hot, cold, d, options, remove ) > 0 )
+      {
+        moved++;
+      }
+    }
+
+    return moved;
+  }
+
+  /**
+   * days with [NID]-DD.db or DD.seg files under root/YYYY/MM, ascending
+   */
+  static set<uint32_t> days ( const string& root )
+  {
+    set<uint32_t> found;
+
+    if ( !filesystem::is_directory ( root ) )
+    {
+      return found;
+    }
+
+    for ( const auto& year : filesystem::directory_iterator ( root ) )
+    {
+      const int yyyy = number ( year.path ().filename ().string (), 4 );
+
+      if ( yyyy < 0 || !year.is_directory () )
+      {
+        continue;
+      }
+
+      for ( const auto& month : filesystem::directory_iterator ( year.path () ) )
+      {
+        const int MM = number ( month.path ().filename ().string (), 2 );
+
+        if ( MM < 1 || MM > 12 || !month.is_directory () )
+        {
+          continue;
+        }
+
+        for ( const auto& entry : filesystem::directory_iterator ( month.path () ) )
+        {
+          const string name = entry.path ().filename ().string ();
+          const size_t dash = name.rfind ( '-' );
+          int dd = -1;
+
+          if ( name.size () == 6 && name.compare ( 2, 4, ".seg" ) == 0 )
+          {
+            dd = number ( name.substr ( 0, 2 ), 2 );
+          }
+          else if ( dash != string::npos && name.size () == dash + 6 && name.compare ( dash + 3, 3, ".db" ) == 0 )
+          {
+            dd = number ( name.substr ( dash + 1, 2 ), 2 );
+          }
+
+          if ( dd >= 1 && dd <= 31 )
+          {
+            found.insert ( LogPath::day ( yyyy, MM, dd ) );
+          }
+        }
+      }
+    }
+
+    return found;
+  }
+
+private:
+  /**
+   * exactly digits decimal digits, -1 otherwise
+   */
+  static int number ( const string& s, size_t digits )
+  {
+    if ( s.size () != digits )
+    {
+      return -1;
+    }
+
+    int n = 0;
+
+    for ( char c : s )
+    {
+      if ( c < '0' || c > '9' )
+      {
+        return -1;
+      }
+
+      n = n * 10 + ( c - '0' );
+    }
+
+    return n;
+  }
+};
+
+#endif
@@ -0,0 +1,589 @@
+#ifndef LOG_CODEC_HPP
+#define LOG_CODEC_HPP
+
+#include "LogRecord.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#if defined( __SSE2__ ) || defined( _M_X64 ) || ( defined( _M_IX86_FP ) && _M_IX86_FP >= 2 )
+#  include <emmintrin.h>
+#  define LOG_USE_SSE2 1
+#endif
+
+using namespace std;
+
+constexpr size_t LOG_CODEC_FRAME = 128; /* values per bit-packed frame */
+constexpr size_t LOG_CODEC_HEADER = 17;
+
+enum class LogEncoding : uint8_t
+{
+  RAW = 0,   /* 8 byte records as written by LogWriter */
+  PACKED = 1 /* LogCodec block */
+};
+
+struct LogColumns
+{
+  vector<uint32_t> time;
+  vector<int32_t> value;
+  vector<uint8_t> status;
+
+  size_t size () const
+  {
+    return time.size ();
+  }
+};
+
+/**
+ * LOG CODEC
+ *
+ * columnar block of one NID's records, little-endian
+ *
+ * [header]  encoding(1) count(4) t0(4) v0(4) status bytes(4)
+ * [PACKED]  time widths(frames) value widths(frames) time frames value frames status runs
+ * [RAW]     count * 8 byte records
+ *
+ * - TIME: delta-of-delta (c0 = 0, c1 = t1 - t0, ci = (ti - ti-1) - (ti-1 - ti-2)), VALUE: delta (c0 = 0, ci = vi - vi-1),
+ *   both zigzag encoded and bit-packed in frames of 128 with the narrowest width of the frame (the last frame
+ *   holds the remaining values rounded up to 4)
+ * - frames use the 4 lane vertical layout of SIMD-BP128 (D. Lemire, "Decoding billions of integers per second
+ *   through vectorization"): value i sits in lane i % 4, so SSE2 unpacks 4 values per shift and mask and the
+ *   zigzag decode and the prefix sums run in the same registers
+ * - STATUS: runs of (length varint, status)
+ * - encode () falls back to RAW when packing does not make the block smaller (noisy sensors)
+ */
+class LogCodec
+{
+public:
+  static void encode ( const LogRecord* records, size_t count, string& out )
+  {
+    out.clear ();
+
+    const size_t frames = ( count + LOG_CODEC_FRAME - 1 ) / LOG_CODEC_FRAME;
+    vector<uint32_t> t ( frames * LOG_CODEC_FRAME, 0 );
+    vector<uint32_t> v ( frames * LOG_CODEC_FRAME, 0 );
+    string runs;
+
+    for ( size_t i = 0; i < count; ++i )
+    {
+      const uint32_t ti = records[i].time.to_uint32 ();
+      const uint32_t vi = static_cast<uint32_t> ( records[i].value );
+
+      if ( i >= 2 )
+      {
+        t[i] = zigzag ( ( ti - records[i - 1].time.to_uint32 () ) - ( records[i - 1].time.to_uint32 () - records[i - 2].time.to_uint32 () ) );
+      }
+      else if ( i == 1 )
+      {
+        t[i] = zigzag ( ti - records[0].time.to_uint32 () );
+      }
+
+      if ( i >= 1 )
+      {
+        v[i] = zigzag ( vi - static_cast<uint32_t> ( records[i - 1].value ) );
+      }
+
+      if ( i == 0 || records[i].status != records[i - 1].status )
+      {
+        size_t run = 1;
+
+        while ( i + run < count && records[i + run].status == records[i].status )
+        {
+          run++;
+        }
+
+        varint ( run, runs );
+        runs += static_cast<char> ( records[i].status );
+      }
+    }
+
+    header ( out, LogEncoding::PACKED, count, count ? records[0].time.to_uint32 () : 0, count ? static_cast<uint32_t> ( records[0].value ) : 0, static_cast<uint32_t> ( runs.size () ) );
+
+    const size_t widths = out.size ();
+
+    out.resize ( widths + frames * 2 );
+
+    for ( size_t f = 0; f < frames; ++f )
+    {
+      out[widths + f] = static_cast<char> ( width ( t.data () + f * LOG_CODEC_FRAME, frameSize ( count, f ) ) );
+      out[widths + frames + f] = static_cast<char> ( width ( v.data () + f * LOG_CODEC_FRAME, frameSize ( count, f ) ) );
+    }
+
+    for ( size_t f = 0; f < frames; ++f )
+    {
+      pack ( t.data () + f * LOG_CODEC_FRAME, frameSize ( count, f ), static_cast<uint8_t> ( out[widths + f] ), out );
+    }
+
+    for ( size_t f = 0; f < frames; ++f )
+    {
+      pack ( v.data () + f * LOG_CODEC_FRAME, frameSize ( count, f ), static_cast<uint8_t> ( out[widths + frames + f] ), out );
+    }
+
+    out += runs;
+
+    if ( out.size () >= LOG_CODEC_HEADER + count * sizeof ( LogRecord ) )
+    {
+      out.clear ();
+      header ( out, LogEncoding::RAW, count, 0, 0, 0 );
+      out.append ( reinterpret_cast<const char*> ( records ), count * sizeof ( LogRecord ) );
+    }
+  }
+
+  /**
+   * block -> columns, returns the record count
+   */
+  static size_t decode ( const char* p, size_t len, LogColumns& out )
+  {
+    const size_t count = check ( p, len );
+
+    out.time.resize ( roundup ( count ) );
+    out.value.resize ( roundup ( count ) );
+    out.status.resize ( count );
+
+    if ( static_cast<LogEncoding> ( p[0] ) == LogEncoding::RAW )
+    {
+      const char* r = p + LOG_CODEC_HEADER;
+
+      for ( size_t i = 0; i < count; ++i, r += sizeof ( LogRecord ) )
+      {
+        LogRecord rec;
+
+        memcpy ( &rec, r, sizeof ( rec ) );
+        out.time[i] = rec.time.to_uint32 ();
+        out.value[i] = rec.value;
+        out.status[i] = rec.status;
+      }
+    }
+    else
+    {
+      const size_t frames = roundup ( count ) / LOG_CODEC_FRAME;
+      const uint8_t* widths = reinterpret_cast<const uint8_t*> ( p + LOG_CODEC_HEADER );
+      const char* data = p + LOG_CODEC_HEADER + frames * 2;
+      uint32_t tsum = get<uint32_t> ( p + 5 );
+      uint32_t dsum = 0;
+      uint32_t vsum = get<uint32_t> ( p + 9 );
+
+      for ( size_t f = 0; f < frames; ++f )
+      {
+        const size_t n = frameSize ( count, f );
+
+        unpack ( data, n, widths[f], out.time.data () + f * LOG_CODEC_FRAME );
+        data += frameBytes ( n, widths[f] );
+        integrate2 ( out.time.data () + f * LOG_CODEC_FRAME, n, dsum, tsum );
+      }
+
+      for ( size_t f = 0; f < frames; ++f )
+      {
+        const size_t n = frameSize ( count, f );
+        uint32_t* v = reinterpret_cast<uint32_t*> ( out.value.data () + f * LOG_CODEC_FRAME );
+
+        unpack ( data, n, widths[frames + f], v );
+        data += frameBytes ( n, widths[frames + f] );
+        integrate ( v, n, vsum );
+      }
+
+      const char* end = data + get<uint32_t> ( p + 13 );
+      size_t i = 0;
+
+      while ( data < end && i < count )
+      {
+        const size_t run = min<size_t> ( readVarint ( data, end ), count - i );
+
+        if ( data >= end )
+        {
+          break;
+        }
+
+        memset ( out.status.data () + i, static_cast<uint8_t> ( *data++ ), run );
+        i += run;
+      }
+
+      if ( i != count )
+      {
+        throw runtime_error ( "RUNTIME_ERROR: log block status runs" );
+      }
+    }
+
+    out.time.resize ( count );
+    out.value.resize ( count );
+
+    return count;
+  }
+
+  /**
+   * block -> 8 byte records appended to out, returns the record count
+   */
+  static size_t decode ( const char* p, size_t len, vector<LogRecord>& out )
+  {
+    const size_t count = check ( p, len );
+    const size_t before = out.size ();
+
+    if ( count == 0 )
+    {
+      return 0;
+    }
+
+    if ( static_cast<LogEncoding> ( p[0] ) == LogEncoding::RAW )
+    {
+      out.resize ( before + count );
+      memcpy ( out.data () + before, p + LOG_CODEC_HEADER, count * sizeof ( LogRecord ) );
+      return count;
+    }
+
+    static thread_local LogColumns columns;
+
+    decode ( p, len, columns );
+    out.resize ( before + count );
+
+    char* r = reinterpret_cast<char*> ( out.data () + before );
+
+    /* a record is VALUE | STATUS << 32 | TIME << 40 as one little-endian word */
+    for ( size_t i = 0; i < count; ++i, r += sizeof ( LogRecord ) )
+    {
+      const uint64_t word = static_cast<uint32_t> ( columns.value[i] ) | static_cast<uint64_t> ( columns.status[i] ) << 32 | static_cast<uint64_t> ( columns.time[i] ) << 40;
+
+      memcpy ( r, &word, sizeof ( word ) );
+    }
+
+    return count;
+  }
+
+  /**
+   * record count of a block without decoding it
+   */
+  static size_t count ( const char* p, size_t len )
+  {
+    return check ( p, len );
+  }
+
+  static LogEncoding encoding ( const char* p )
+  {
+    return static_cast<LogEncoding> ( p[0] );
+  }
+
+private:
+  template <typename T> static T get ( const char* p )
+  {
+    T v;
+    memcpy ( &v, p, sizeof ( T ) );
+    return v;
+  }
+
+  static size_t roundup ( size_t n )
+  {
+    return ( n + LOG_CODEC_FRAME - 1 ) / LOG_CODEC_FRAME * LOG_CODEC_FRAME;
+  }
+
+  /**
+   * values in frame f: 128, or the rest of the block rounded up to the 4 lanes
+   */
+  static size_t frameSize ( size_t count, size_t f )
+  {
+    return min<size_t> ( LOG_CODEC_FRAME, ( count - f * LOG_CODEC_FRAME + 3 ) / 4 * 4 );
+  }
+
+  /**
+   * n values of w bits: 4 lanes of whole 32 bit words
+   */
+  static size_t frameBytes ( size_t n, uint8_t w )
+  {
+    return ( n / 4 * w + 31 ) / 32 * 16;
+  }
+
+  static void header ( string& out, LogEncoding e, size_t count, uint32_t t0, uint32_t v0, uint32_t runs )
+  {
+    const uint32_t n = static_cast<uint32_t> ( count );
+
+    out += static_cast<char> ( e );
+    out.append ( reinterpret_cast<const char*> ( &n ), 4 );
+    out.append ( reinterpret_cast<const char*> ( &t0 ), 4 );
+    out.append ( reinterpret_cast<const char*> ( &v0 ), 4 );
+    out.append ( reinterpret_cast<const char*> ( &runs ), 4 );
+  }
+
+  /**
+   * validates the block length against its header, returns the count
+   */
+  static size_t check ( const char* p, size_t len )
+  {
+    if ( len < LOG_CODEC_HEADER )
+    {
+      throw runtime_error ( "RUNTIME_ERROR: log block header" );
+    }
+
+    const size_t count = get<uint32_t> ( p + 1 );
+    size_t need = LOG_CODEC_HEADER;
+
+    if ( static_cast<LogEncoding> ( p[0] ) == LogEncoding::RAW )
+    {
+      need += count * sizeof ( LogRecord );
+    }
+    else if ( static_cast<LogEncoding> ( p[0] ) == LogEncoding::PACKED )
+    {
+      const size_t frames = roundup ( count ) / LOG_CODEC_FRAME;
+
+      need += frames * 2;
+
+      for ( size_t f = 0; f < frames * 2 && need <= len; ++f )
+      {
+        const uint8_t w = static_cast<uint8_t> ( p[LOG_CODEC_HEADER + f] );
+
+        if ( w > 32 )
+        {
+          throw runtime_error ( "RUNTIME_ERROR: log block width" );
+        }
+
+        need += frameBytes ( frameSize ( count, f % frames ), w );
+      }
+
+      need += get<uint32_t> ( p + 13 );
+    }
+    else
+    {
+      throw runtime_error ( "RUNTIME_ERROR: log block encoding" );
+    }
+
+    if ( need > len )
+    {
+      throw runtime_error ( "RUNTIME_ERROR: log block length" );
+    }
+
+    return count;
+  }
+
+  static uint32_t zigzag ( uint32_t d )
+  {
+    return ( d << 1 ) ^ static_cast<uint32_t> ( static_cast<int32_t> ( d ) >> 31 );
+  }
+
+  static uint32_t unzigzag ( uint32_t z )
+  {
+    return ( z >> 1 ) ^ ( 0 - ( z & 1 ) );
+  }
+
+  static void varint ( size_t v, string& out )
+  {
+    while ( v >= 0x80 )
+    {
+      out += static_cast<char> ( ( v & 0x7F ) | 0x80 );
+      v >>= 7;
+    }
+
+    out += static_cast<char> ( v );
+  }
+
+  static size_t readVarint ( const char*& p, const char* end )
+  {
+    size_t v = 0;
+
+    for ( int shift = 0; p < end && shift < 64; shift += 7 )
+    {
+      const uint8_t b = static_cast<uint8_t> ( *p++ );
+
+      v |= static_cast<size_t> ( b & 0x7F ) << shift;
+
+      if ( !( b & 0x80 ) )
+      {
+        break;
+      }
+    }
+
+    return v;
+  }
+
+  static uint8_t width ( const uint32_t* in, size_t n )
+  {
+    uint32_t bits = 0;
+
+    for ( size_t i = 0; i < n; ++i )
+    {
+      bits |= in[i];
+    }
+
+    uint8_t w = 0;
+
+    while ( bits )
+    {
+      w++;
+      bits >>= 1;
+    }
+
+    return w;
+  }
+
+  /**
+   * n values of w bits: lane l (values l, l + 4, ...) is a little-endian bit stream in words l, l + 4, ...
+   */
+  static void pack ( const uint32_t* in, size_t n, uint8_t w, string& out )
+  {
+    if ( w == 0 )
+    {
+      return;
+    }
+
+    const size_t words = frameBytes ( n, w ) / sizeof ( uint32_t );
+    vector<uint32_t> packed ( words, 0 );
+
+    for ( size_t lane = 0; lane < 4; ++lane )
+    {
+      size_t bit = 0;
+
+      for ( size_t k = 0; k < n / 4; ++k, bit += w )
+      {
+        const uint64_t v = in[k * 4 + lane];
+        const size_t word = bit / 32;
+        const size_t shift = bit % 32;
+
+        packed[word * 4 + lane] |= static_cast<uint32_t> ( v << shift );
+
+        if ( shift + w > 32 )
+        {
+          packed[( word + 1 ) * 4 + lane] |= static_cast<uint32_t> ( v >> ( 32 - shift ) );
+        }
+      }
+    }
+
+    out.append ( reinterpret_cast<const char*> ( packed.data () ), words * sizeof ( uint32_t ) );
+  }
+
+  static void unpack ( const char* in, size_t n, uint8_t w, uint32_t* out )
+  {
+    if ( w == 0 )
+    {
+      memset ( out, 0, n * sizeof ( uint32_t ) );
+      return;
+    }
+
+#ifdef LOG_USE_SSE2
+    const __m128i mask = _mm_set1_epi32 ( w == 32 ? -1 : static_cast<int> ( ( 1u << w ) - 1 ) );
+    const __m128i* src = reinterpret_cast<const __m128i*> ( in );
+    __m128i cur = _mm_loadu_si128 ( src++ );
+    uint32_t shift = 0;
+
+    for ( size_t k = 0; k < n / 4; ++k )
+    {
+      __m128i v = _mm_srl_epi32 ( cur, _mm_cvtsi32_si128 ( static_cast<int> ( shift ) ) );
+
+      shift += w;
+
+      if ( shift >= 32 )
+      {
+        shift -= 32;
+
+        if ( k + 1 < n / 4 || shift > 0 )
+        {
+          cur = _mm_loadu_si128 ( src++ );
+
+          if ( shift > 0 )
+          {
+            v = _mm_or_si128 ( v, _mm_sll_epi32 ( cur, _mm_cvtsi32_si128 ( static_cast<int> ( w - shift ) ) ) );
+          }
+        }
+      }
+
+      _mm_storeu_si128 ( reinterpret_cast<__m128i*> ( out + k * 4 ), _mm_and_si128 ( v, mask ) );
+    }
+#else
+    const uint64_t mask = ( 1ULL << w ) - 1;
+
+    for ( size_t lane = 0; lane < 4; ++lane )
+    {
+      size_t bit = 0;
+
+      for ( size_t k = 0; k < n / 4; ++k, bit += w )
+      {
+        const size_t word = bit / 32;
+        const size_t shift = bit % 32;
+        uint64_t v = get<uint32_t> ( in + ( word * 4 + lane ) * 4 ) >> shift;
+
+        if ( shift + w > 32 )
+        {
+          v |= static_cast<uint64_t> ( get<uint32_t> ( in + ( ( word + 1 ) * 4 + lane ) * 4 ) ) << ( 32 - shift );
+        }
+
+        out[k * 4 + lane] = static_cast<uint32_t> ( v & mask );
+      }
+    }
+#endif
+  }
+
+  /**
+   * in place: zigzag decode, then running sum from sum (VALUE)
+   */
+  static void integrate ( uint32_t* x, size_t n, uint32_t& sum )
+  {
+#ifdef LOG_USE_SSE2
+    __m128i run = _mm_set1_epi32 ( static_cast<int> ( sum ) );
+
+    for ( size_t i = 0; i < n; i += 4 )
+    {
+      __m128i v = unzigzag ( _mm_loadu_si128 ( reinterpret_cast<const __m128i*> ( x + i ) ) );
+
+      v = _mm_add_epi32 ( prefix ( v ), run );
+      run = _mm_shuffle_epi32 ( v, _MM_SHUFFLE ( 3, 3, 3, 3 ) );
+      _mm_storeu_si128 ( reinterpret_cast<__m128i*> ( x + i ), v );
+    }
+
+    sum = static_cast<uint32_t> ( _mm_cvtsi128_si32 ( run ) );
+#else
+    for ( size_t i = 0; i < n; ++i )
+    {
+      sum += unzigzag ( x[i] );
+      x[i] = sum;
+    }
+#endif
+  }
+
+  /**
+   * in place: zigzag decode, running sum from delta (delta-of-delta -> delta), running sum from sum (TIME)
+   */
+  static void integrate2 ( uint32_t* x, size_t n, uint32_t& delta, uint32_t& sum )
+  {
+#ifdef LOG_USE_SSE2
+    __m128i d = _mm_set1_epi32 ( static_cast<int> ( delta ) );
+    __m128i run = _mm_set1_epi32 ( static_cast<int> ( sum ) );
+
+    for ( size_t i = 0; i < n; i += 4 )
+    {
+      __m128i v = unzigzag ( _mm_loadu_si128 ( reinterpret_cast<const __m128i*> ( x + i ) ) );
+
+      v = _mm_add_epi32 ( prefix ( v ), d );
+      d = _mm_shuffle_epi32 ( v, _MM_SHUFFLE ( 3, 3, 3, 3 ) );
+      v = _mm_add_epi32 ( prefix ( v ), run );
+      run = _mm_shuffle_epi32 ( v, _MM_SHUFFLE ( 3, 3, 3, 3 ) );
+      _mm_storeu_si128 ( reinterpret_cast<__m128i*> ( x + i ), v );
+    }
+
+    delta = static_cast<uint32_t> ( _mm_cvtsi128_si32 ( d ) );
+    sum = static_cast<uint32_t> ( _mm_cvtsi128_si32 ( run ) );
+#else
+    for ( size_t i = 0; i < n; ++i )
+    {
+      delta += unzigzag ( x[i] );
+      sum += delta;
+      x[i] = sum;
+    }
+#endif
+  }
+
+#ifdef LOG_USE_SSE2
+  static __m128i unzigzag ( __m128i z )
+  {
+    return _mm_xor_si128 ( _mm_srli_epi32 ( z, 1 ), _mm_sub_epi32 ( _mm_setzero_si128 (), _mm_and_si128 ( z, _mm_set1_epi32 ( 1 ) ) ) );
+  }
+
+  /**
+   * inclusive prefix sum of the 4 lanes
+   */
+  static __m128i prefix ( __m128i v )
+  {
+    v = _mm_add_epi32 ( v, _mm_slli_si128 ( v, 4 ) );
+    return _mm_add_epi32 ( v, _mm_slli_si128 ( v, 8 ) );
+  }
+#endif
+};
+
+#endif
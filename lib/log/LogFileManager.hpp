@@ -0,0 +1,291 @@
+#ifndef LOG_FILE_MANAGER_HPP
+#define LOG_FILE_MANAGER_HPP
+
+#include "LogRecord.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <climits>
+#include <cstdint>
+#include <filesystem>
+#include <list>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+using namespace std;
+
+constexpr size_t LOG_MAX_OPEN = 1024;
+constexpr size_t LOG_FD_RESERVE = 64; /* descriptors left to the rest of the process */
+
+struct LogFileStats
+{
+  uint64_t hits;     /* writes to an already open file */
+  uint64_t opens;    /* open + fstat */
+  uint64_t closes;   /* evicted or closed */
+  uint64_t writes;   /* pwritev calls */
+  uint64_t bytes;
+  uint64_t syscalls; /* open, fstat, pwritev, fdatasync, close */
+  size_t open;
+};
+
+/**
+ * LOG FILE MANAGER
+ *
+ * descriptors of the [NID]-DD.db files behind LogWriter
+ * - LRU cache of open files keyed by NID and day, bounded by the open-file budget (also clamped to
+ *   RLIMIT_NOFILE - LOG_FD_RESERVE), the least recently written file is closed first
+ * - files are opened without O_APPEND and written with pwritev at the offset taken from fstat on open
+ *   (Linux ignores the pwritev offset under O_APPEND): every buffered run of a file goes out in one call
+ * - a failed pwritev or fdatasync cuts the file back to where the write started, the retry of the requeued
+ *   batch (LogWriter) writes it again at the same offset instead of appending a second copy
+ * - not thread safe, LogWriter calls it under its flush lock
+ */
+class LogFileManager
+{
+private:
+  struct File
+  {
+    uint64_t key;
+    int fd;
+    off_t offset;
+  };
+
+  string _path;
+  size_t _budget;
+  bool _sync;
+
+  list<File> _lru; /* front is the most recently written */
+  unordered_map<uint64_t, list<File>::iterator> _files;
+  set<uint32_t> _months; /* yyyy * 12 + MM of the directories already created */
+
+  LogFileStats _stats{ 0, 0, 0, 0, 0, 0, 0 };
+
+public:
+  LogFileManager ( const string& path, size_t budget = LOG_MAX_OPEN, bool sync = false ) : _path ( path ), _budget ( limit ( budget ) ), _sync ( sync )
+  {
+  }
+
+  ~LogFileManager ()
+  {
+    closeAll ();
+  }
+
+  LogFileManager ( const LogFileManager& ) = delete;
+  LogFileManager& operator= ( const LogFileManager& ) = delete;
+
+  /**
+   * appends iov[0, count) to the file of nid and day in as few pwritev calls as IOV_MAX allows.
+   * on failure the file is cut back to where this write started, so the caller can retry the whole write
+   */
+  void write ( uint32_t nid, uint32_t day, struct iovec* iov, size_t count )
+  {
+    File& f = acquire ( nid, day );
+    const off_t start = f.offset;
+
+    while ( count > 0 )
+    {
+      const int n = static_cast<int> ( min<size_t> ( count, IOV_MAX ) );
+      ssize_t done = pwritev ( f.fd, iov, n, f.offset );
+
+      _stats.syscalls++;
+
+      if ( done < 0 )
+      {
+        if ( errno == EINTR )
+        {
+          continue;
+        }
+
+        rewind ( f, start );
+        throw runtime_error ( "RUNTIME_ERROR: log write " + LogPath::file ( _path, nid, day ) );
+      }
+
+      _stats.writes++;
+      _stats.bytes += static_cast<uint64_t> ( done );
+      f.offset += done;
+
+      /* skip what was written, a short write resumes inside the iovec */
+      while ( count > 0 && static_cast<size_t> ( done ) >= iov->iov_len )
+      {
+        done -= static_cast<ssize_t> ( iov->iov_len );
+        iov++;
+        count--;
+      }
+
+      if ( count > 0 && done > 0 )
+      {
+        iov->iov_base = static_cast<char*> ( iov->iov_base ) + done;
+        iov->iov_len -= static_cast<size_t> ( done );
+      }
+    }
+
+    if ( _sync )
+    {
+      const int rc = fdatasync ( f.fd );
+
+      _stats.syscalls++;
+
+      /* the data may not be on disk: throw so the caller requeues the batch and writes it again */
+      if ( rc != 0 )
+      {
+        rewind ( f, start );
+        throw runtime_error ( "RUNTIME_ERROR: log sync " + LogPath::file ( _path, nid, day ) );
+      }
+    }
+  }
+
+  /**
+   * closes the files of days before day (called once a day has been rolled over)
+   */
+  void closeBefore ( uint32_t day )
+  {
+    for ( auto it = _lru.begin (); it != _lru.end (); )
+    {
+      const uint64_t key = it->key;
+
+      ++it;
+
+      if ( static_cast<uint32_t> ( key >> 32 ) < day )
+      {
+        close ( key );
+      }
+    }
+  }
+
+  void closeAll ()
+  {
+    while ( !_lru.empty () )
+    {
+      close ( _lru.back ().key );
+    }
+  }
+
+  /**
+   * closes the least recently written files beyond the new budget right away
+   */
+  void setBudget ( size_t budget )
+  {
+    _budget = limit ( budget );
+
+    while ( _lru.size () > _budget )
+    {
+      close ( _lru.back ().key );
+    }
+  }
+
+  size_t budget () const
+  {
+    return _budget;
+  }
+
+  LogFileStats stats () const
+  {
+    LogFileStats r = _stats;
+
+    r.open = _lru.size ();
+    return r;
+  }
+
+private:
+  static size_t limit ( size_t budget )
+  {
+    struct rlimit rl;
+
+    if ( getrlimit ( RLIMIT_NOFILE, &rl ) == 0 && rl.rlim_cur != RLIM_INFINITY && rl.rlim_cur > LOG_FD_RESERVE )
+    {
+      budget = min<size_t> ( budget, static_cast<size_t> ( rl.rlim_cur ) - LOG_FD_RESERVE );
+    }
+
+    return max<size_t> ( budget, 1 );
+  }
+
+  File& acquire ( uint32_t nid, uint32_t day )
+  {
+    const uint64_t key = ( static_cast<uint64_t> ( day ) << 32 ) | nid;
+    auto it = _files.find ( key );
+
+    if ( it != _files.end () )
+    {
+      _lru.splice ( _lru.begin (), _lru, it->second );
+      _stats.hits++;
+      return _lru.front ();
+    }
+
+    while ( _lru.size () >= _budget )
+    {
+      close ( _lru.back ().key );
+    }
+
+    const LogDate d = LogPath::date ( day );
+
+    if ( _months.insert ( static_cast<uint32_t> ( d.yyyy * 12 + d.MM ) ).second )
+    {
+      filesystem::create_directories ( LogPath::directory ( _path, day ) );
+    }
+
+    const string file = LogPath::file ( _path, nid, day );
+    int fd = ::open ( file.c_str (), O_WRONLY | O_CREAT, 0644 );
+    struct stat st;
+
+    _stats.syscalls += 2;
+
+    if ( fd < 0 || fstat ( fd, &st ) != 0 )
+    {
+      if ( fd >= 0 )
+      {
+        ::close ( fd );
+      }
+
+      throw runtime_error ( "RUNTIME_ERROR: log open " + file );
+    }
+
+    /* a torn record at the end of a file (crash in the middle of a write) is overwritten */
+    const off_t offset = st.st_size - st.st_size % static_cast<off_t> ( sizeof ( LogRecord ) );
+
+    _lru.push_front ( { key, fd, offset } );
+    _files.emplace ( key, _lru.begin () );
+    _stats.opens++;
+
+    return _lru.front ();
+  }
+
+  /**
+   * drops a failed write from start on: the file is truncated (a reopen takes its offset from the size) and stays
+   * open at start, so even if the truncate fails the retry overwrites the partial write instead of appending
+   */
+  void rewind ( File& f, off_t start )
+  {
+    f.offset = start;
+    _stats.syscalls++;
+
+    if ( ftruncate ( f.fd, start ) != 0 )
+    {
+      return; /* the open file's offset is still right */
+    }
+  }
+
+  void close ( uint64_t key )
+  {
+    auto it = _files.find ( key );
+
+    if ( it == _files.end () )
+    {
+      return;
+    }
+
+    ::close ( it->second->fd );
+    _lru.erase ( it->second );
+    _files.erase ( it );
+    _stats.closes++;
+    _stats.syscalls++;
+  }
+};
+
+#endif
@@ -0,0 +1,278 @@
+#ifndef LOG_RECORD_HPP
+#define LOG_RECORD_HPP
+
+#include "../types/AdvancedType.hpp"
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+using namespace std;
+
+constexpr uint32_t LOG_NID_MAX = 0xFFFFFF;
+constexpr uint64_t LOG_DAY_MS = 86400000ULL;
+constexpr uint32_t LOG_TIME_MS = 10;     /* TIME unit: 1/100 s since 00:00 UTC, 0 - 8,639,999 */
+constexpr size_t LOG_CHANGE_PAGE = 4096; /* NIDs per LogChangeDetector page (32 KB) */
+
+/**
+ * LOG RECORD
+ *
+ * one change of a NID: [VALUE int32][STATUS uint8][TIME uint24], 8 bytes, little-endian, no padding.
+ * the NID and the day are in the file name (data/YYYY/MM/[NID]-DD.db), a file is an array of records in
+ * append order
+ */
+struct LogRecord
+{
+  int32_t value;
+  uint8_t status;
+  uint24_t time;
+
+  LogRecord () : value ( 0 ), status ( 0 )
+  {
+  }
+
+  LogRecord ( int32_t v, uint8_t s, uint64_t ms ) : value ( v ), status ( s ), time ( timeOf ( ms ) )
+  {
+  }
+
+  /**
+   * epoch ms -> TIME of its day
+   */
+  static uint32_t timeOf ( uint64_t ms )
+  {
+    return static_cast<uint32_t> ( ( ms % LOG_DAY_MS ) / LOG_TIME_MS );
+  }
+
+  /**
+   * epoch ms -> days since 1970-01-01 (UTC)
+   */
+  static uint32_t dayOf ( uint64_t ms )
+  {
+    return static_cast<uint32_t> ( ms / LOG_DAY_MS );
+  }
+};
+
+static_assert ( sizeof ( LogRecord ) == 8, "LogRecord must stay 8 bytes" );
+
+struct LogDate
+{
+  int yyyy;
+  int MM;
+  int dd;
+};
+
+/**
+ * LOG PATH
+ *
+ * file naming: [root]/YYYY/MM/[NID]-DD.db (or DD.seg once the day is packed, DD.arc on the cold tier), dates are UTC
+ */
+class LogPath
+{
+public:
+  /**
+   * days since epoch -> civil date (H. Hinnant's days_from_civil inverse), no gmtime so it is thread safe
+   */
+  static LogDate date ( uint32_t day )
+  {
+    const int64_t z = static_cast<int64_t> ( day ) + 719468;
+    const int64_t era = z / 146097;
+    const uint32_t doe = static_cast<uint32_t> ( z - era * 146097 );
+    const uint32_t yoe = ( doe - doe / 1460 + doe / 36524 - doe / 146096 ) / 365;
+    const uint32_t doy = doe - ( 365 * yoe + yoe / 4 - yoe / 100 );
+    const uint32_t mp = ( 5 * doy + 2 ) / 153;
+    const uint32_t d = doy - ( 153 * mp + 2 ) / 5 + 1;
+    const uint32_t m = mp < 10 ? mp + 3 : mp - 9;
+
+    return { static_cast<int> ( yoe + era * 400 + ( m <= 2 ? 1 : 0 ) ), static_cast<int> ( m ), static_cast<int> ( d ) };
+  }
+
+  /**
+   * civil date -> days since epoch (H. Hinnant's days_from_civil)
+   */
+  static uint32_t day ( int yyyy, int MM, int dd )
+  {
+    const int64_t y = yyyy - ( MM <= 2 ? 1 : 0 );
+    const int64_t era = ( y >= 0 ? y : y - 399 ) / 400;
+    const uint32_t yoe = static_cast<uint32_t> ( y - era * 400 );
+    const uint32_t doy = ( 153 * static_cast<uint32_t> ( MM > 2 ? MM - 3 : MM + 9 ) + 2 ) / 5 + static_cast<uint32_t> ( dd ) - 1;
+    const uint32_t doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+
+    return static_cast<uint32_t> ( era * 146097 + static_cast<int64_t> ( doe ) - 719468 );
+  }
+
+  /**
+   * [root]/YYYY/MM
+   */
+  static string directory ( const string& root, uint32_t day )
+  {
+    const LogDate d = date ( day );
+    char buf[32];
+
+    snprintf ( buf, sizeof ( buf ), "/%04d/%02d", d.yyyy, d.MM );
+    return root + buf;
+  }
+
+  /**
+   * [root]/YYYY/MM/[NID]-DD.db
+   */
+  static string file ( const string& root, uint32_t nid, uint32_t day )
+  {
+    const LogDate d = date ( day );
+    char buf[48];
+
+    snprintf ( buf, sizeof ( buf ), "/%04d/%02d/%u-%02d.db", d.yyyy, d.MM, nid, d.dd );
+    return root + buf;
+  }
+
+  /**
+   * [root]/YYYY/MM/DD.seg, every NID of the day (LogSegment.hpp)
+   */
+  static string segment ( const string& root, uint32_t day )
+  {
+    const LogDate d = date ( day );
+    char buf[32];
+
+    snprintf ( buf, sizeof ( buf ), "/%04d/%02d/%02d.seg", d.yyyy, d.MM, d.dd );
+    return root + buf;
+  }
+
+  /**
+   * [root]/YYYY/MM/DD.arc, compressed frames of a day on the cold tier (LogArchive.hpp)
+   */
+  static string archive ( const string& root, uint32_t day )
+  {
+    const LogDate d = date ( day );
+    char buf[32];
+
+    snprintf ( buf, sizeof ( buf ), "/%04d/%02d/%02d.arc", d.yyyy, d.MM, d.dd );
+    return root + buf;
+  }
+};
+
+/**
+ * LOG CHANGE DETECTOR
+ *
+ * last VALUE/STATUS per NID in one atomic<uint64_t> = VALUE(32) | STATUS(8) << 32 | VALID << 40 (same packing as
+ * NidTable, whose update () gives the same answer when the memory DB is already at hand).
+ * the states are split in pages of LOG_CHANGE_PAGE NIDs allocated on the first change of one of them, so the
+ * default capacity (every NID) costs only the page pointers until NIDs show up
+ */
+class LogChangeDetector
+{
+private:
+  static constexpr uint64_t VALID = 1ULL << 40;
+
+  struct Page
+  {
+    atomic<uint64_t> state[LOG_CHANGE_PAGE];
+  };
+
+  unique_ptr<atomic<Page*>[]> _pages;
+  size_t _capacity;
+
+public:
+  explicit LogChangeDetector ( size_t capacity = LOG_NID_MAX + 1 ) : _pages ( make_unique<atomic<Page*>[]> ( ( capacity + LOG_CHANGE_PAGE - 1 ) / LOG_CHANGE_PAGE ) ), _capacity ( capacity )
+  {
+    for ( size_t n = 0; n < pageCount (); ++n )
+    {
+      _pages[n].store ( nullptr, memory_order_relaxed );
+    }
+  }
+
+  ~LogChangeDetector ()
+  {
+    for ( size_t n = 0; n < pageCount (); ++n )
+    {
+      delete _pages[n].load ( memory_order_relaxed );
+    }
+  }
+
+  LogChangeDetector ( const LogChangeDetector& ) = delete;
+  LogChangeDetector& operator= ( const LogChangeDetector& ) = delete;
+
+  /**
+   * true when VALUE or STATUS differs from the last call for nid (or it is the first one)
+   */
+  bool changed ( uint32_t nid, int32_t value, uint8_t status )
+  {
+    if ( nid >= _capacity )
+    {
+      throw out_of_range ( "RUNTIME_ERROR: NID out of range" );
+    }
+
+    const uint64_t next = static_cast<uint64_t> ( static_cast<uint32_t> ( value ) ) | ( static_cast<uint64_t> ( status ) << 32 ) | VALID;
+    atomic<uint64_t>& state = page ( nid ).state[nid % LOG_CHANGE_PAGE];
+
+    if ( state.load ( memory_order_relaxed ) == next )
+    {
+      return false;
+    }
+
+    return state.exchange ( next, memory_order_acq_rel ) != next;
+  }
+
+  void reset ( uint32_t nid )
+  {
+    Page* p = nid < _capacity ? _pages[nid / LOG_CHANGE_PAGE].load ( memory_order_acquire ) : nullptr;
+
+    if ( p )
+    {
+      p->state[nid % LOG_CHANGE_PAGE].store ( 0, memory_order_release );
+    }
+  }
+
+  size_t capacity () const
+  {
+    return _capacity;
+  }
+
+  /**
+   * bytes held by the allocated pages and the page pointers
+   */
+  size_t memory () const
+  {
+    size_t pages = 0;
+
+    for ( size_t n = 0; n < pageCount (); ++n )
+    {
+      pages += _pages[n].load ( memory_order_relaxed ) != nullptr;
+    }
+
+    return pages * sizeof ( Page ) + pageCount () * sizeof ( atomic<Page*> );
+  }
+
+private:
+  size_t pageCount () const
+  {
+    return ( _capacity + LOG_CHANGE_PAGE - 1 ) / LOG_CHANGE_PAGE;
+  }
+
+  /**
+   * the page of nid, allocated (zeroed) by the first writer, a writer losing the race frees its copy
+   */
+  Page& page ( uint32_t nid )
+  {
+    atomic<Page*>& slot = _pages[nid / LOG_CHANGE_PAGE];
+    Page* p = slot.load ( memory_order_acquire );
+
+    if ( !p )
+    {
+      Page* fresh = new Page ();
+
+      if ( slot.compare_exchange_strong ( p, fresh, memory_order_acq_rel, memory_order_acquire ) )
+      {
+        p = fresh;
+      }
+      else
+      {
+        delete fresh;
+      }
+    }
+
+    return *p;
+  }
+};
+
+#endif
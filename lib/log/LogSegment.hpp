@@ -0,0 +1,875 @@
+#ifndef LOG_SEGMENT_HPP
+#define LOG_SEGMENT_HPP
+
+#include "LogCodec.hpp"
+#include "LogRecord.hpp"
+#include <zlib.h>
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace std;
+
+/**
+ * LOG SEGMENT
+ *
+ * every NID of one day in a single file, [root]/YYYY/MM/DD.seg, little-endian
+ *
+ * [data]    the records of each NID back to back, NIDs ascending (RAW), or one LogCodec block per NID (PACKED)
+ * [index]   extent(24) per NID: nid(4) count(4) offset(8) first TIME(4) last TIME(4), NIDs ascending
+ * [footer]  index offset(8) entries(4) day(4) crc32 of the index(4) version(2) encoding(2) magic(8)
+ *
+ * a segment is written once, when a day is closed (LogConvert::toSegment), and read through mmap:
+ * a lookup is a binary search of the index and the records are used in place (RAW) or decoded (PACKED).
+ * a PACKED block ends where the next extent (or the index) starts, the data is padded to 8 bytes
+ */
+constexpr char LOG_SEGMENT_MAGIC[8] = { 'R', 'I', 'K', 'L', 'S', 'E', 'G', '\0' };
+constexpr uint16_t LOG_SEGMENT_VERSION = 1;
+constexpr size_t LOG_SEGMENT_FOOTER_SIZE = 32;
+constexpr size_t LOG_SEGMENT_BUFFER_SIZE = 1 << 20;
+
+struct LogExtent
+{
+  uint32_t nid;
+  uint32_t count;
+  uint64_t offset;
+  uint32_t first; /* smallest TIME */
+  uint32_t last;  /* largest TIME */
+};
+
+static_assert ( sizeof ( LogExtent ) == 24, "LogExtent must stay 24 bytes" );
+
+/**
+ * LOG SEGMENT WRITER
+ *
+ * streams a segment to DD.seg.tmp and renames it on close (), so a segment is either complete or absent
+ * (with sync, the data and the rename are on disk when close () returns).
+ * NIDs are added in ascending order, repeated add () calls for the same NID extend its extent
+ * (PACKED holds the records of the current NID until the next NID or close ())
+ */
+class LogSegmentWriter
+{
+private:
+  string _file;
+  string _tmp;
+  int _fd = -1;
+  uint32_t _day;
+  uint64_t _offset = 0;
+  string _buf;
+  vector<LogExtent> _extents;
+  bool _sync;
+  LogEncoding _encoding;
+  vector<LogRecord> _current; /* PACKED: records of _extents.back () not encoded yet */
+  string _block;
+
+public:
+  LogSegmentWriter ( const string& root, uint32_t day, bool sync = false, LogEncoding encoding = LogEncoding::RAW )
+      : _file ( LogPath::segment ( root, day ) ), _tmp ( _file + ".tmp" ), _day ( day ), _sync ( sync ), _encoding ( encoding )
+  {
+    filesystem::create_directories ( LogPath::directory ( root, day ) );
+
+    _fd = ::open ( _tmp.c_str (), O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+
+    if ( _fd < 0 )
+    {
+      throw runtime_error ( "RUNTIME_ERROR: segment open " + _tmp );
+    }
+
+    _buf.reserve ( LOG_SEGMENT_BUFFER_SIZE );
+  }
+
+  /**
+   * an unclosed segment is discarded
+   */
+  ~LogSegmentWriter ()
+  {
+    if ( _fd >= 0 )
+    {
+      ::close ( _fd );
+      ::unlink ( _tmp.c_str () );
+    }
+  }
+
+  LogSegmentWriter ( const LogSegmentWriter& ) = delete;
+  LogSegmentWriter& operator= ( const LogSegmentWriter& ) = delete;
+
+  void add ( uint32_t nid, const LogRecord* records, size_t count )
+  {
+    if ( count == 0 )
+    {
+      return;
+    }
+
+    if ( !_extents.empty () && nid < _extents.back ().nid )
+    {
+      throw runtime_error ( "RUNTIME_ERROR: segment NIDs must be added in ascending order" );
+    }
+
+    uint32_t first = UINT32_MAX;
+    uint32_t last = 0;
+
+    for ( size_t i = 0; i < count; ++i )
+    {
+      const uint32_t t = records[i].time.to_uint32 ();
+
+      first = min ( first, t );
+      last = max ( last, t );
+    }
+
+    if ( !_extents.empty () && _extents.back ().nid == nid )
+    {
+      LogExtent& e = _extents.back ();
+
+      e.count += static_cast<uint32_t> ( count );
+      e.first = min ( e.first, first );
+      e.last = max ( e.last, last );
+    }
+    else
+    {
+      seal ();
+      _extents.push_back ( { nid, static_cast<uint32_t> ( count ), _offset, first, last } );
+    }
+
+    if ( _encoding == LogEncoding::PACKED )
+    {
+      _current.insert ( _current.end (), records, records + count );
+      return;
+    }
+
+    put ( records, count * sizeof ( LogRecord ) );
+    _offset += count * sizeof ( LogRecord );
+  }
+
+  /**
+   * writes the index and the footer and publishes the segment
+   */
+  void close ()
+  {
+    if ( _fd < 0 )
+    {
+      return;
+    }
+
+    static const char zero[sizeof ( LogRecord )] = { 0 };
+    const uint16_t encoding = static_cast<uint16_t> ( _encoding );
+
+    seal ();
+    put ( zero, ( sizeof ( LogRecord ) - _offset % sizeof ( LogRecord ) ) % sizeof ( LogRecord ) );
+    _offset += ( sizeof ( LogRecord ) - _offset % sizeof ( LogRecord ) ) % sizeof ( LogRecord );
+
+    const uint64_t index = _offset;
+    const uint32_t entries = static_cast<uint32_t> ( _extents.size () );
+    const uint32_t crc = static_cast<uint32_t> (
+        crc32 ( 0, reinterpret_cast<const Bytef*> ( _extents.data () ), static_cast<uInt> ( _extents.size () * sizeof ( LogExtent ) ) ) );
+
+    put ( _extents.data (), _extents.size () * sizeof ( LogExtent ) );
+    put ( &index, sizeof ( index ) );
+    put ( &entries, sizeof ( entries ) );
+    put ( &_day, sizeof ( _day ) );
+    put ( &crc, sizeof ( crc ) );
+    put ( &LOG_SEGMENT_VERSION, sizeof ( LOG_SEGMENT_VERSION ) );
+    put ( &encoding, sizeof ( encoding ) );
+    put ( LOG_SEGMENT_MAGIC, sizeof ( LOG_SEGMENT_MAGIC ) );
+    drain ();
+
+    /* the destructor discards the temporary file */
+    if ( _sync && fdatasync ( _fd ) != 0 )
+    {
+      throw runtime_error ( "RUNTIME_ERROR: segment sync " + _tmp );
+    }
+
+    ::close ( _fd );
+    _fd = -1;
+
+    if ( ::rename ( _tmp.c_str (), _file.c_str () ) != 0 )
+    {
+      ::unlink ( _tmp.c_str () );
+      throw runtime_error ( "RUNTIME_ERROR: segment rename " + _file );
+    }
+
+    if ( _sync )
+    {
+      syncDirectory ( filesystem::path ( _file ).parent_path ().string () );
+    }
+  }
+
+  /**
+   * fsync of dir, makes a rename into it durable
+   */
+  static void syncDirectory ( const string& dir )
+  {
+    int fd = ::open ( dir.c_str (), O_RDONLY | O_DIRECTORY );
+
+    if ( fd < 0 || fsync ( fd ) != 0 )
+    {
+      if ( fd >= 0 )
+      {
+        ::close ( fd );
+      }
+
+      throw runtime_error ( "RUNTIME_ERROR: segment sync " + dir );
+    }
+
+    ::close ( fd );
+  }
+
+  size_t size () const
+  {
+    return _extents.size ();
+  }
+
+  const string& file () const
+  {
+    return _file;
+  }
+
+private:
+  /**
+   * PACKED: encodes the held records of the last extent
+   */
+  void seal ()
+  {
+    if ( _current.empty () )
+    {
+      return;
+    }
+
+    LogCodec::encode ( _current.data (), _current.size (), _block );
+    put ( _block.data (), _block.size () );
+    _offset += _block.size ();
+    _current.clear ();
+  }
+
+  void put ( const void* p, size_t n )
+  {
+    if ( _buf.size () + n > LOG_SEGMENT_BUFFER_SIZE )
+    {
+      drain ();
+    }
+
+    if ( n >= LOG_SEGMENT_BUFFER_SIZE )
+    {
+      write ( static_cast<const char*> ( p ), n );
+      return;
+    }
+
+    _buf.append ( static_cast<const char*> ( p ), n );
+  }
+
+  void drain ()
+  {
+    write ( _buf.data (), _buf.size () );
+    _buf.clear ();
+  }
+
+  void write ( const char* p, size_t remain )
+  {
+    while ( remain > 0 )
+    {
+      ssize_t n = ::write ( _fd, p, remain );
+
+      if ( n < 0 )
+      {
+        if ( errno == EINTR )
+        {
+          continue;
+        }
+
+        throw runtime_error ( "RUNTIME_ERROR: segment write " + _tmp );
+      }
+
+      p += n;
+      remain -= static_cast<size_t> ( n );
+    }
+  }
+};
+
+/**
+ * LOG SEGMENT READER
+ *
+ * mmap of a closed segment, the footer and the index crc are checked on open
+ */
+class LogSegmentReader
+{
+private:
+  void* _map = MAP_FAILED;
+  size_t _size = 0;
+  const char* _data = nullptr;
+  const LogExtent* _index = nullptr; /* the data is a multiple of 8 bytes, so the index is 8 byte aligned */
+  uint32_t _entries = 0;
+  uint32_t _day = 0;
+  LogEncoding _encoding = LogEncoding::RAW;
+
+public:
+  explicit LogSegmentReader ( const string& file )
+  {
+    int fd = ::open ( file.c_str (), O_RDONLY );
+
+    if ( fd < 0 )
+    {
+      throw runtime_error ( "RUNTIME_ERROR: segment open " + file );
+    }
+
+    struct stat st;
+
+    if ( fstat ( fd, &st ) != 0 || static_cast<size_t> ( st.st_size ) < LOG_SEGMENT_FOOTER_SIZE )
+    {
+      ::close ( fd );
+      throw runtime_error ( "RUNTIME_ERROR: segment stat " + file );
+    }
+
+    _size = static_cast<size_t> ( st.st_size );
+    _map = mmap ( nullptr, _size, PROT_READ, MAP_SHARED, fd, 0 );
+    ::close ( fd );
+
+    if ( _map == MAP_FAILED )
+    {
+      throw runtime_error ( "RUNTIME_ERROR: segment mmap " + file );
+    }
+
+    _data = static_cast<const char*> ( _map );
+
+    const char* footer = _data + _size - LOG_SEGMENT_FOOTER_SIZE;
+    const uint64_t index = get<uint64_t> ( footer );
+
+    _entries = get<uint32_t> ( footer + 8 );
+    _day = get<uint32_t> ( footer + 12 );
+    _encoding = static_cast<LogEncoding> ( get<uint16_t> ( footer + 22 ) );
+
+    if ( memcmp ( footer + 24, LOG_SEGMENT_MAGIC, sizeof ( LOG_SEGMENT_MAGIC ) ) != 0 || get<uint16_t> ( footer + 20 ) != LOG_SEGMENT_VERSION ||
+         ( _encoding != LogEncoding::RAW && _encoding != LogEncoding::PACKED ) || index % sizeof ( LogRecord ) != 0 ||
+         index + static_cast<uint64_t> ( _entries ) * sizeof ( LogExtent ) + LOG_SEGMENT_FOOTER_SIZE != _size )
+    {
+      release ();
+      throw runtime_error ( "RUNTIME_ERROR: segment footer " + file );
+    }
+
+    if ( static_cast<uint32_t> ( crc32 ( 0, reinterpret_cast<const Bytef*> ( _data + index ), static_cast<uInt> ( _entries * sizeof ( LogExtent ) ) ) ) != get<uint32_t> ( footer + 16 ) )
+    {
+      release ();
+      throw runtime_error ( "RUNTIME_ERROR: segment index crc " + file );
+    }
+
+    _index = reinterpret_cast<const LogExtent*> ( _data + index );
+    madvise ( _map, _size, MADV_RANDOM );
+  }
+
+  ~LogSegmentReader ()
+  {
+    release ();
+  }
+
+  LogSegmentReader ( const LogSegmentReader& ) = delete;
+  LogSegmentReader& operator= ( const LogSegmentReader& ) = delete;
+
+  /**
+   * the records of nid in place, nullptr when the NID has none this day. RAW segments only
+   */
+  const LogRecord* view ( uint32_t nid, size_t& count ) const
+  {
+    if ( _encoding != LogEncoding::RAW )
+    {
+      throw runtime_error ( "RUNTIME_ERROR: segment view: packed segments are read with read ()" );
+    }
+
+    const LogExtent* e = find ( nid );
+
+    if ( !e )
+    {
+      count = 0;
+      return nullptr;
+    }
+
+    count = e->count;
+    return reinterpret_cast<const LogRecord*> ( _data + e->offset );
+  }
+
+  /**
+   * appends the records of nid with from <= TIME <= to, returns how many
+   */
+  size_t read ( uint32_t nid, vector<LogRecord>& out, uint32_t from = 0, uint32_t to = UINT32_MAX ) const
+  {
+    const LogExtent* e = find ( nid );
+
+    if ( !e || e->last < from || e->first > to )
+    {
+      return 0;
+    }
+
+    const size_t before = out.size ();
+
+    if ( _encoding == LogEncoding::PACKED )
+    {
+      LogCodec::decode ( _data + e->offset, length ( e ), out );
+
+      if ( from > e->first || e->last > to )
+      {
+        out.erase ( remove_if ( out.begin () + static_cast<ptrdiff_t> ( before ), out.end (),
+                                [&] ( const LogRecord& r ) { return r.time.to_uint32 () < from || r.time.to_uint32 () > to; } ),
+                    out.end () );
+      }
+
+      return out.size () - before;
+    }
+
+    const LogRecord* r = reinterpret_cast<const LogRecord*> ( _data + e->offset );
+
+    if ( from <= e->first && e->last <= to )
+    {
+      out.insert ( out.end (), r, r + e->count );
+    }
+    else
+    {
+      for ( uint32_t i = 0; i < e->count; ++i )
+      {
+        const uint32_t t = r[i].time.to_uint32 ();
+
+        if ( from <= t && t <= to )
+        {
+          out.push_back ( r[i] );
+        }
+      }
+    }
+
+    return out.size () - before;
+  }
+
+  /**
+   * fn ( uint32_t nid, const LogRecord* records, size_t count ) for every NID, ascending.
+   * records of a PACKED segment are decoded into a buffer that is reused for the next NID
+   */
+  template <typename F> void forEach ( F&& fn ) const
+  {
+    vector<LogRecord> records;
+
+    /* a scan reads the data front to back, point lookups go back to random access afterwards */
+    madvise ( _map, _size, MADV_SEQUENTIAL );
+
+    for ( uint32_t i = 0; i < _entries; ++i )
+    {
+      if ( _encoding == LogEncoding::PACKED )
+      {
+        records.clear ();
+        LogCodec::decode ( _data + _index[i].offset, length ( _index + i ), records );
+        fn ( _index[i].nid, records.data (), records.size () );
+        continue;
+      }
+
+      fn ( _index[i].nid, reinterpret_cast<const LogRecord*> ( _data + _index[i].offset ), static_cast<size_t> ( _index[i].count ) );
+    }
+
+    madvise ( _map, _size, MADV_RANDOM );
+  }
+
+  bool has ( uint32_t nid ) const
+  {
+    return find ( nid ) != nullptr;
+  }
+
+  /**
+   * the NIDs of the day, ascending
+   */
+  vector<uint32_t> nids () const
+  {
+    vector<uint32_t> out ( _entries );
+
+    for ( uint32_t i = 0; i < _entries; ++i )
+    {
+      out[i] = _index[i].nid;
+    }
+
+    return out;
+  }
+
+  size_t size () const
+  {
+    return _entries;
+  }
+
+  uint32_t day () const
+  {
+    return _day;
+  }
+
+  LogEncoding encoding () const
+  {
+    return _encoding;
+  }
+
+  static bool isSegment ( const string& file )
+  {
+    int fd = ::open ( file.c_str (), O_RDONLY );
+
+    if ( fd < 0 )
+    {
+      return false;
+    }
+
+    struct stat st;
+    char magic[sizeof ( LOG_SEGMENT_MAGIC )] = { 0 };
+    bool ok = fstat ( fd, &st ) == 0 && static_cast<size_t> ( st.st_size ) >= LOG_SEGMENT_FOOTER_SIZE &&
+              pread ( fd, magic, sizeof ( magic ), st.st_size - static_cast<off_t> ( sizeof ( magic ) ) ) == static_cast<ssize_t> ( sizeof ( magic ) );
+
+    ::close ( fd );
+    return ok && memcmp ( magic, LOG_SEGMENT_MAGIC, sizeof ( magic ) ) == 0;
+  }
+
+private:
+  template <typename T> static T get ( const char* p )
+  {
+    T v;
+    memcpy ( &v, p, sizeof ( T ) );
+    return v;
+  }
+
+  const LogExtent* find ( uint32_t nid ) const
+  {
+    const LogExtent* end = _index + _entries;
+    const LogExtent* e = lower_bound ( _index, end, nid, [] ( const LogExtent& x, uint32_t n ) { return x.nid < n; } );
+
+    return e != end && e->nid == nid ? e : nullptr;
+  }
+
+  /**
+   * bytes of a PACKED block: up to the next extent or the index
+   */
+  size_t length ( const LogExtent* e ) const
+  {
+    const char* end = e + 1 < _index + _entries ? _data + e[1].offset : reinterpret_cast<const char*> ( _index );
+
+    return static_cast<size_t> ( end - ( _data + e->offset ) );
+  }
+
+  void release ()
+  {
+    if ( _map != MAP_FAILED )
+    {
+      munmap ( _map, _size );
+      _map = MAP_FAILED;
+    }
+
+    _data = nullptr;
+    _index = nullptr;
+    _size = 0;
+  }
+};
+
+/**
+ * LOG CONVERT
+ *
+ * between the per-NID layout ([NID]-DD.db, written by LogWriter) and the daily segment (DD.seg) of one day
+ */
+class LogConvert
+{
+public:
+  /**
+   * packs every [NID]-DD.db of the day into DD.seg, returns the NID count. an existing DD.seg is merged, its records
+   * first, and the records a file shares with it (a file kept by an earlier run) are not packed twice.
+   * remove syncs the segment and its directory, then deletes the files that did not grow after they were read
+   */
+  static size_t toSegment ( const string& root, uint32_t day, bool remove = false, bool sync = false, LogEncoding encoding = LogEncoding::RAW )
+  {
+    const string file = LogPath::segment ( root, day );
+    const vector<pair<uint32_t, string>> files = dayFiles ( root, day );
+    unique_ptr<LogSegmentReader> existing;
+    vector<uint32_t> nids;
+    vector<size_t> packed ( files.size (), 0 ); /* records read from each file */
+
+    if ( filesystem::exists ( file ) )
+    {
+      existing = make_unique<LogSegmentReader> ( file );
+      nids = existing->nids ();
+    }
+
+    for ( const auto& f : files )
+    {
+      nids.push_back ( f.first );
+    }
+
+    sort ( nids.begin (), nids.end () );
+    nids.erase ( unique ( nids.begin (), nids.end () ), nids.end () );
+
+    {
+      LogSegmentWriter segment ( root, day, sync || remove, encoding );
+      vector<LogRecord> records;
+      vector<LogRecord> fresh;
+      size_t next = 0;
+
+      for ( uint32_t nid : nids )
+      {
+        records.clear ();
+
+        if ( existing )
+        {
+          existing->read ( nid, records );
+        }
+
+        if ( next < files.size () && files[next].first == nid )
+        {
+          readFile ( files[next].second, fresh );
+          records.insert ( records.end (), fresh.begin () + static_cast<ptrdiff_t> ( overlap ( records.data (), records.size (), fresh.data (), fresh.size () ) ), fresh.end () );
+          packed[next++] = fresh.size ();
+        }
+
+        segment.add ( nid, records.data (), records.size () );
+      }
+
+      existing.reset ();
+      segment.close ();
+    }
+
+    if ( remove )
+    {
+      for ( size_t i = 0; i < files.size (); ++i )
+      {
+        error_code ec;
+        const uintmax_t size = filesystem::file_size ( files[i].second, ec );
+
+        if ( !ec && size / sizeof ( LogRecord ) <= packed[i] )
+        {
+          filesystem::remove ( files[i].second );
+        }
+      }
+    }
+
+    return nids.size ();
+  }
+
+  /**
+   * unpacks DD.seg into [NID]-DD.db files, returns the NID count. records a file holds beyond the segment's are kept
+   * after them. remove syncs the files and their directory, then deletes the segment
+   */
+  static size_t toFiles ( const string& root, uint32_t day, bool remove = false )
+  {
+    const string file = LogPath::segment ( root, day );
+    size_t count = 0;
+
+    {
+      LogSegmentReader segment ( file );
+      vector<LogRecord> records;
+      vector<LogRecord> fresh;
+
+      segment.forEach (
+          [&] ( uint32_t nid, const LogRecord* r, size_t n )
+          {
+            const string path = LogPath::file ( root, nid, day );
+
+            readFile ( path, fresh );
+            records.assign ( r, r + n );
+            records.insert ( records.end (), fresh.begin () + static_cast<ptrdiff_t> ( overlap ( r, n, fresh.data (), fresh.size () ) ), fresh.end () );
+            writeFile ( path, records.data (), records.size (), remove );
+            count++;
+          } );
+    }
+
+    if ( remove )
+    {
+      LogSegmentWriter::syncDirectory ( LogPath::directory ( root, day ) );
+      filesystem::remove ( file );
+    }
+
+    return count;
+  }
+
+  /**
+   * how many records at the start of fresh are already the last records of stored: a source that was packed,
+   * then kept (it grew, remove was off, or a crash came before the delete) and read again.
+   * a record is a sample (TIME, VALUE, STATUS), an equal one in the same place is the same sample
+   */
+  static size_t overlap ( const LogRecord* stored, size_t n, const LogRecord* fresh, size_t m )
+  {
+    if ( n == 0 || m == 0 )
+    {
+      return 0;
+    }
+
+    /* longest first: the earliest start in stored whose tail is a prefix of fresh */
+    for ( size_t j = n - min ( n, m ); j < n; ++j )
+    {
+      if ( memcmp ( &stored[j], fresh, ( n - j ) * sizeof ( LogRecord ) ) == 0 )
+      {
+        return n - j;
+      }
+    }
+
+    return 0;
+  }
+
+  /**
+   * records of a NID in the per-NID layout, with from <= TIME <= to
+   */
+  static size_t read ( const string& root, uint32_t nid, uint32_t day, vector<LogRecord>& out, uint32_t from = 0, uint32_t to = UINT32_MAX )
+  {
+    vector<LogRecord> records;
+    const size_t before = out.size ();
+
+    readFile ( LogPath::file ( root, nid, day ), records );
+
+    for ( const auto& r : records )
+    {
+      const uint32_t t = r.time.to_uint32 ();
+
+      if ( from <= t && t <= to )
+      {
+        out.push_back ( r );
+      }
+    }
+
+    return out.size () - before;
+  }
+
+  /**
+   * whole records only, a torn tail is ignored. a missing file reads as empty
+   */
+  static void readFile ( const string& file, vector<LogRecord>& out )
+  {
+    out.clear ();
+
+    int fd = ::open ( file.c_str (), O_RDONLY );
+
+    if ( fd < 0 )
+    {
+      return;
+    }
+
+    struct stat st;
+
+    if ( fstat ( fd, &st ) == 0 )
+    {
+      out.resize ( static_cast<size_t> ( st.st_size ) / sizeof ( LogRecord ) );
+
+      char* p = reinterpret_cast<char*> ( out.data () );
+      size_t remain = out.size () * sizeof ( LogRecord );
+
+      while ( remain > 0 )
+      {
+        ssize_t n = ::read ( fd, p, remain );
+
+        if ( n < 0 && errno == EINTR )
+        {
+          continue;
+        }
+
+        if ( n <= 0 )
+        {
+          break;
+        }
+
+        p += n;
+        remain -= static_cast<size_t> ( n );
+      }
+
+      out.resize ( out.size () - ( remain + sizeof ( LogRecord ) - 1 ) / sizeof ( LogRecord ) );
+    }
+
+    ::close ( fd );
+  }
+
+  /**
+   * (nid, path) of the day's [NID]-DD.db files, NIDs ascending
+   */
+  static vector<pair<uint32_t, string>> dayFiles ( const string& root, uint32_t day )
+  {
+    vector<pair<uint32_t, string>> files;
+    const string dir = LogPath::directory ( root, day );
+    char suffix[16];
+
+    snprintf ( suffix, sizeof ( suffix ), "-%02d.db", LogPath::date ( day ).dd );
+
+    const size_t len = strlen ( suffix );
+
+    if ( !filesystem::is_directory ( dir ) )
+    {
+      return files;
+    }
+
+    for ( const auto& entry : filesystem::directory_iterator ( dir ) )
+    {
+      const string name = entry.path ().filename ().string ();
+
+      if ( !entry.is_regular_file () || name.size () <= len || name.compare ( name.size () - len, len, suffix ) != 0 )
+      {
+        continue;
+      }
+
+      char* end = nullptr;
+      const unsigned long nid = strtoul ( name.c_str (), &end, 10 );
+
+      if ( end == name.c_str () + name.size () - len && nid <= LOG_NID_MAX )
+      {
+        files.emplace_back ( static_cast<uint32_t> ( nid ), entry.path ().string () );
+      }
+    }
+
+    sort ( files.begin (), files.end () );
+    return files;
+  }
+
+private:
+  /**
+   * replaces file through file.tmp and a rename, so a crash leaves the old or the new records. sync puts the data on
+   * disk before the rename
+   */
+  static void writeFile ( const string& file, const LogRecord* records, size_t count, bool sync )
+  {
+    const string tmp = file + ".tmp";
+    int fd = ::open ( tmp.c_str (), O_WRONLY | O_CREAT | O_TRUNC, 0644 );
+
+    if ( fd < 0 )
+    {
+      throw runtime_error ( "RUNTIME_ERROR: log open " + tmp );
+    }
+
+    const char* p = reinterpret_cast<const char*> ( records );
+    size_t remain = count * sizeof ( LogRecord );
+
+    while ( remain > 0 )
+    {
+      ssize_t n = ::write ( fd, p, remain );
+
+      if ( n < 0 )
+      {
+        if ( errno == EINTR )
+        {
+          continue;
+        }
+
+        ::close ( fd );
+        ::unlink ( tmp.c_str () );
+        throw runtime_error ( "RUNTIME_ERROR: log write " + tmp );
+      }
+
+      p += n;
+      remain -= static_cast<size_t> ( n );
+    }
+
+    if ( sync && fdatasync ( fd ) != 0 )
+    {
+      ::close ( fd );
+      ::unlink ( tmp.c_str () );
+      throw runtime_error ( "RUNTIME_ERROR: log sync " + tmp );
+    }
+
+    ::close ( fd );
+
+    if ( ::rename ( tmp.c_str (), file.c_str () ) != 0 )
+    {
+      ::unlink ( tmp.c_str () );
+      throw runtime_error ( "RUNTIME_ERROR: log rename " + file );
+    }
+  }
+};
+
+#endif
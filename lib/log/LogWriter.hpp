@@ -0,0 +1,356 @@
+#ifndef LOG_WRITER_HPP
+#define LOG_WRITER_HPP
+
+#include "LogFileManager.hpp"
+#include "LogRecord.hpp"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <iterator>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+#include <sys/uio.h>
+
+using namespace std;
+
+constexpr size_t LOG_BATCH_RECORDS = 512;         /* 4 KB per file write */
+constexpr size_t LOG_BUFFER_BUDGET = 64ULL << 20; /* buffered bytes before a flush */
+constexpr uint64_t LOG_MAX_AGE = 60000;           /* ms a record may wait in a buffer */
+
+struct LogWriterOptions
+{
+  string path = "data";
+  size_t capacity = LOG_NID_MAX + 1;        /* NIDs covered by the change detector */
+  size_t batch_records = LOG_BATCH_RECORDS; /* a NID's buffer is sealed at this size */
+  size_t budget = LOG_BUFFER_BUDGET;        /* record () flushes once this many bytes are buffered */
+  uint64_t max_age = LOG_MAX_AGE;           /* record () flushes buffers whose first record is older (sample time, ms) */
+  size_t max_open = LOG_MAX_OPEN;           /* open-file budget of the LogFileManager */
+  bool sync = false;                        /* fdatasync every file after its write */
+};
+
+struct LogWriterStats
+{
+  uint64_t offered;  /* record () calls */
+  uint64_t appended; /* records buffered (changes) */
+  uint64_t written;  /* records written to disk */
+  uint64_t files;    /* file appends (one pwritev per NID and day per flush) */
+  uint64_t flushes;
+  LogFileStats io;
+};
+
+/**
+ * LOG WRITER
+ *
+ * change-only appender for the 8 byte log records
+ * - record () runs the per-NID change detector and buffers the record only when VALUE or STATUS changed
+ * - records are buffered per NID; a buffer holds one day and is sealed when the day changes or it reaches
+ *   batch_records. a flush hands every run of a file to the LogFileManager as one iovec list (one pwritev)
+ * - record () flushes everything once `budget` bytes are buffered, and the buffers older than max_age
+ *   (by sample time) as soon as the oldest one expires
+ * - buffers are swapped out under the lock and written outside of it, appends keep going meanwhile;
+ *   flushes are serialized so records of a NID reach the file in the order they were appended
+ */
+class LogWriter
+{
+private:
+  struct Pending
+  {
+    uint32_t day = 0;
+    uint64_t since = 0; /* sample ms of the first buffered record */
+    bool dirty = false;
+    vector<LogRecord> records;
+  };
+
+  struct Batch
+  {
+    uint32_t nid;
+    uint32_t day;
+    vector<LogRecord> records;
+  };
+
+  LogWriterOptions _options;
+  LogChangeDetector _detector;
+
+  mutex _mutex;
+  vector<Pending> _pending; /* indexed by NID */
+  deque<uint32_t> _dirty;   /* NIDs whose pending buffer may hold records, oldest first */
+  vector<Batch> _sealed;
+  size_t _buffered = 0;
+
+  mutex _flush_mutex;
+  LogFileManager _io; /* flush () only */
+  uint32_t _last_day = 0;
+
+  atomic<uint64_t> _offered{ 0 };
+  atomic<uint64_t> _appended{ 0 };
+  atomic<uint64_t> _written{ 0 };
+  atomic<uint64_t> _files{ 0 };
+  atomic<uint64_t> _flushes{ 0 };
+
+public:
+  explicit LogWriter ( const LogWriterOptions& options = LogWriterOptions () )
+      : _options ( options ), _detector ( options.capacity ), _io ( options.path, options.max_open, options.sync )
+  {
+    if ( _options.batch_records == 0 )
+    {
+      _options.batch_records = 1;
+    }
+
+    filesystem::create_directories ( _options.path );
+  }
+
+  ~LogWriter ()
+  {
+    try
+    {
+      flush ();
+    }
+    catch ( ... )
+    {
+    }
+  }
+
+  LogWriter ( const LogWriter& ) = delete;
+  LogWriter& operator= ( const LogWriter& ) = delete;
+
+  /**
+   * one sample of nid at epoch ms, returns whether it produced a log record
+   */
+  bool record ( uint24_t nid, int32_t value, uint8_t status, uint64_t ms )
+  {
+    _offered.fetch_add ( 1, memory_order_relaxed );
+
+    if ( !_detector.changed ( nid.to_uint32 (), value, status ) )
+    {
+      return false;
+    }
+
+    append ( nid, value, status, ms );
+    return true;
+  }
+
+  /**
+   * buffers a record without change detection (the caller already knows it changed, e.g. NidTable::update)
+   */
+  void append ( uint24_t nid, int32_t value, uint8_t status, uint64_t ms )
+  {
+    const uint32_t n = nid.to_uint32 ();
+    const uint32_t day = LogRecord::dayOf ( ms );
+    bool full;
+    bool expired;
+
+    {
+      /* @MUTEX-LOCK */
+      lock_guard<mutex> lock ( _mutex );
+
+      if ( n >= _pending.size () )
+      {
+        if ( n >= _options.capacity )
+        {
+          throw out_of_range ( "RUNTIME_ERROR: NID out of range" );
+        }
+
+        _pending.resize ( max<size_t> ( n + 1, _pending.size () * 2 ) );
+      }
+
+      Pending& p = _pending[n];
+
+      if ( !p.dirty )
+      {
+        p.dirty = true;
+        p.since = ms;
+        _dirty.push_back ( n );
+      }
+
+      if ( p.records.empty () )
+      {
+        p.day = day;
+      }
+      else if ( p.day != day )
+      {
+        seal ( n, p );
+        p.day = day;
+      }
+
+      p.records.emplace_back ( value, status, ms );
+
+      if ( p.records.size () >= _options.batch_records )
+      {
+        seal ( n, p );
+      }
+
+      _buffered += sizeof ( LogRecord );
+      full = _buffered >= _options.budget;
+      expired = _pending[_dirty.front ()].since + _options.max_age <= ms;
+    }
+
+    _appended.fetch_add ( 1, memory_order_relaxed );
+
+    if ( full )
+    {
+      flush ();
+    }
+    else if ( expired && ms >= _options.max_age )
+    {
+      flush ( ms - _options.max_age );
+    }
+  }
+
+  /**
+   * writes every buffered record
+   */
+  void flush ()
+  {
+    flush ( UINT64_MAX );
+  }
+
+  /**
+   * writes the sealed batches and the buffers whose first record is at or before cutoff (sample ms)
+   */
+  void flush ( uint64_t cutoff )
+  {
+    /* @MUTEX-LOCK */
+    lock_guard<mutex> flush_lock ( _flush_mutex );
+    vector<Batch> batches;
+
+    {
+      /* @MUTEX-LOCK */
+      lock_guard<mutex> lock ( _mutex );
+
+      batches.swap ( _sealed );
+
+      while ( !_dirty.empty () && _pending[_dirty.front ()].since <= cutoff )
+      {
+        const uint32_t n = _dirty.front ();
+        Pending& p = _pending[n];
+
+        _dirty.pop_front ();
+        p.dirty = false;
+
+        if ( !p.records.empty () )
+        {
+          batches.push_back ( { n, p.day, move ( p.records ) } );
+          p.records = vector<LogRecord> ();
+        }
+      }
+
+      _buffered = 0;
+
+      for ( uint32_t n : _dirty )
+      {
+        _buffered += _pending[n].records.size () * sizeof ( LogRecord );
+      }
+    }
+
+    if ( batches.empty () )
+    {
+      return;
+    }
+
+    /* same file next to each other, in append order; files of a month share their directory */
+    stable_sort ( batches.begin (), batches.end (), [] ( const Batch& a, const Batch& b ) { return a.day != b.day ? a.day < b.day : a.nid < b.nid; } );
+
+    for ( size_t i = 0; i < batches.size (); )
+    {
+      size_t j = i + 1;
+
+      while ( j < batches.size () && batches[j].nid == batches[i].nid && batches[j].day == batches[i].day )
+      {
+        j++;
+      }
+
+      try
+      {
+        write ( batches, i, j );
+      }
+      catch ( ... )
+      {
+        requeue ( batches, i );
+        throw;
+      }
+
+      i = j;
+    }
+
+    /* a later day was flushed: close the files of earlier days now, a NID that has not rolled over yet reopens its file */
+    const uint32_t last = batches.back ().day;
+
+    if ( last > _last_day )
+    {
+      _io.closeBefore ( last );
+      _last_day = last;
+    }
+
+    _flushes.fetch_add ( 1, memory_order_relaxed );
+  }
+
+  LogWriterStats stats ()
+  {
+    LogWriterStats r{ _offered.load ( memory_order_relaxed ), _appended.load ( memory_order_relaxed ), _written.load ( memory_order_relaxed ), _files.load ( memory_order_relaxed ),
+                      _flushes.load ( memory_order_relaxed ), LogFileStats{} };
+
+    /* @MUTEX-LOCK */
+    lock_guard<mutex> lock ( _flush_mutex );
+    r.io = _io.stats ();
+
+    return r;
+  }
+
+  const string& path () const
+  {
+    return _options.path;
+  }
+
+private:
+  /**
+   * _mutex held
+   */
+  void seal ( uint32_t n, Pending& p )
+  {
+    _sealed.push_back ( { n, p.day, move ( p.records ) } );
+    p.records = vector<LogRecord> ();
+  }
+
+  /**
+   * a failed flush puts the batches it did not write back in front of the sealed ones
+   */
+  void requeue ( vector<Batch>& batches, size_t from )
+  {
+    /* @MUTEX-LOCK */
+    lock_guard<mutex> lock ( _mutex );
+
+    for ( size_t i = from; i < batches.size (); ++i )
+    {
+      _buffered += batches[i].records.size () * sizeof ( LogRecord );
+    }
+
+    _sealed.insert ( _sealed.begin (), make_move_iterator ( batches.begin () + from ), make_move_iterator ( batches.end () ) );
+  }
+
+  /**
+   * batches [from, to) belong to one file, _flush_mutex held
+   */
+  void write ( const vector<Batch>& batches, size_t from, size_t to )
+  {
+    vector<struct iovec> iov;
+    size_t count = 0;
+
+    for ( size_t i = from; i < to; ++i )
+    {
+      iov.push_back ( { const_cast<LogRecord*> ( batches[i].records.data () ), batches[i].records.size () * sizeof ( LogRecord ) } );
+      count += batches[i].records.size ();
+    }
+
+    _io.write ( batches[from].nid, batches[from].day, iov.data (), iov.size () );
+
+    _written.fetch_add ( count, memory_order_relaxed );
+    _files.fetch_add ( 1, memory_order_relaxed );
+  }
+};
+
+#endif
@@ -0,0 +1,230 @@
+#ifndef REGEXP_CACHE_HPP
+#define REGEXP_CACHE_HPP
+
+#include "RegexpProgram.hpp"
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <future>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+using namespace std;
+
+constexpr size_t REGEXP_CACHE_CAPACITY = 1024;
+
+struct RegexpCacheStats
+{
+  uint64_t hits;
+  uint64_t misses;
+  uint64_t compiles;
+  uint64_t evictions;
+  uint64_t compile_ns; /* total time spent compiling */
+  size_t size;
+};
+
+/**
+ * REGEXP CACHE
+ *
+ * compiled patterns keyed by the pattern string, the programs are immutable and shared between threads
+ * - a hit takes the shared lock, stamps the entry with the LRU clock and copies the shared_ptr
+ * - a miss registers a pending entry under the exclusive lock and compiles outside of it, threads asking for
+ *   the same pattern meanwhile wait on that compile instead of starting their own: a pattern is compiled once
+ *   for as long as it stays cached
+ * - beyond the capacity the entry with the oldest stamp is evicted, programs already handed out stay alive
+ * - a pattern that fails to compile is not cached, the error is rethrown to every waiter
+ */
+class RegexpCache
+{
+private:
+  using Program = shared_ptr<const RegexpProgram>;
+
+  struct Entry
+  {
+    string pattern;
+    shared_future<Program> program;
+    atomic<uint64_t> tick{ 0 };
+  };
+
+  mutable shared_mutex _mutex;
+  unordered_map<string_view, shared_ptr<Entry>> _entries; /* keys view Entry::pattern */
+  size_t _capacity;
+
+  atomic<uint64_t> _clock{ 0 };
+  atomic<uint64_t> _hits{ 0 };
+  atomic<uint64_t> _misses{ 0 };
+  atomic<uint64_t> _compiles{ 0 };
+  atomic<uint64_t> _evictions{ 0 };
+  atomic<uint64_t> _compile_ns{ 0 };
+
+public:
+  explicit RegexpCache ( size_t capacity = REGEXP_CACHE_CAPACITY ) : _capacity ( capacity ? capacity : 1 )
+  {
+  }
+
+  RegexpCache ( const RegexpCache& ) = delete;
+  RegexpCache& operator= ( const RegexpCache& ) = delete;
+
+  /**
+   * process wide cache used by RegexpMatch
+   */
+  static RegexpCache& global ()
+  {
+    static RegexpCache cache;
+    return cache;
+  }
+
+  Program get ( string_view pattern )
+  {
+    {
+      /* @MUTEX-LOCK */
+      shared_lock<shared_mutex> lock ( _mutex );
+      auto it = _entries.find ( pattern );
+
+      if ( it != _entries.end () )
+      {
+        shared_ptr<Entry> e = it->second;
+
+        lock.unlock ();
+        return hit ( *e );
+      }
+    }
+
+    promise<Program> result;
+    shared_ptr<Entry> e;
+
+    {
+      /* @MUTEX-LOCK */
+      unique_lock<shared_mutex> lock ( _mutex );
+      auto it = _entries.find ( pattern );
+
+      if ( it != _entries.end () )
+      {
+        e = it->second;
+        lock.unlock ();
+        return hit ( *e );
+      }
+
+      while ( _entries.size () >= _capacity )
+      {
+        evict ();
+      }
+
+      e = make_shared<Entry> ();
+      e->pattern.assign ( pattern.data (), pattern.size () );
+      e->program = result.get_future ().share ();
+      e->tick.store ( _clock.fetch_add ( 1, memory_order_relaxed ), memory_order_relaxed );
+      _entries.emplace ( string_view ( e->pattern ), e );
+    }
+
+    _misses.fetch_add ( 1, memory_order_relaxed );
+
+    try
+    {
+      const auto begin = chrono::steady_clock::now ();
+      Program p = make_shared<const RegexpProgram> ( pattern );
+
+      _compile_ns.fetch_add ( static_cast<uint64_t> ( chrono::duration_cast<chrono::nanoseconds> ( chrono::steady_clock::now () - begin ).count () ), memory_order_relaxed );
+      _compiles.fetch_add ( 1, memory_order_relaxed );
+      result.set_value ( p );
+
+      return p;
+    }
+    catch ( ... )
+    {
+      result.set_exception ( current_exception () );
+      drop ( e );
+      throw;
+    }
+  }
+
+  bool contains ( string_view pattern ) const
+  {
+    /* @MUTEX-LOCK */
+    shared_lock<shared_mutex> lock ( _mutex );
+    return _entries.count ( pattern ) != 0;
+  }
+
+  void clear ()
+  {
+    /* @MUTEX-LOCK */
+    unique_lock<shared_mutex> lock ( _mutex );
+    _entries.clear ();
+  }
+
+  /**
+   * evicts down to the new capacity right away
+   */
+  void setCapacity ( size_t c )
+  {
+    /* @MUTEX-LOCK */
+    unique_lock<shared_mutex> lock ( _mutex );
+    _capacity = c ? c : 1;
+
+    while ( _entries.size () > _capacity )
+    {
+      evict ();
+    }
+  }
+
+  RegexpCacheStats stats () const
+  {
+    RegexpCacheStats r{ _hits.load ( memory_order_relaxed ),       _misses.load ( memory_order_relaxed ),
+                        _compiles.load ( memory_order_relaxed ),   _evictions.load ( memory_order_relaxed ),
+                        _compile_ns.load ( memory_order_relaxed ), 0 };
+
+    /* @MUTEX-LOCK */
+    shared_lock<shared_mutex> lock ( _mutex );
+    r.size = _entries.size ();
+
+    return r;
+  }
+
+private:
+  /**
+   * waits when the pattern is still being compiled by another thread
+   */
+  Program hit ( Entry& e )
+  {
+    e.tick.store ( _clock.fetch_add ( 1, memory_order_relaxed ), memory_order_relaxed );
+    _hits.fetch_add ( 1, memory_order_relaxed );
+
+    return e.program.get ();
+  }
+
+  /**
+   * exclusive lock held. linear in the entry count, only runs on a miss that is about to compile anyway
+   */
+  void evict ()
+  {
+    auto victim = _entries.begin ();
+
+    for ( auto it = _entries.begin (); it != _entries.end (); ++it )
+    {
+      if ( it->second->tick.load ( memory_order_relaxed ) < victim->second->tick.load ( memory_order_relaxed ) )
+      {
+        victim = it;
+      }
+    }
+
+    _entries.erase ( victim );
+    _evictions.fetch_add ( 1, memory_order_relaxed );
+  }
+
+  void drop ( const shared_ptr<Entry>& e )
+  {
+    /* @MUTEX-LOCK */
+    unique_lock<shared_mutex> lock ( _mutex );
+    auto it = _entries.find ( e->pattern );
+
+    if ( it != _entries.end () && it->second == e )
+    {
+      _entries.erase ( it );
+    }
+  }
+};
+
+#endif
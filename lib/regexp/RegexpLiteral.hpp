@@ -0,0 +1,280 @@
+#ifndef REGEXP_LITERAL_HPP
+#define REGEXP_LITERAL_HPP
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#ifdef _MSC_VER
+#  include <intrin.h>
+#endif
+
+#if defined( __x86_64__ ) || defined( __i386__ ) || defined( _M_X64 ) || defined( _M_IX86 )
+#  include <immintrin.h>
+#  define REGEXP_USE_X86 1
+#endif
+
+#if defined( __SSE2__ ) || defined( _M_X64 ) || ( defined( _M_IX86_FP ) && _M_IX86_FP >= 2 )
+#  define REGEXP_USE_SSE2 1
+#endif
+
+/* the AVX2 kernel is compiled for the avx2 target only, the header itself needs no -mavx2 */
+#if defined( REGEXP_USE_X86 ) && ( defined( __GNUC__ ) || defined( __clang__ ) )
+#  define REGEXP_TARGET_AVX2 __attribute__ ( ( target ( "avx2" ) ) )
+#  define REGEXP_USE_AVX2 1
+#elif defined( REGEXP_USE_X86 ) && defined( _MSC_VER )
+#  define REGEXP_TARGET_AVX2
+#  define REGEXP_USE_AVX2 1
+#endif
+
+using namespace std;
+
+enum class RegexpIsa
+{
+  SCALAR,
+  SSE2,
+  AVX2
+};
+
+/**
+ * REGEXP LITERAL
+ *
+ * substring search for patterns without metacharacters, on UTF-8 bytes
+ * - first / last byte filter (W. Mula, "SIMD-friendly algorithms for substring searching"): the first byte of the
+ *   needle is compared against the block at i, the last byte against the block at i + n - 1, only positions where
+ *   both agree are verified with memcmp. one byte needles skip the verify
+ * - 32 byte AVX2 lanes or 16 byte SSE2 lanes, unaligned loads, no copies, every offset is tested
+ * - the kernel is picked once at runtime from the CPU (cpuid / __builtin_cpu_supports)
+ */
+class RegexpLiteral
+{
+private:
+  using Kernel = size_t ( * ) ( const char*, size_t, const char*, size_t, size_t );
+
+  string _needle;
+
+public:
+  explicit RegexpLiteral ( string_view needle ) : _needle ( needle )
+  {
+  }
+
+  /**
+   * offset of the first occurrence at or after from, string_view::npos if none
+   */
+  size_t find ( string_view text, size_t from = 0 ) const
+  {
+    if ( _needle.empty () )
+    {
+      return from <= text.size () ? from : string_view::npos;
+    }
+
+    if ( text.size () < _needle.size () || from > text.size () - _needle.size () )
+    {
+      return string_view::npos;
+    }
+
+    return kernel () ( text.data (), text.size (), _needle.data (), _needle.size (), from );
+  }
+
+  /**
+   * start offset of every occurrence, overlapping ones included ("aa" in "aaa" -> 0, 1). returns the count
+   */
+  size_t findAll ( string_view text, vector<size_t>& positions ) const
+  {
+    positions.clear ();
+
+    if ( _needle.empty () )
+    {
+      return 0;
+    }
+
+    for ( size_t i = find ( text ); i != string_view::npos; i = find ( text, i + 1 ) )
+    {
+      positions.push_back ( i );
+    }
+
+    return positions.size ();
+  }
+
+  bool search ( string_view text ) const
+  {
+    return find ( text ) != string_view::npos;
+  }
+
+  const string& needle () const
+  {
+    return _needle;
+  }
+
+  static RegexpIsa isa ()
+  {
+    static const RegexpIsa detected = detect ();
+    return detected;
+  }
+
+private:
+  static Kernel kernel ()
+  {
+    static const Kernel k = select ( isa () );
+    return k;
+  }
+
+  static Kernel select ( RegexpIsa isa )
+  {
+#ifdef REGEXP_USE_AVX2
+    if ( isa == RegexpIsa::AVX2 )
+    {
+      return findAvx2;
+    }
+#endif
+#ifdef REGEXP_USE_SSE2
+    if ( isa != RegexpIsa::SCALAR )
+    {
+      return findSse2;
+    }
+#endif
+    return findScalar;
+  }
+
+  static RegexpIsa detect ()
+  {
+#if defined( REGEXP_USE_AVX2 ) && defined( _MSC_VER )
+    int info[4];
+
+    __cpuid ( info, 1 );
+
+    const bool osxsave = ( info[2] & ( 1 << 27 ) ) != 0;
+    const bool avx = ( info[2] & ( 1 << 28 ) ) != 0;
+
+    if ( osxsave && avx && ( _xgetbv ( 0 ) & 6 ) == 6 )
+    {
+      __cpuidex ( info, 7, 0 );
+
+      if ( info[1] & ( 1 << 5 ) )
+      {
+        return RegexpIsa::AVX2;
+      }
+    }
+#elif defined( REGEXP_USE_AVX2 )
+    if ( __builtin_cpu_supports ( "avx2" ) )
+    {
+      return RegexpIsa::AVX2;
+    }
+#endif
+#ifdef REGEXP_USE_SSE2
+    return RegexpIsa::SSE2;
+#else
+    return RegexpIsa::SCALAR;
+#endif
+  }
+
+  /**
+   * candidate at p: first and last byte already agree
+   */
+  static bool verify ( const char* p, const char* needle, size_t n )
+  {
+    return n <= 2 || memcmp ( p + 1, needle + 1, n - 2 ) == 0;
+  }
+
+  static size_t findScalar ( const char* text, size_t len, const char* needle, size_t n, size_t from )
+  {
+    const char* p = text + from;
+    const char* last = text + len - n;
+
+    while ( p <= last )
+    {
+      p = static_cast<const char*> ( memchr ( p, needle[0], static_cast<size_t> ( last - p ) + 1 ) );
+
+      if ( !p )
+      {
+        break;
+      }
+
+      if ( p[n - 1] == needle[n - 1] && verify ( p, needle, n ) )
+      {
+        return static_cast<size_t> ( p - text );
+      }
+
+      p++;
+    }
+
+    return string_view::npos;
+  }
+
+#ifdef REGEXP_USE_SSE2
+  static size_t findSse2 ( const char* text, size_t len, const char* needle, size_t n, size_t from )
+  {
+    const __m128i first = _mm_set1_epi8 ( needle[0] );
+    const __m128i last = _mm_set1_epi8 ( needle[n - 1] );
+    const size_t end = len - n + 1; /* candidate starts are [from, end) */
+    size_t i = from;
+
+    for ( ; i + 16 <= end; i += 16 )
+    {
+      const __m128i a = _mm_loadu_si128 ( reinterpret_cast<const __m128i*> ( text + i ) );
+      const __m128i b = _mm_loadu_si128 ( reinterpret_cast<const __m128i*> ( text + i + n - 1 ) );
+      uint32_t mask = static_cast<uint32_t> ( _mm_movemask_epi8 ( _mm_and_si128 ( _mm_cmpeq_epi8 ( a, first ), _mm_cmpeq_epi8 ( b, last ) ) ) );
+
+      while ( mask )
+      {
+        const size_t at = i + ctz ( mask );
+
+        if ( verify ( text + at, needle, n ) )
+        {
+          return at;
+        }
+
+        mask &= mask - 1;
+      }
+    }
+
+    return i < end ? findScalar ( text, len, needle, n, i ) : string_view::npos;
+  }
+#endif
+
+#ifdef REGEXP_USE_AVX2
+  REGEXP_TARGET_AVX2 static size_t findAvx2 ( const char* text, size_t len, const char* needle, size_t n, size_t from )
+  {
+    const __m256i first = _mm256_set1_epi8 ( needle[0] );
+    const __m256i last = _mm256_set1_epi8 ( needle[n - 1] );
+    const size_t end = len - n + 1;
+    size_t i = from;
+
+    for ( ; i + 32 <= end; i += 32 )
+    {
+      const __m256i a = _mm256_loadu_si256 ( reinterpret_cast<const __m256i*> ( text + i ) );
+      const __m256i b = _mm256_loadu_si256 ( reinterpret_cast<const __m256i*> ( text + i + n - 1 ) );
+      uint32_t mask = static_cast<uint32_t> ( _mm256_movemask_epi8 ( _mm256_and_si256 ( _mm256_cmpeq_epi8 ( a, first ), _mm256_cmpeq_epi8 ( b, last ) ) ) );
+
+      while ( mask )
+      {
+        const size_t at = i + ctz ( mask );
+
+        if ( verify ( text + at, needle, n ) )
+        {
+          return at;
+        }
+
+        mask &= mask - 1;
+      }
+    }
+
+    return i < end ? findScalar ( text, len, needle, n, i ) : string_view::npos;
+  }
+#endif
+
+  static uint32_t ctz ( uint32_t m )
+  {
+#ifdef _MSC_VER
+    unsigned long i;
+    _BitScanForward ( &i, m );
+    return i;
+#else
+    return static_cast<uint32_t> ( __builtin_ctz ( m ) );
+#endif
+  }
+};
+
+#endif
@@ -1,22 +1,15 @@
 #ifndef REGEXP_MATCH_HPP
 #define REGEXP_MATCH_HPP
 
-#include <algorithm>
-#include <codecvt>
-#include <locale>
-#include <map>
+#include "RegexpCache.hpp"
+#include "RegexpProgram.hpp"
+#include <cstdint>
 #include <memory>
-#include <set>
 #include <stdexcept>
 #include <string>
+#include <string_view>
 #include <vector>
 
-#ifdef _MSC_VER
-#  include <intrin.h>
-#else
-#  include <x86intrin.h>
-#endif
-
 #ifdef _WIN32
 #  ifdef REGEX_ENGINE_EXPORTS
 #    define REGEX_API __declspec ( dllexport )
@@ -36,8 +29,7 @@ public:
   {
     try
     {
-      wstring wpattern = utf2Wstring ( pattern );
-      init ( wpattern );
+      init ( pattern );
     }
     catch ( const exception& e )
     {
@@ -49,7 +41,7 @@ public:
   {
     try
     {
-      init ( pattern );
+      init ( wstring2Utf ( pattern ) );
     }
     catch ( const exception& e )
     {
@@ -59,33 +51,25 @@ public:
 
   ~RegexpMatch () = default;
 
-  bool test ( const string& text ) const
+  /**
+   * unanchored search on UTF-8 text, linear in the text length. no conversion and no allocation
+   */
+  bool test ( string_view text ) const
   {
-    try
-    {
-      return test ( utf2Wstring ( text ) );
-    }
-    catch ( const exception& e )
-    {
-      throw runtime_error ( "RUNTIME_ERROR test: " + string ( e.what () ) );
-    }
+    return program->search ( text );
   }
 
+  /**
+   * encoded to UTF-8 in a per-thread buffer first
+   */
   bool test ( const wstring& text ) const
   {
-    if ( text.empty () )
-    {
-      return false;
-    }
+    static thread_local string buffer;
 
     try
     {
-      if ( simd_search )
-      {
-        return matchSIMD ( text );
-      }
-
-      return match ( text );
+      wstring2Utf ( text, buffer );
+      return program->search ( buffer );
     }
     catch ( const exception& e )
     {
@@ -93,301 +77,98 @@ public:
     }
   }
 
-private:
-  struct State
+  /**
+   * start offset of every occurrence (overlapping included) for patterns without metacharacters, returns the count.
+   * other patterns throw: the DFA and Pike VM only answer whether the text matches
+   */
+  size_t find ( string_view text, vector<size_t>& positions ) const
   {
-    bool is_final;
-    map<wstring, shared_ptr<State>> mapper;
-    State () : is_final ( false )
-    {
-    }
-  };
-
-  shared_ptr<State> root;
-  wstring pattern;
-  size_t pattern_len;
-  bool simd_search;
-  vector<__m256i> simd_pattern;
+    const RegexpLiteral* literal = program->literal ();
 
-  void init ( const wstring& str )
-  {
-    if ( str.empty () )
+    if ( !literal )
     {
-      throw invalid_argument ( "Pattern cannot be empty" );
+      throw runtime_error ( "RUNTIME_ERROR find: positions are only available for literal patterns" );
     }
 
-    pattern = str;
-    pattern_len = str.length ();
-    root = make_shared<State> ();
-
-    build ( pattern );
-
-    simd_search = hasOnlySimplePattern ( pattern ) && isAvailableSIMD ();
-
-    if ( simd_search )
-    {
-      genPatternSIMD ();
-    }
+    return literal->findAll ( text, positions );
   }
 
-  bool hasOnlySimplePattern ( const wstring& str ) const
+  bool isLiteral () const
   {
-    return str.find_first_of ( L"[]\\*+?{}()^$" ) == wstring::npos;
+    return program->literal () != nullptr;
   }
 
-  bool isAvailableSIMD () const
-  {
-    /* clang-format off */
-    #ifdef _MSC_VER
-        int cpu_info[4];
-        __cpuid ( cpu_info, 1 );
-        return ( cpu_info[2] & ( 1 << 28 ) ) != 0;
-    #else
-        return __builtin_cpu_supports ( "avx2" );
-    #endif
-    /* clang-format on */
-  }
+private:
+  shared_ptr<const RegexpProgram> program; /* shared through RegexpCache::global (), never recompiled per instance */
 
-  bool matchSIMD ( const wstring& str ) const
+  void init ( const string& str )
   {
-    if ( pattern_len > str.length () )
-    {
-      return false;
-    }
-
-    const size_t text_len = str.length ();
-    const size_t chunks = simd_pattern.size ();
-
-    for ( size_t i = 0; i <= text_len - pattern_len; i += 16 )
+    if ( str.empty () )
     {
-      bool potential_match = true;
-
-      for ( size_t j = 0; j < chunks && potential_match; ++j )
-      {
-        alignas ( 32 ) wchar_t temp[16] = { 0 };
-        size_t remain = min ( size_t ( 16 ), text_len - i );
-
-        copy_n ( str.begin () + i, remain, temp );
-
-        __m256i text_chunk = _mm256_load_si256 ( reinterpret_cast<const __m256i*> ( temp ) );
-        __m256i cmp = _mm256_cmpeq_epi16 ( text_chunk, simd_pattern[j] );
-        unsigned int mask = _mm256_movemask_epi8 ( cmp );
-
-        if ( mask != 0xFFFFFFFF )
-        {
-          potential_match = false;
-        }
-      }
-
-      if ( potential_match && verify ( str, i ) )
-      {
-        return true;
-      }
+      throw invalid_argument ( "Pattern cannot be empty" );
     }
 
-    return false;
+    program = RegexpCache::global ().get ( str );
   }
 
-  bool verify ( const wstring& str, size_t pos ) const
+  static string wstring2Utf ( const wstring& str )
   {
-    if ( pos + pattern_len > str.length () )
-    {
-      return false;
-    }
-
-    return equal ( pattern.begin (), pattern.end (), str.begin () + pos );
+    string out;
+    wstring2Utf ( str, out );
+    return out;
   }
 
-  bool match ( const wstring& str ) const
+  /**
+   * UTF-16 (wchar_t on Windows, surrogate pairs joined) or UTF-32 -> UTF-8
+   */
+  static void wstring2Utf ( const wstring& str, string& out )
   {
-    auto now = root;
-    size_t pos = 0;
+    out.clear ();
 
-    while ( pos < str.length () )
+    for ( size_t i = 0; i < str.size (); ++i )
     {
-      bool matched = false;
-
-      for ( const auto& transition : now->mapper )
-      {
-        if ( matchePatterns ( str, pos, transition.first ) )
-        {
-          pos += getMatchLength ( transition.first );
-          now = transition.second;
-          matched = true;
-
-          break;
-        }
-      }
+      uint32_t cp = static_cast<uint32_t> ( str[i] );
 
-      if ( !matched )
+      if ( sizeof ( wchar_t ) == 2 && cp >= 0xD800 && cp <= 0xDBFF && i + 1 < str.size () )
       {
-        if ( now->is_final )
-        {
-          return true;
-        }
+        const uint32_t lo = static_cast<uint32_t> ( str[i + 1] );
 
-        if ( pos == 0 )
+        if ( lo >= 0xDC00 && lo <= 0xDFFF )
         {
-          pos++;
-          now = root;
-        }
-        else
-        {
-          return false;
+          cp = 0x10000 + ( ( cp - 0xD800 ) << 10 ) + ( lo - 0xDC00 );
+          i++;
         }
       }
-    }
 
-    return now->is_final;
-  }
-
-  void build ( const wstring& str )
-  {
-    auto now = root;
-    wstring token;
-
-    for ( size_t i = 0; i < str.length (); ++i )
-    {
-      token.clear ();
-
-      if ( str[i] == L'\\' && i + 1 < str.length () )
-      {
-        token = str.substr ( i, 2 );
-        i++;
-      }
-      else if ( str[i] == L'[' )
-      {
-        size_t end = str.find ( L']', i );
-
-        if ( end != wstring::npos )
-        {
-          token = str.substr ( i, end - i + 1 );
-          i = end;
-        }
-        else
-        {
-          throw runtime_error ( "RUNTIME_ERROR: [...]" );
-        }
-      }
-      else
+      if ( cp > 0x10FFFF || ( cp >= 0xD800 && cp <= 0xDFFF ) )
       {
-        token = str[i];
+        throw range_error ( "invalid code point" );
       }
 
-      auto next = make_shared<State> ();
-
-      now->mapper[token] = next;
-      now = next;
-    }
-
-    now->is_final = true;
-  }
-
-  bool matchePatterns ( const wstring& str, size_t pos, const wstring& pattern ) const
-  {
-    if ( pattern.empty () || pos >= str.length () )
-    {
-      return false;
-    }
-
-    if ( pattern[0] == L'\\' )
-    {
-      if ( pattern.length () < 2 )
+      if ( cp < 0x80 )
       {
-        throw runtime_error ( "RUNTIME_ERROR: escape" );
+        out += static_cast<char> ( cp );
       }
-      switch ( pattern[1] )
+      else if ( cp < 0x800 )
       {
-        case L'd':
-          return iswdigit ( str[pos] );
-        case L'w':
-          return iswalnum ( str[pos] ) || str[pos] == L'_';
-        case L's':
-          return iswspace ( str[pos] );
-        default:
-          return str[pos] == pattern[1];
+        out += static_cast<char> ( 0xC0 | ( cp >> 6 ) );
+        out += static_cast<char> ( 0x80 | ( cp & 0x3F ) );
       }
-    }
-
-
-    if ( pattern[0] == L'[' )
-    {
-      return matcheCharacterClasses ( str[pos], pattern );
-    }
-
-
-    return str[pos] == pattern[0];
-  }
-
-  bool matcheCharacterClasses ( wchar_t c, const wstring& pattern ) const
-  {
-    if ( pattern.length () < 3 )
-    {
-      throw runtime_error ( "RUNTIME_ERROR: character class" );
-    }
-
-    bool negate = pattern[1] == L'^';
-    size_t start = negate ? 2 : 1;
-    bool matched = false;
-
-    for ( size_t i = start; i < pattern.length () - 1; ++i )
-    {
-
-      if ( pattern[i] == L'-' && i > start && i + 1 < pattern.length () - 1 )
+      else if ( cp < 0x10000 )
       {
-        if ( c >= pattern[i - 1] && c <= pattern[i + 1] )
-        {
-          matched = true;
-          break;
-        }
-        i++;
+        out += static_cast<char> ( 0xE0 | ( cp >> 12 ) );
+        out += static_cast<char> ( 0x80 | ( ( cp >> 6 ) & 0x3F ) );
+        out += static_cast<char> ( 0x80 | ( cp & 0x3F ) );
       }
-
-      else if ( c == pattern[i] )
+      else
       {
-        matched = true;
-        break;
+        out += static_cast<char> ( 0xF0 | ( cp >> 18 ) );
+        out += static_cast<char> ( 0x80 | ( ( cp >> 12 ) & 0x3F ) );
+        out += static_cast<char> ( 0x80 | ( ( cp >> 6 ) & 0x3F ) );
+        out += static_cast<char> ( 0x80 | ( cp & 0x3F ) );
       }
     }
-
-    return negate ? !matched : matched;
-  }
-
-  size_t getMatchLength ( const wstring& pattern ) const
-  {
-    if ( pattern[0] == L'\\' )
-      return 1;
-    if ( pattern[0] == L'[' )
-      return 1;
-    return pattern.length ();
-  }
-
-  void genPatternSIMD ()
-  {
-    simd_pattern.clear ();
-
-    for ( size_t i = 0; i < pattern.length (); i += 16 )
-    {
-      alignas ( 32 ) wchar_t temp[16] = { 0 };
-      size_t remain = min ( size_t ( 16 ), pattern.length () - i );
-      copy_n ( pattern.begin () + i, remain, temp );
-
-      __m256i chunk = _mm256_load_si256 ( reinterpret_cast<const __m256i*> ( temp ) );
-      simd_pattern.push_back ( chunk );
-    }
-  }
-
-  static wstring utf2Wstring ( const string& str )
-  {
-    wstring_convert<codecvt_utf8<wchar_t>> converter;
-    return converter.from_bytes ( str );
-  }
-
-  static string wstring2Utf ( const wstring& str )
-  {
-    wstring_convert<codecvt_utf8<wchar_t>> converter;
-    return converter.to_bytes ( str );
   }
 };
 
-#endif
\ No newline at end of file
+#endif
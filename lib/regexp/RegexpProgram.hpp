@@ -0,0 +1,1285 @@
+#ifndef REGEXP_PROGRAM_HPP
+#define REGEXP_PROGRAM_HPP
+
+#include "RegexpLiteral.hpp"
+#include <algorithm>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+constexpr uint32_t REGEXP_NONE = 0xFFFFFFFF;
+constexpr size_t REGEXP_DFA_MAX_STATES = 10000;
+constexpr uint32_t REGEXP_REPEAT_MAX = 1000;
+constexpr uint32_t REGEXP_CODEPOINT_MAX = 0x10FFFF;
+
+/**
+ * REGEXP NFA
+ *
+ * Thompson NFA over UTF-8 bytes, every codepoint range is expanded to byte sequences at compile time
+ */
+struct RegexpNfa
+{
+  enum class Op : uint8_t
+  {
+    BYTE,  /* lo <= byte <= hi, then out */
+    SPLIT, /* out and out1 (out1 may be REGEXP_NONE: plain epsilon) */
+    BEGIN, /* ^ */
+    END,   /* $ */
+    MATCH  /* out is the pattern id (RegexpSet) */
+  };
+
+  struct Inst
+  {
+    Op op;
+    uint8_t lo;
+    uint8_t hi;
+    uint32_t out;
+    uint32_t out1;
+  };
+
+  vector<Inst> insts;
+  uint32_t start = REGEXP_NONE;
+
+  /**
+   * epsilon closure of pc, keeps BYTE / END / MATCH instructions. seen is all zero on entry and on return
+   */
+  void closure ( uint32_t pc, bool begin, bool end, vector<uint8_t>& seen, vector<uint32_t>& out ) const
+  {
+    vector<uint32_t> stack{ pc };
+    vector<uint32_t> visited;
+
+    while ( !stack.empty () )
+    {
+      const uint32_t i = stack.back ();
+
+      stack.pop_back ();
+
+      if ( i == REGEXP_NONE || seen[i] )
+      {
+        continue;
+      }
+
+      seen[i] = 1;
+      visited.push_back ( i );
+
+      const auto& inst = insts[i];
+
+      switch ( inst.op )
+      {
+        case Op::SPLIT:
+          stack.push_back ( inst.out1 );
+          stack.push_back ( inst.out );
+          break;
+        case Op::BEGIN:
+          if ( begin )
+          {
+            stack.push_back ( inst.out );
+          }
+          break;
+        case Op::END:
+          if ( end )
+          {
+            stack.push_back ( inst.out );
+          }
+          else
+          {
+            out.push_back ( i );
+          }
+          break;
+        default:
+          out.push_back ( i );
+          break;
+      }
+    }
+
+    for ( uint32_t i : visited )
+    {
+      seen[i] = 0;
+    }
+  }
+
+  /**
+   * byte -> equivalence class, two bytes no BYTE instruction tells apart share a class. rep holds one byte per class
+   */
+  void byteClasses ( uint8_t classes[256], vector<uint8_t>& rep ) const
+  {
+    bool edge[257] = { false };
+
+    for ( const auto& inst : insts )
+    {
+      if ( inst.op == Op::BYTE )
+      {
+        edge[inst.lo] = true;
+        edge[inst.hi + 1] = true;
+      }
+    }
+
+    rep.clear ();
+
+    for ( int b = 0, c = -1; b < 256; ++b )
+    {
+      if ( edge[b] || b == 0 )
+      {
+        rep.push_back ( static_cast<uint8_t> ( b ) );
+        c++;
+      }
+
+      classes[b] = static_cast<uint8_t> ( c );
+    }
+  }
+};
+
+/**
+ * REGEXP PARSER
+ *
+ * UTF-8 pattern -> RegexpNfa
+ * - literals, ., [...] [^...] with ranges, \d \w \s \D \W \S \n \r \t, escaped metacharacters
+ * - *, +, ?, {m}, {m,}, {m,n} (a lazy ? suffix is accepted, test () only answers whether a match exists)
+ * - |, ( ), (?: ), groups do not capture
+ * - ^, $
+ * - a '{' that does not start a valid repeat is a literal
+ */
+class RegexpParser
+{
+private:
+  using Ranges = vector<pair<uint32_t, uint32_t>>;
+
+  /* out slots to patch: inst index << 1 | (0: out, 1: out1) */
+  struct Frag
+  {
+    uint32_t start;
+    vector<uint32_t> outs;
+  };
+
+  string_view _src;
+  size_t _pos = 0;
+  RegexpNfa& _nfa;
+  const size_t _base;
+
+public:
+  static RegexpNfa compile ( string_view pattern )
+  {
+    RegexpNfa nfa;
+
+    nfa.start = append ( nfa, pattern, 0 );
+    return nfa;
+  }
+
+  /**
+   * compiles pattern into nfa next to what is already there, its MATCH carries id. returns the pattern start
+   */
+  static uint32_t append ( RegexpNfa& nfa, string_view pattern, uint32_t id )
+  {
+    RegexpParser p ( pattern, nfa );
+    Frag f = p.parseAlt ();
+
+    if ( p._pos < p._src.size () )
+    {
+      throw runtime_error ( "RUNTIME_ERROR: Unexpected '" + string ( 1, p._src[p._pos] ) + "' at " + to_string ( p._pos ) );
+    }
+
+    p.patch ( f, p.emit ( RegexpNfa::Op::MATCH, 0, 0, id ) );
+
+    return f.start;
+  }
+
+  /**
+   * UTF-8 decode, throws on malformed input
+   */
+  static uint32_t decode ( string_view s, size_t& pos )
+  {
+    const uint8_t c = static_cast<uint8_t> ( s[pos++] );
+    size_t n;
+    uint32_t cp;
+
+    if ( c < 0x80 )
+    {
+      return c;
+    }
+    else if ( ( c & 0xE0 ) == 0xC0 )
+    {
+      n = 1;
+      cp = c & 0x1F;
+    }
+    else if ( ( c & 0xF0 ) == 0xE0 )
+    {
+      n = 2;
+      cp = c & 0x0F;
+    }
+    else if ( ( c & 0xF8 ) == 0xF0 )
+    {
+      n = 3;
+      cp = c & 0x07;
+    }
+    else
+    {
+      throw runtime_error ( "RUNTIME_ERROR: Invalid UTF-8 in pattern" );
+    }
+
+    for ( ; n > 0; --n )
+    {
+      if ( pos >= s.size () || ( static_cast<uint8_t> ( s[pos] ) & 0xC0 ) != 0x80 )
+      {
+        throw runtime_error ( "RUNTIME_ERROR: Invalid UTF-8 in pattern" );
+      }
+
+      cp = ( cp << 6 ) | ( static_cast<uint8_t> ( s[pos++] ) & 0x3F );
+    }
+
+    return cp;
+  }
+
+private:
+  RegexpParser ( string_view src, RegexpNfa& nfa ) : _src ( src ), _nfa ( nfa ), _base ( nfa.insts.size () )
+  {
+  }
+
+  bool more () const
+  {
+    return _pos < _src.size ();
+  }
+
+  char peek () const
+  {
+    return _src[_pos];
+  }
+
+  uint32_t emit ( RegexpNfa::Op op, uint8_t lo = 0, uint8_t hi = 0, uint32_t out = REGEXP_NONE, uint32_t out1 = REGEXP_NONE )
+  {
+    _nfa.insts.push_back ( { op, lo, hi, out, out1 } );
+    return static_cast<uint32_t> ( _nfa.insts.size () - 1 );
+  }
+
+  void patch ( const Frag& f, uint32_t target )
+  {
+    for ( uint32_t o : f.outs )
+    {
+      auto& inst = _nfa.insts[o >> 1];
+      ( o & 1 ? inst.out1 : inst.out ) = target;
+    }
+  }
+
+  Frag epsilon ()
+  {
+    const uint32_t i = emit ( RegexpNfa::Op::SPLIT );
+    return { i, { i << 1 } };
+  }
+
+  Frag parseConcat ()
+  {
+    Frag f = epsilon ();
+
+    while ( more () && peek () != '|' && peek () != ')' )
+    {
+      Frag next = parseRepeat ();
+
+      patch ( f, next.start );
+      f.outs = move ( next.outs );
+    }
+
+    return f;
+  }
+
+  Frag parseAlt ()
+  {
+    Frag f = parseConcat ();
+
+    while ( more () && peek () == '|' )
+    {
+      _pos++;
+
+      Frag g = parseConcat ();
+      const uint32_t s = emit ( RegexpNfa::Op::SPLIT, 0, 0, f.start, g.start );
+
+      f.start = s;
+      f.outs.insert ( f.outs.end (), g.outs.begin (), g.outs.end () );
+    }
+
+    return f;
+  }
+
+  Frag parseRepeat ()
+  {
+    const uint32_t first = static_cast<uint32_t> ( _nfa.insts.size () );
+    Frag f = parseAtom ();
+    uint32_t lo;
+    uint32_t hi;
+
+    while ( more () )
+    {
+      const char q = peek ();
+
+      if ( q == '*' || q == '+' || q == '?' )
+      {
+        _pos++;
+        f = q == '*' ? star ( f ) : q == '+' ? plus ( f ) : quest ( f );
+      }
+      else if ( q == '{' && parseBounds ( lo, hi ) )
+      {
+        f = repeat ( f, first, lo, hi );
+      }
+      else
+      {
+        break;
+      }
+
+      if ( more () && peek () == '?' )
+      {
+        _pos++;
+      }
+    }
+
+    return f;
+  }
+
+  Frag star ( Frag f )
+  {
+    const uint32_t s = emit ( RegexpNfa::Op::SPLIT, 0, 0, f.start );
+
+    patch ( f, s );
+    return { s, { s << 1 | 1 } };
+  }
+
+  Frag plus ( Frag f )
+  {
+    const uint32_t s = emit ( RegexpNfa::Op::SPLIT, 0, 0, f.start );
+
+    patch ( f, s );
+    return { f.start, { s << 1 | 1 } };
+  }
+
+  Frag quest ( Frag f )
+  {
+    const uint32_t s = emit ( RegexpNfa::Op::SPLIT, 0, 0, f.start );
+
+    f.outs.push_back ( s << 1 | 1 );
+    return { s, move ( f.outs ) };
+  }
+
+  /**
+   * {m} {m,} {m,n}, leaves _pos untouched and returns false when the brace is not a repeat
+   */
+  bool parseBounds ( uint32_t& lo, uint32_t& hi )
+  {
+    size_t i = _pos + 1;
+
+    auto number = [&] ( uint32_t& n ) -> bool
+    {
+      const size_t from = i;
+
+      for ( n = 0; i < _src.size () && _src[i] >= '0' && _src[i] <= '9'; ++i )
+      {
+        n = min<uint32_t> ( n * 10 + ( _src[i] - '0' ), REGEXP_REPEAT_MAX + 1 );
+      }
+
+      return i > from;
+    };
+
+    if ( !number ( lo ) )
+    {
+      return false;
+    }
+
+    hi = lo;
+
+    if ( i < _src.size () && _src[i] == ',' )
+    {
+      i++;
+      hi = number ( hi ) ? hi : REGEXP_NONE;
+    }
+
+    if ( i >= _src.size () || _src[i] != '}' )
+    {
+      return false;
+    }
+
+    if ( lo > REGEXP_REPEAT_MAX || ( hi != REGEXP_NONE && ( hi > REGEXP_REPEAT_MAX || hi < lo ) ) )
+    {
+      throw runtime_error ( "RUNTIME_ERROR: Invalid repeat at " + to_string ( _pos ) );
+    }
+
+    _pos = i + 1;
+    return true;
+  }
+
+  /**
+   * x{2,4} -> x x (x (x)?)?, x{2,} -> x x+; f spans the instructions [first, size)
+   * every copy is cloned before anything is patched, the clones must see f unpatched
+   */
+  Frag repeat ( const Frag& f, uint32_t first, uint32_t lo, uint32_t hi )
+  {
+    const uint32_t last = static_cast<uint32_t> ( _nfa.insts.size () );
+
+    if ( lo == 0 && hi == 0 )
+    {
+      return epsilon ();
+    }
+
+    vector<Frag> x{ f };
+    const uint32_t total = hi == REGEXP_NONE ? max<uint32_t> ( lo, 1 ) : hi;
+
+    while ( x.size () < total )
+    {
+      x.push_back ( clone ( f, first, last ) );
+    }
+
+    Frag tail{ REGEXP_NONE, {} };
+
+    if ( hi == REGEXP_NONE )
+    {
+      tail = lo == 0 ? star ( x.back () ) : plus ( x.back () );
+      lo = lo == 0 ? 0 : lo - 1;
+    }
+    else if ( hi > lo )
+    {
+      tail = quest ( x[hi - 1] );
+
+      for ( uint32_t i = hi - 1; i-- > lo; )
+      {
+        patch ( x[i], tail.start );
+        tail = quest ( { x[i].start, move ( tail.outs ) } );
+      }
+    }
+
+    Frag out{ REGEXP_NONE, {} };
+
+    for ( uint32_t i = 0; i < lo; ++i )
+    {
+      if ( out.start == REGEXP_NONE )
+      {
+        out = x[i];
+      }
+      else
+      {
+        patch ( out, x[i].start );
+        out.outs = move ( x[i].outs );
+      }
+    }
+
+    if ( tail.start == REGEXP_NONE )
+    {
+      return out;
+    }
+
+    if ( out.start == REGEXP_NONE )
+    {
+      return tail;
+    }
+
+    patch ( out, tail.start );
+    out.outs = move ( tail.outs );
+
+    return out;
+  }
+
+  /**
+   * copies the unpatched fragment occupying [first, last), references inside the range are relocated
+   */
+  Frag clone ( const Frag& f, uint32_t first, uint32_t last )
+  {
+    const uint32_t delta = static_cast<uint32_t> ( _nfa.insts.size () ) - first;
+
+    if ( _nfa.insts.size () - _base + ( last - first ) > REGEXP_REPEAT_MAX * 64 )
+    {
+      throw runtime_error ( "RUNTIME_ERROR: Pattern too large" );
+    }
+
+    for ( uint32_t i = first; i < last; ++i )
+    {
+      RegexpNfa::Inst inst = _nfa.insts[i];
+
+      inst.out = ( inst.out != REGEXP_NONE && inst.out >= first && inst.out < last ) ? inst.out + delta : inst.out;
+      inst.out1 = ( inst.out1 != REGEXP_NONE && inst.out1 >= first && inst.out1 < last ) ? inst.out1 + delta : inst.out1;
+      _nfa.insts.push_back ( inst );
+    }
+
+    Frag c{ f.start + delta, {} };
+
+    for ( uint32_t o : f.outs )
+    {
+      c.outs.push_back ( o + ( delta << 1 ) );
+    }
+
+    return c;
+  }
+
+  Frag parseAtom ()
+  {
+    const char c = peek ();
+
+    switch ( c )
+    {
+      case '^':
+      case '$':
+      {
+        _pos++;
+        const uint32_t i = emit ( c == '^' ? RegexpNfa::Op::BEGIN : RegexpNfa::Op::END );
+        return { i, { i << 1 } };
+      }
+      case '.':
+        _pos++;
+        return ranges ( negate ( { { '\n', '\n' } } ) );
+      case '[':
+        return ranges ( parseClass () );
+      case '\\':
+      {
+        Ranges r;
+        parseEscape ( r );
+        return ranges ( r );
+      }
+      case '(':
+      {
+        _pos++;
+
+        if ( _src.substr ( _pos, 2 ) == "?:" )
+        {
+          _pos += 2;
+        }
+
+        Frag f = parseAlt ();
+
+        if ( !more () || peek () != ')' )
+        {
+          throw runtime_error ( "RUNTIME_ERROR: Missing ')'" );
+        }
+
+        _pos++;
+        return f;
+      }
+      case '*':
+      case '+':
+      case '?':
+      case ')':
+      case '|':
+        throw runtime_error ( "RUNTIME_ERROR: Unexpected '" + string ( 1, c ) + "' at " + to_string ( _pos ) );
+      default:
+      {
+        const uint32_t cp = decode ( _src, _pos );
+        return ranges ( { { cp, cp } } );
+      }
+    }
+  }
+
+  Ranges parseClass ()
+  {
+    Ranges r;
+    bool neg = false;
+
+    _pos++;
+
+    if ( more () && peek () == '^' )
+    {
+      neg = true;
+      _pos++;
+    }
+
+    for ( bool first = true; more () && ( peek () != ']' || first ); first = false )
+    {
+      uint32_t lo;
+
+      if ( peek () == '\\' )
+      {
+        if ( !parseEscape ( r, &lo ) )
+        {
+          continue;
+        }
+      }
+      else
+      {
+        lo = decode ( _src, _pos );
+      }
+
+      uint32_t hi = lo;
+
+      if ( _pos + 1 < _src.size () && peek () == '-' && _src[_pos + 1] != ']' )
+      {
+        _pos++;
+
+        if ( peek () == '\\' )
+        {
+          if ( !parseEscape ( r, &hi ) )
+          {
+            throw runtime_error ( "RUNTIME_ERROR: Invalid range in character class" );
+          }
+        }
+        else
+        {
+          hi = decode ( _src, _pos );
+        }
+
+        if ( hi < lo )
+        {
+          throw runtime_error ( "RUNTIME_ERROR: Invalid range in character class" );
+        }
+      }
+
+      r.push_back ( { lo, hi } );
+    }
+
+    if ( !more () )
+    {
+      throw runtime_error ( "RUNTIME_ERROR: [...]" );
+    }
+
+    _pos++;
+
+    return neg ? negate ( r ) : r;
+  }
+
+  /**
+   * appends the escape to r, or returns the single codepoint through cp (inside a class it may start a range)
+   */
+  bool parseEscape ( Ranges& r, uint32_t* cp = nullptr )
+  {
+    _pos++;
+
+    if ( !more () )
+    {
+      throw runtime_error ( "RUNTIME_ERROR: escape" );
+    }
+
+    const Ranges digit = { { '0', '9' } };
+    const Ranges word = { { '0', '9' }, { 'A', 'Z' }, { '_', '_' }, { 'a', 'z' } };
+    const Ranges space = { { '\t', '\r' }, { ' ', ' ' } };
+    const char c = peek ();
+    const Ranges* set = nullptr;
+    uint32_t single = 0;
+
+    if ( c == 'd' || c == 'D' )
+    {
+      set = &digit;
+    }
+    else if ( c == 'w' || c == 'W' )
+    {
+      set = &word;
+    }
+    else if ( c == 's' || c == 'S' )
+    {
+      set = &space;
+    }
+    else if ( c == 'n' || c == 'r' || c == 't' )
+    {
+      single = c == 'n' ? '\n' : c == 'r' ? '\r' : '\t';
+    }
+
+    if ( set || single )
+    {
+      _pos++;
+    }
+    else
+    {
+      single = decode ( _src, _pos );
+    }
+
+    if ( set )
+    {
+      const Ranges add = ( c >= 'A' && c <= 'Z' ) ? negate ( *set ) : *set;
+      r.insert ( r.end (), add.begin (), add.end () );
+      return false;
+    }
+
+    if ( cp )
+    {
+      *cp = single;
+      return true;
+    }
+
+    r.push_back ( { single, single } );
+    return false;
+  }
+
+  static Ranges normalize ( Ranges r )
+  {
+    Ranges out;
+
+    sort ( r.begin (), r.end () );
+
+    for ( const auto& x : r )
+    {
+      if ( !out.empty () && x.first <= out.back ().second + 1 )
+      {
+        out.back ().second = max ( out.back ().second, x.second );
+      }
+      else
+      {
+        out.push_back ( x );
+      }
+    }
+
+    return out;
+  }
+
+  /* complement over all scalar values, surrogates excluded */
+  static Ranges negate ( const Ranges& r )
+  {
+    Ranges out;
+    uint32_t next = 0;
+
+    for ( const auto& x : normalize ( r ) )
+    {
+      if ( x.first > next )
+      {
+        out.push_back ( { next, x.first - 1 } );
+      }
+
+      next = x.second + 1;
+    }
+
+    if ( next <= REGEXP_CODEPOINT_MAX )
+    {
+      out.push_back ( { next, REGEXP_CODEPOINT_MAX } );
+    }
+
+    Ranges valid;
+
+    for ( const auto& x : out )
+    {
+      if ( x.second < 0xD800 || x.first > 0xDFFF )
+      {
+        valid.push_back ( x );
+        continue;
+      }
+
+      if ( x.first < 0xD800 )
+      {
+        valid.push_back ( { x.first, 0xD7FF } );
+      }
+
+      if ( x.second > 0xDFFF )
+      {
+        valid.push_back ( { 0xE000, x.second } );
+      }
+    }
+
+    return valid;
+  }
+
+  /**
+   * codepoint ranges -> alternation of UTF-8 byte range sequences
+   */
+  Frag ranges ( const Ranges& r )
+  {
+    vector<vector<pair<uint8_t, uint8_t>>> seqs;
+
+    for ( const auto& x : normalize ( r ) )
+    {
+      utf8Sequences ( x.first, x.second, seqs );
+    }
+
+    if ( seqs.empty () )
+    {
+      throw runtime_error ( "RUNTIME_ERROR: Empty character class" );
+    }
+
+    Frag f{ REGEXP_NONE, {} };
+
+    for ( const auto& seq : seqs )
+    {
+      uint32_t first = REGEXP_NONE;
+      uint32_t prev = REGEXP_NONE;
+
+      for ( const auto& b : seq )
+      {
+        const uint32_t i = emit ( RegexpNfa::Op::BYTE, b.first, b.second );
+
+        if ( prev == REGEXP_NONE )
+        {
+          first = i;
+        }
+        else
+        {
+          _nfa.insts[prev].out = i;
+        }
+
+        prev = i;
+      }
+
+      f.outs.push_back ( prev << 1 );
+      f.start = f.start == REGEXP_NONE ? first : emit ( RegexpNfa::Op::SPLIT, 0, 0, f.start, first );
+    }
+
+    return f;
+  }
+
+  /* RE2 / Go utf8ranges: split until every piece is a product of byte ranges */
+  static void utf8Sequences ( uint32_t lo, uint32_t hi, vector<vector<pair<uint8_t, uint8_t>>>& out )
+  {
+    static const uint32_t limits[] = { 0x7F, 0x7FF, 0xFFFF };
+
+    for ( uint32_t m : limits )
+    {
+      if ( lo <= m && hi > m )
+      {
+        utf8Sequences ( lo, m, out );
+        utf8Sequences ( m + 1, hi, out );
+        return;
+      }
+    }
+
+    if ( hi < 0x80 )
+    {
+      out.push_back ( { { static_cast<uint8_t> ( lo ), static_cast<uint8_t> ( hi ) } } );
+      return;
+    }
+
+    for ( uint32_t i = 1; i < 4; ++i )
+    {
+      const uint32_t m = ( 1u << ( 6 * i ) ) - 1;
+
+      if ( ( lo & ~m ) != ( hi & ~m ) )
+      {
+        if ( ( lo & m ) != 0 )
+        {
+          utf8Sequences ( lo, lo | m, out );
+          utf8Sequences ( ( lo | m ) + 1, hi, out );
+          return;
+        }
+
+        if ( ( hi & m ) != m )
+        {
+          utf8Sequences ( lo, ( hi & ~m ) - 1, out );
+          utf8Sequences ( hi & ~m, hi, out );
+          return;
+        }
+      }
+    }
+
+    uint8_t a[4];
+    uint8_t b[4];
+    const size_t n = encode ( lo, a );
+
+    encode ( hi, b );
+
+    vector<pair<uint8_t, uint8_t>> seq;
+
+    for ( size_t i = 0; i < n; ++i )
+    {
+      seq.push_back ( { a[i], b[i] } );
+    }
+
+    out.push_back ( move ( seq ) );
+  }
+
+  static size_t encode ( uint32_t cp, uint8_t* b )
+  {
+    if ( cp < 0x80 )
+    {
+      b[0] = static_cast<uint8_t> ( cp );
+      return 1;
+    }
+
+    if ( cp < 0x800 )
+    {
+      b[0] = static_cast<uint8_t> ( 0xC0 | ( cp >> 6 ) );
+      b[1] = static_cast<uint8_t> ( 0x80 | ( cp & 0x3F ) );
+      return 2;
+    }
+
+    if ( cp < 0x10000 )
+    {
+      b[0] = static_cast<uint8_t> ( 0xE0 | ( cp >> 12 ) );
+      b[1] = static_cast<uint8_t> ( 0x80 | ( ( cp >> 6 ) & 0x3F ) );
+      b[2] = static_cast<uint8_t> ( 0x80 | ( cp & 0x3F ) );
+      return 3;
+    }
+
+    b[0] = static_cast<uint8_t> ( 0xF0 | ( cp >> 18 ) );
+    b[1] = static_cast<uint8_t> ( 0x80 | ( ( cp >> 12 ) & 0x3F ) );
+    b[2] = static_cast<uint8_t> ( 0x80 | ( ( cp >> 6 ) & 0x3F ) );
+    b[3] = static_cast<uint8_t> ( 0x80 | ( cp & 0x3F ) );
+    return 4;
+  }
+};
+
+/**
+ * REGEXP DFA
+ *
+ * subset construction of a RegexpNfa, built once and immutable afterwards (safe to share between threads)
+ * - bytes are mapped to equivalence classes: two bytes no BYTE instruction tells apart share a column
+ * - the transition table is dense, entries are the next row premultiplied by the class count,
+ *   the top bit flags an accepting row so the scan loop needs no second lookup
+ * - unanchored search: the NFA start is re-added to every state, so one pass finds a match at any offset
+ * - state 0 is dead, reached only when every thread died (patterns anchored with ^)
+ */
+class RegexpDfa
+{
+private:
+  static constexpr uint32_t ACCEPT = 0x80000000;
+
+  uint8_t _classes[256];
+  uint32_t _class_num = 0;
+  uint32_t _start = 0;
+  vector<uint32_t> _table;
+  vector<uint8_t> _accept;     /* by row: MATCH reached, the search can stop */
+  vector<uint8_t> _accept_end; /* by row: MATCH reached if the input ends here ($) */
+
+public:
+  /**
+   * nullptr when the DFA would exceed REGEXP_DFA_MAX_STATES
+   */
+  static unique_ptr<RegexpDfa> compile ( const RegexpNfa& nfa )
+  {
+    unique_ptr<RegexpDfa> dfa ( new RegexpDfa () );
+
+    return dfa->build ( nfa ) ? move ( dfa ) : nullptr;
+  }
+
+  bool search ( string_view text ) const
+  {
+    const uint8_t* p = reinterpret_cast<const uint8_t*> ( text.data () );
+    const uint8_t* end = p + text.size ();
+    uint32_t s = _start;
+
+    for ( ; p < end && !( s & ACCEPT ); ++p )
+    {
+      s = _table[s + _classes[*p]];
+
+      if ( s == 0 )
+      {
+        return false;
+      }
+    }
+
+    return ( s & ACCEPT ) || _accept_end[s / _class_num];
+  }
+
+  size_t states () const
+  {
+    return _accept.size ();
+  }
+
+  size_t classes () const
+  {
+    return _class_num;
+  }
+
+private:
+  using Set = vector<uint32_t>;
+
+  RegexpDfa () = default;
+
+  bool build ( const RegexpNfa& nfa )
+  {
+    bool overflow = false;
+    vector<uint8_t> rep;
+
+    nfa.byteClasses ( _classes, rep );
+    _class_num = static_cast<uint32_t> ( rep.size () );
+
+    map<Set, uint32_t> ids;
+    vector<Set> sets;
+    vector<uint8_t> seen ( nfa.insts.size (), 0 );
+    Set restart;
+
+    nfa.closure ( nfa.start, false, false, seen, restart );
+
+    auto intern = [&] ( Set&& s ) -> uint32_t
+    {
+      sort ( s.begin (), s.end () );
+      s.erase ( unique ( s.begin (), s.end () ), s.end () );
+
+      auto it = ids.find ( s );
+
+      if ( it != ids.end () )
+      {
+        return it->second;
+      }
+
+      if ( sets.size () >= REGEXP_DFA_MAX_STATES )
+      {
+        overflow = true;
+        return 0;
+      }
+
+      const uint32_t id = static_cast<uint32_t> ( sets.size () );
+
+      ids.emplace ( s, id );
+      sets.push_back ( move ( s ) );
+
+      return id;
+    };
+
+    intern ( Set () ); /* dead */
+
+    Set init;
+    nfa.closure ( nfa.start, true, false, seen, init );
+    init.push_back ( REGEXP_NONE ); /* the start row must not merge with a later row holding the same threads, $^ differs */
+    const uint32_t start = intern ( move ( init ) );
+
+    for ( uint32_t i = 0; i < sets.size () && !overflow; ++i )
+    {
+      const Set cur = sets[i];
+
+      _accept.push_back ( 0 );
+      _accept_end.push_back ( 0 );
+
+      for ( uint32_t pc : cur )
+      {
+        if ( pc == REGEXP_NONE )
+        {
+          continue;
+        }
+
+        const auto& inst = nfa.insts[pc];
+
+        if ( inst.op == RegexpNfa::Op::MATCH )
+        {
+          _accept[i] = 1;
+        }
+        else if ( inst.op == RegexpNfa::Op::END )
+        {
+          Set tail;
+          nfa.closure ( inst.out, i == start, true, seen, tail );
+
+          for ( uint32_t t : tail )
+          {
+            _accept_end[i] |= nfa.insts[t].op == RegexpNfa::Op::MATCH;
+          }
+        }
+      }
+
+      _accept_end[i] |= _accept[i];
+
+      for ( uint32_t c = 0; c < _class_num; ++c )
+      {
+        Set next;
+
+        if ( i != 0 )
+        {
+          for ( uint32_t pc : cur )
+          {
+            if ( pc == REGEXP_NONE )
+            {
+              continue;
+            }
+
+            const auto& inst = nfa.insts[pc];
+
+            if ( inst.op == RegexpNfa::Op::BYTE && inst.lo <= rep[c] && rep[c] <= inst.hi )
+            {
+              nfa.closure ( inst.out, false, false, seen, next );
+            }
+          }
+
+          next.insert ( next.end (), restart.begin (), restart.end () );
+        }
+
+        _table.push_back ( intern ( move ( next ) ) );
+      }
+    }
+
+    if ( overflow )
+    {
+      return false;
+    }
+
+    for ( auto& t : _table )
+    {
+      t = ( t * _class_num ) | ( _accept[t] ? ACCEPT : 0 );
+    }
+
+    _start = ( start * _class_num ) | ( _accept[start] ? ACCEPT : 0 );
+    return true;
+  }
+
+};
+
+/**
+ * REGEXP PIKE VM
+ *
+ * lock-step simulation of the NFA (Thompson / Pike), O(text * insts) for any pattern,
+ * used when the DFA would be too large. groups do not capture, so a thread is only its pc.
+ * the thread lists live in per-thread scratch buffers, a search allocates only while they grow
+ */
+class RegexpPikeVm
+{
+private:
+  struct Scratch
+  {
+    vector<uint32_t> mark;
+    vector<uint32_t> stack;
+    vector<uint32_t> cur;
+    vector<uint32_t> next;
+    uint32_t gen = 0;
+  };
+
+public:
+  static bool search ( const RegexpNfa& nfa, string_view text )
+  {
+    static thread_local Scratch sc;
+    const uint8_t* p = reinterpret_cast<const uint8_t*> ( text.data () );
+    const size_t n = text.size ();
+
+    if ( sc.mark.size () < nfa.insts.size () )
+    {
+      sc.mark.resize ( nfa.insts.size (), 0 );
+    }
+
+    sc.cur.clear ();
+    generation ( sc );
+
+    if ( add ( nfa, sc, sc.cur, nfa.start, true, n == 0 ) )
+    {
+      return true;
+    }
+
+    for ( size_t i = 0; i < n; ++i )
+    {
+      const bool end = i + 1 == n;
+
+      sc.next.clear ();
+      generation ( sc );
+
+      for ( uint32_t pc : sc.cur )
+      {
+        const auto& inst = nfa.insts[pc];
+
+        if ( p[i] >= inst.lo && p[i] <= inst.hi && add ( nfa, sc, sc.next, inst.out, false, end ) )
+        {
+          return true;
+        }
+      }
+
+      if ( add ( nfa, sc, sc.next, nfa.start, false, end ) )
+      {
+        return true;
+      }
+
+      sc.cur.swap ( sc.next );
+    }
+
+    return false;
+  }
+
+private:
+  /**
+   * one generation per thread list, marks of older lists (or of other programs) never equal it
+   */
+  static void generation ( Scratch& sc )
+  {
+    if ( ++sc.gen == 0 )
+    {
+      fill ( sc.mark.begin (), sc.mark.end (), 0 );
+      sc.gen = 1;
+    }
+  }
+
+  /**
+   * follows epsilons from pc, keeps BYTE threads, true as soon as MATCH is reachable
+   */
+  static bool add ( const RegexpNfa& nfa, Scratch& sc, vector<uint32_t>& list, uint32_t pc, bool begin, bool end )
+  {
+    sc.stack.assign ( 1, pc );
+
+    while ( !sc.stack.empty () )
+    {
+      const uint32_t i = sc.stack.back ();
+
+      sc.stack.pop_back ();
+
+      if ( i == REGEXP_NONE || sc.mark[i] == sc.gen )
+      {
+        continue;
+      }
+
+      sc.mark[i] = sc.gen;
+
+      const auto& inst = nfa.insts[i];
+
+      switch ( inst.op )
+      {
+        case RegexpNfa::Op::BYTE:
+          list.push_back ( i );
+          break;
+        case RegexpNfa::Op::SPLIT:
+          sc.stack.push_back ( inst.out1 );
+          sc.stack.push_back ( inst.out );
+          break;
+        case RegexpNfa::Op::BEGIN:
+          if ( begin )
+          {
+            sc.stack.push_back ( inst.out );
+          }
+          break;
+        case RegexpNfa::Op::END:
+          if ( end )
+          {
+            sc.stack.push_back ( inst.out );
+          }
+          break;
+        case RegexpNfa::Op::MATCH:
+          return true;
+      }
+    }
+
+    return false;
+  }
+};
+
+/**
+ * REGEXP PROGRAM
+ *
+ * compiled pattern: the NFA and, unless it is too large, its DFA. immutable, share it between threads
+ * - a pattern without metacharacters is searched as a literal (RegexpLiteral)
+ * - search () does not allocate
+ */
+class RegexpProgram
+{
+private:
+  RegexpNfa _nfa;
+  unique_ptr<RegexpDfa> _dfa;
+  unique_ptr<RegexpLiteral> _literal;
+
+public:
+  explicit RegexpProgram ( string_view pattern ) : _nfa ( RegexpParser::compile ( pattern ) ), _dfa ( RegexpDfa::compile ( _nfa ) )
+  {
+    if ( isLiteral ( pattern ) )
+    {
+      _literal.reset ( new RegexpLiteral ( pattern ) );
+    }
+  }
+
+  bool search ( string_view text ) const
+  {
+    if ( _literal )
+    {
+      return _literal->search ( text );
+    }
+
+    if ( _dfa )
+    {
+      return _dfa->search ( text );
+    }
+
+    return RegexpPikeVm::search ( _nfa, text );
+  }
+
+  bool hasDfa () const
+  {
+    return _dfa != nullptr;
+  }
+
+  const RegexpLiteral* literal () const
+  {
+    return _literal.get ();
+  }
+
+  const RegexpNfa& nfa () const
+  {
+    return _nfa;
+  }
+
+  static bool isLiteral ( string_view pattern )
+  {
+    return pattern.find_first_of ( "[]\\*+?{}()^$.|" ) == string_view::npos;
+  }
+};
+
+#endif
@@ -0,0 +1,467 @@
+#ifndef REGEXP_SET_HPP
+#define REGEXP_SET_HPP
+
+#include "RegexpProgram.hpp"
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+using namespace std;
+
+constexpr size_t REGEXP_SET_MAX_STATES = 4096;
+
+/**
+ * REGEXP SET
+ *
+ * N patterns compiled into one automaton, one pass over the text returns the bitset of every pattern that matches
+ * (unanchored, same semantics as RegexpMatch::test)
+ * - the patterns share one NFA, each MATCH carries its pattern id
+ * - the DFA is built lazily: a row is created the first time the scan needs it, the transition table is
+ *   preallocated and read without locks, only a missing transition takes the mutex
+ * - a row records the patterns matched on entering it and the patterns that match if the text ends there,
+ *   the scan ORs a row's bits only when the entry is flagged, so a step costs one lookup whatever the rule count
+ * - once REGEXP_SET_MAX_STATES rows exist, the rows are flushed and the scan goes on from its current threads (as RE2
+ *   does). a scan holds a shared lock, a flush waits for the running scans. a scan that fills the rows again after
+ *   its flush falls back to NFA simulation for the rest of the text
+ */
+class RegexpSet
+{
+private:
+  using Set = vector<uint32_t>;
+
+  static constexpr uint32_t ACCEPT = 0x80000000;
+  static constexpr uint32_t UNKNOWN = 0x7FFFFFFF;
+
+  RegexpNfa _nfa;
+  size_t _size;
+  size_t _words;
+  uint8_t _classes[256];
+  uint32_t _class_num;
+  vector<uint8_t> _rep;
+  uint32_t _start;
+  Set _restart;
+  unique_ptr<atomic<uint32_t>[]> _table; /* row * class_num + class -> next row * class_num | ACCEPT */
+  unique_ptr<uint64_t[]> _accept;        /* row * words: matched on entering the row */
+  unique_ptr<uint64_t[]> _accept_end;    /* row * words: matched if the text ends in the row */
+
+  /* lazily built rows */
+  mutable shared_mutex _flush; /* shared by a scan, exclusive to flush the rows */
+  mutable mutex _mutex;
+  mutable map<Set, uint32_t> _ids;
+  mutable vector<Set> _sets;
+  mutable vector<uint8_t> _flags;
+  mutable vector<uint8_t> _seen;
+
+public:
+  explicit RegexpSet ( const vector<string>& patterns ) : _size ( patterns.size () ), _words ( ( patterns.size () + 63 ) / 64 )
+  {
+    if ( patterns.empty () )
+    {
+      throw invalid_argument ( "Pattern set cannot be empty" );
+    }
+
+    uint32_t start = REGEXP_NONE;
+
+    for ( size_t i = 0; i < patterns.size (); ++i )
+    {
+      if ( patterns[i].empty () )
+      {
+        throw invalid_argument ( "Pattern cannot be empty" );
+      }
+
+      uint32_t s;
+
+      try
+      {
+        s = RegexpParser::append ( _nfa, patterns[i], static_cast<uint32_t> ( i ) );
+      }
+      catch ( const exception& e )
+      {
+        throw runtime_error ( "RUNTIME_ERROR: pattern " + to_string ( i ) + ": " + e.what () );
+      }
+
+      if ( start != REGEXP_NONE )
+      {
+        _nfa.insts.push_back ( { RegexpNfa::Op::SPLIT, 0, 0, start, s } );
+        s = static_cast<uint32_t> ( _nfa.insts.size () - 1 );
+      }
+
+      start = s;
+    }
+
+    _nfa.start = start;
+    _nfa.byteClasses ( _classes, _rep );
+    _class_num = static_cast<uint32_t> ( _rep.size () );
+    _table.reset ( new atomic<uint32_t>[REGEXP_SET_MAX_STATES * _class_num] );
+    _accept.reset ( new uint64_t[REGEXP_SET_MAX_STATES * _words] () );
+    _accept_end.reset ( new uint64_t[REGEXP_SET_MAX_STATES * _words] () );
+
+    for ( size_t i = 0; i < REGEXP_SET_MAX_STATES * _class_num; ++i )
+    {
+      _table[i].store ( UNKNOWN, memory_order_relaxed );
+    }
+
+    _seen.assign ( _nfa.insts.size (), 0 );
+    _nfa.closure ( _nfa.start, false, false, _seen, _restart );
+
+    intern ( Set () ); /* dead */
+
+    Set init;
+
+    _nfa.closure ( _nfa.start, true, false, _seen, init );
+    init.push_back ( REGEXP_NONE ); /* start row, see RegexpDfa */
+    _start = entry ( intern ( move ( init ) ) );
+  }
+
+  RegexpSet ( const RegexpSet& ) = delete;
+  RegexpSet& operator= ( const RegexpSet& ) = delete;
+
+  /**
+   * bits[i / 64] >> (i % 64) & 1 is set when pattern i matches text
+   */
+  void match ( string_view text, vector<uint64_t>& bits ) const
+  {
+    const uint8_t* p = reinterpret_cast<const uint8_t*> ( text.data () );
+    const uint8_t* end = p + text.size ();
+    uint32_t s = _start;
+    bool flushed = false;
+
+    bits.assign ( _words, 0 );
+
+    /* @MUTEX-LOCK */
+    shared_lock<shared_mutex> scan ( _flush );
+
+    for ( ; p < end; ++p )
+    {
+      if ( s & ACCEPT )
+      {
+        merge ( _accept.get (), s, bits );
+      }
+
+      const uint32_t row = s & ~ACCEPT;
+
+      if ( row == 0 )
+      {
+        return;
+      }
+
+      uint32_t next = _table[row + _classes[*p]].load ( memory_order_acquire );
+
+      if ( next == UNKNOWN && ( next = step ( row, *p ) ) == UNKNOWN )
+      {
+        Set set = threads ( row );
+
+        if ( !flushed )
+        {
+          scan.unlock ();
+          flush ();
+          scan.lock ();
+          flushed = true;
+          next = restore ( set, *p );
+        }
+
+        if ( next == UNKNOWN )
+        {
+          simulate ( move ( set ), p, end, bits );
+          return;
+        }
+      }
+
+      s = next;
+    }
+
+    if ( s & ACCEPT )
+    {
+      merge ( _accept.get (), s, bits );
+    }
+
+    merge ( _accept_end.get (), s, bits );
+  }
+
+  vector<size_t> match ( string_view text ) const
+  {
+    vector<uint64_t> bits;
+    vector<size_t> out;
+
+    match ( text, bits );
+
+    for ( size_t i = 0; i < _size; ++i )
+    {
+      if ( has ( bits, i ) )
+      {
+        out.push_back ( i );
+      }
+    }
+
+    return out;
+  }
+
+  static bool has ( const vector<uint64_t>& bits, size_t i )
+  {
+    return ( bits[i >> 6] >> ( i & 63 ) ) & 1;
+  }
+
+  size_t size () const
+  {
+    return _size;
+  }
+
+  /**
+   * DFA rows built so far
+   */
+  size_t states () const
+  {
+    /* @MUTEX-LOCK */
+    lock_guard<mutex> lock ( _mutex );
+    return _sets.size ();
+  }
+
+private:
+  void merge ( const uint64_t* src, uint32_t s, vector<uint64_t>& bits ) const
+  {
+    const uint64_t* row = src + ( ( s & ~ACCEPT ) / _class_num ) * _words;
+
+    for ( size_t i = 0; i < _words; ++i )
+    {
+      bits[i] |= row[i];
+    }
+  }
+
+  uint32_t entry ( uint32_t row ) const
+  {
+    return ( row * _class_num ) | ( _flags[row] ? ACCEPT : 0 );
+  }
+
+  /**
+   * builds the missing transition, UNKNOWN when the row budget is used up
+   */
+  uint32_t step ( uint32_t row, uint8_t byte ) const
+  {
+    const uint32_t c = _classes[byte];
+
+    /* @MUTEX-LOCK */
+    lock_guard<mutex> lock ( _mutex );
+    uint32_t next = _table[row + c].load ( memory_order_relaxed );
+
+    if ( next != UNKNOWN )
+    {
+      return next;
+    }
+
+    Set set = advance ( _sets[row / _class_num], _rep[c], false, _seen );
+    const uint32_t r = intern ( move ( set ) );
+
+    if ( r == REGEXP_NONE )
+    {
+      return UNKNOWN;
+    }
+
+    next = entry ( r );
+    _table[row + c].store ( next, memory_order_release );
+
+    return next;
+  }
+
+  /**
+   * threads of cur after consuming byte, with the pattern starts re-added (unanchored search)
+   */
+  Set advance ( const Set& cur, uint8_t byte, bool end, vector<uint8_t>& seen ) const
+  {
+    Set next;
+
+    if ( cur.empty () )
+    {
+      return next;
+    }
+
+    for ( uint32_t pc : cur )
+    {
+      if ( pc == REGEXP_NONE )
+      {
+        continue;
+      }
+
+      const auto& inst = _nfa.insts[pc];
+
+      if ( inst.op == RegexpNfa::Op::BYTE && inst.lo <= byte && byte <= inst.hi )
+      {
+        _nfa.closure ( inst.out, false, end, seen, next );
+      }
+    }
+
+    if ( end )
+    {
+      /* a restart at the very end only matches through patterns that accept the empty string */
+      _nfa.closure ( _nfa.start, false, true, seen, next );
+    }
+    else
+    {
+      next.insert ( next.end (), _restart.begin (), _restart.end () );
+    }
+
+    return next;
+  }
+
+  Set threads ( uint32_t row ) const
+  {
+    /* @MUTEX-LOCK */
+    lock_guard<mutex> lock ( _mutex );
+    return _sets[row / _class_num];
+  }
+
+  /**
+   * drops every row but the dead and start rows, the caller holds no scan lock
+   */
+  void flush () const
+  {
+    /* @MUTEX-LOCK */
+    unique_lock<shared_mutex> all ( _flush );
+    lock_guard<mutex> lock ( _mutex );
+
+    if ( _sets.size () < REGEXP_SET_MAX_STATES )
+    {
+      return; /* flushed by another scan meanwhile */
+    }
+
+    Set init = move ( _sets[( _start & ~ACCEPT ) / _class_num] );
+
+    for ( size_t i = 0; i < REGEXP_SET_MAX_STATES * _class_num; ++i )
+    {
+      _table[i].store ( UNKNOWN, memory_order_relaxed );
+    }
+
+    fill ( _accept.get (), _accept.get () + REGEXP_SET_MAX_STATES * _words, 0 );
+    fill ( _accept_end.get (), _accept_end.get () + REGEXP_SET_MAX_STATES * _words, 0 );
+    _ids.clear ();
+    _sets.clear ();
+    _flags.clear ();
+
+    /* same order as the constructor, so the start row keeps its index */
+    intern ( Set () );
+    intern ( move ( init ) );
+  }
+
+  /**
+   * the transition on byte from a row holding set (threads of a row from before a flush)
+   */
+  uint32_t restore ( const Set& set, uint8_t byte ) const
+  {
+    uint32_t row;
+
+    {
+      /* @MUTEX-LOCK */
+      lock_guard<mutex> lock ( _mutex );
+      row = intern ( Set ( set ) );
+    }
+
+    return row == REGEXP_NONE ? UNKNOWN : step ( row * _class_num, byte );
+  }
+
+  uint32_t intern ( Set&& s ) const
+  {
+    sort ( s.begin (), s.end () );
+    s.erase ( unique ( s.begin (), s.end () ), s.end () );
+
+    auto it = _ids.find ( s );
+
+    if ( it != _ids.end () )
+    {
+      return it->second;
+    }
+
+    if ( _sets.size () >= REGEXP_SET_MAX_STATES )
+    {
+      return REGEXP_NONE;
+    }
+
+    const uint32_t row = static_cast<uint32_t> ( _sets.size () );
+    const bool begin = !s.empty () && s.back () == REGEXP_NONE;
+    uint64_t* accept = _accept.get () + row * _words;
+    uint64_t* accept_end = _accept_end.get () + row * _words;
+    bool any = false;
+
+    for ( uint32_t pc : s )
+    {
+      if ( pc == REGEXP_NONE )
+      {
+        continue;
+      }
+
+      const auto& inst = _nfa.insts[pc];
+
+      if ( inst.op == RegexpNfa::Op::MATCH )
+      {
+        accept[inst.out >> 6] |= 1ULL << ( inst.out & 63 );
+        any = true;
+      }
+      else if ( inst.op == RegexpNfa::Op::END )
+      {
+        Set tail;
+
+        _nfa.closure ( inst.out, begin, true, _seen, tail );
+
+        for ( uint32_t t : tail )
+        {
+          if ( _nfa.insts[t].op == RegexpNfa::Op::MATCH )
+          {
+            accept_end[_nfa.insts[t].out >> 6] |= 1ULL << ( _nfa.insts[t].out & 63 );
+          }
+        }
+      }
+    }
+
+    _ids.emplace ( s, row );
+    _sets.push_back ( move ( s ) );
+    _flags.push_back ( any ? 1 : 0 );
+
+    return row;
+  }
+
+  /**
+   * NFA simulation from the threads of a row for the rest of the text, used once the DFA rows are exhausted.
+   * closure () only dedupes within one call, so each step's threads are deduped with a mark per instruction
+   * (the step number) as the Pike VM does, and only BYTE threads are carried to the next step
+   */
+  void simulate ( Set cur, const uint8_t* p, const uint8_t* end, vector<uint64_t>& bits ) const
+  {
+    vector<uint8_t> seen ( _nfa.insts.size (), 0 );
+    vector<size_t> mark ( _nfa.insts.size (), 0 );
+
+    for ( size_t gen = 1; p < end; ++p, ++gen )
+    {
+      const Set next = advance ( cur, *p, p + 1 == end, seen );
+
+      cur.clear ();
+
+      for ( uint32_t pc : next )
+      {
+        if ( mark[pc] == gen )
+        {
+          continue;
+        }
+
+        mark[pc] = gen;
+
+        const auto& inst = _nfa.insts[pc];
+
+        if ( inst.op == RegexpNfa::Op::MATCH )
+        {
+          bits[inst.out >> 6] |= 1ULL << ( inst.out & 63 );
+        }
+        else if ( inst.op == RegexpNfa::Op::BYTE )
+        {
+          cur.push_back ( pc );
+        }
+      }
+    }
+  }
+};
+
+#endif
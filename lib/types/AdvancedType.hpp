@@ -85,7 +85,7 @@ private:
     asm volatile (
 
         // value --> eax32
-        "mov %1, %%eax\n\t"
+        "mov %3, %%eax\n\t"
 
         // MOV LSB
         "mov %%al, %0\n\t"